@@ -0,0 +1,191 @@
+/**
+ * @file async_deque_bench.cpp
+ * @brief Throughput benchmarks for AsyncDeque
+ *
+ * Each benchmark moves a fixed batch of items from P producer threads to
+ * C consumer threads through one queue. The threads are spawned once per
+ * benchmark and reused by every iteration, so thread creation is not timed.
+ * It reports items per second and a few DequeStats ratios and hardware
+ * counters (see perf_counters.hpp) per item. The matrix covers:
+ * - topology: SPSC, MPSC, SPMC, MPMC with up to 64 threads
+ * - capacity: 1, 16, 1024, unbounded
+ * - payload: int, 64B, 512B, 4KB
+ * - end: FIFO (push_back/pop_front) and LIFO (push_back/pop_back)
+ * - call: blocking (push_back/pop_*) and timed (try_push_back/try_pop_*)
+ *
+ * Names look like Throughput/MPSC/64B/fifo/blocking/producers:4/consumers:1/capacity:16.
+ * Select a slice with --benchmark_filter, e.g.
+ *   async_deque_bench --benchmark_filter='SPSC/int/.*capacity:1024'
+ * The bench_json target runs everything and writes async_deque_bench.json.
+ */
+#include <benchmark/benchmark.h>
+#include <async_deque/async_deque.hpp>
+
+#include "bench_common.hpp"
+#include "perf_counters.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace async_deque;
+using namespace std::chrono_literals;
+
+namespace {
+
+enum class End { fifo, lifo };
+enum class Call { blocking, timed };
+
+struct Config {
+    std::string topology;
+    int producers;
+    int consumers;
+    size_t capacity;    ///< 0 = unbounded
+    End end;
+    Call call;
+};
+
+template<typename T>
+bool produce(AsyncDeque<T>& queue, T item, Call call) {
+    if (call == Call::blocking) {
+        return queue.push_back(std::move(item));
+    }
+    while (!queue.try_push_back(item, 10ms)) {
+        if (queue.is_closed()) return false;
+    }
+    return true;
+}
+
+template<typename T>
+bool consume(AsyncDeque<T>& queue, End end, Call call) {
+    if (call == Call::blocking) {
+        auto item = end == End::fifo ? queue.pop_front() : queue.pop_back();
+        if (item) benchmark::DoNotOptimize(*item);
+        return item.has_value();
+    }
+    for (;;) {
+        auto item = end == End::fifo ? queue.try_pop_front(10ms) : queue.try_pop_back(10ms);
+        if (item) {
+            benchmark::DoNotOptimize(*item);
+            return true;
+        }
+        if (queue.is_closed() && queue.empty()) return false;
+    }
+}
+
+/// Items moved per iteration; smaller for large payloads to bound memory and run time
+template<typename T>
+constexpr int items_per_round() {
+    return sizeof(T) >= 4096 ? 1 << 13 : 1 << 15;
+}
+
+template<typename T>
+void run_throughput(benchmark::State& state, const Config& config) {
+    const int total = items_per_round<T>();
+    const int per_producer = total / config.producers;
+    const int moved = per_producer * config.producers;
+    DequeStats totals;
+    bench::PerfCounters perf;
+
+    // Set before each round; run_round() orders these writes before the workers read them
+    std::unique_ptr<AsyncDeque<T>> queue;
+    std::atomic<int> producers_left{0};
+    bench::RoundWorkers workers(config.consumers + config.producers, [&](int index) {
+        if (index < config.consumers) {
+            while (consume(*queue, config.end, config.call)) {
+            }
+            return;
+        }
+        for (int i = 0; i < per_producer; ++i) {
+            produce(*queue, T(static_cast<uint64_t>(i)), config.call);
+        }
+        if (producers_left.fetch_sub(1) == 1) queue->close();
+    });
+
+    perf.start();
+    for (auto _ : state) {
+        queue = std::make_unique<AsyncDeque<T>>(
+            config.capacity == 0 ? std::numeric_limits<size_t>::max() : config.capacity);
+        producers_left = config.producers;
+        workers.run_round();
+
+        const DequeStats stats = queue->stats();
+        totals.lock_contentions += stats.lock_contentions;
+        totals.producer_wasted_wakeups += stats.producer_wasted_wakeups;
+        totals.consumer_wasted_wakeups += stats.consumer_wasted_wakeups;
+        totals.producer_blocks += stats.producer_blocks;
+        totals.consumer_blocks += stats.consumer_blocks;
+    }
+    workers.join();
+    const bench::PerfSample sample = perf.stop();
+
+    const double items = static_cast<double>(state.iterations()) * moved;
+    state.SetItemsProcessed(static_cast<int64_t>(items));
+    state.SetBytesProcessed(static_cast<int64_t>(items * sizeof(T)));
+    state.counters["contended/item"] = totals.lock_contentions / items;
+    state.counters["blocks/item"] = (totals.producer_blocks + totals.consumer_blocks) / items;
+    state.counters["wasted_wakeups/item"] =
+        (totals.producer_wasted_wakeups + totals.consumer_wasted_wakeups) / items;
+    bench::report_per_item(state, sample, items);
+}
+
+template<typename T>
+void register_payload(const std::string& payload, const Config& config) {
+    std::string name = "Throughput/" + config.topology + "/" + payload + "/" +
+                       (config.end == End::fifo ? "fifo" : "lifo") + "/" +
+                       (config.call == Call::blocking ? "blocking" : "timed") +
+                       "/producers:" + std::to_string(config.producers) +
+                       "/consumers:" + std::to_string(config.consumers) + "/capacity:" +
+                       (config.capacity == 0 ? std::string("unbounded")
+                                             : std::to_string(config.capacity));
+    benchmark::RegisterBenchmark(name.c_str(), [config](benchmark::State& state) {
+        run_throughput<T>(state, config);
+    })->UseRealTime()->Unit(benchmark::kMicrosecond);
+}
+
+void register_matrix() {
+    struct Shape {
+        const char* topology;
+        int producers;
+        int consumers;
+    };
+    std::vector<Shape> shapes = {{"SPSC", 1, 1}};
+    for (int n : {2, 4, 8, 16, 32, 63}) {
+        shapes.push_back({"MPSC", n, 1});
+        shapes.push_back({"SPMC", 1, n});
+    }
+    for (int n : {2, 4, 8, 16, 32}) {
+        shapes.push_back({"MPMC", n, n});
+    }
+
+    for (const Shape& shape : shapes) {
+        for (size_t capacity : {size_t{1}, size_t{16}, size_t{1024}, size_t{0}}) {
+            for (End end : {End::fifo, End::lifo}) {
+                for (Call call : {Call::blocking, Call::timed}) {
+                    const Config config{shape.topology, shape.producers, shape.consumers,
+                                        capacity, end, call};
+                    register_payload<int>("int", config);
+                    register_payload<bench::Payload<64>>("64B", config);
+                    register_payload<bench::Payload<512>>("512B", config);
+                    register_payload<bench::Payload<4096>>("4KB", config);
+                }
+            }
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    register_matrix();
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,190 @@
+/**
+ * @file async_deque_latency.cpp
+ * @brief Latency benchmarks for AsyncDeque
+ *
+ * Two measurements, both reported as percentile counters in nanoseconds
+ * (p50, p90, p99, p99.9, p99.99, max, mean):
+ *
+ * - PingPong: one thread pushes into queue A and blocks on queue B; an echo
+ *   thread moves each item from A to B. Every sample is one round trip, i.e.
+ *   two push-to-blocked-pop handoffs. The two threads are pinned to
+ *   different CPUs (cross_cpu) or to the same CPU (same_cpu).
+ *
+ * - OneWay: producers stamp each item with the steady clock right before
+ *   push_back() and one consumer blocked in pop_front() records the age of
+ *   each item it receives. The load levels are:
+ *   - idle: one producer, 50us between items, so the consumer is always
+ *     blocked when an item arrives and the sample is pure wakeup latency
+ *   - moderate: four producers, 20us between items each
+ *   - saturated: four producers pushing as fast as they can into a queue of
+ *     capacity 1024, so samples include the time spent queued
+ *   The consumer is pinned to CPU 1 and the producers to CPUs 0, 2, 3, ...;
+ *   the pinned counter is 0 if any of them could not be pinned.
+ *
+ * Hardware counters and context switches per sample are reported as in
+ * async_deque_bench.
+ *
+ * Example:
+ *   async_deque_latency --benchmark_filter=OneWay/idle
+ */
+#include <benchmark/benchmark.h>
+#include <async_deque/async_deque.hpp>
+#include <async_deque/stats.hpp>
+
+#include "bench_common.hpp"
+#include "perf_counters.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace async_deque;
+
+namespace {
+
+struct Stamped {
+    uint64_t sent_ns = 0;
+};
+
+void report_percentiles(benchmark::State& state, const bench::LatencyHistogram& histogram) {
+    const HistogramSnapshot snap = histogram.snapshot();
+    state.counters["p50_ns"] = static_cast<double>(snap.percentile(0.50));
+    state.counters["p90_ns"] = static_cast<double>(snap.percentile(0.90));
+    state.counters["p99_ns"] = static_cast<double>(snap.percentile(0.99));
+    state.counters["p99.9_ns"] = static_cast<double>(snap.percentile(0.999));
+    state.counters["p99.99_ns"] = static_cast<double>(snap.percentile(0.9999));
+    state.counters["max_ns"] = static_cast<double>(snap.max);
+    state.counters["mean_ns"] = snap.mean();
+}
+
+void BM_PingPong(benchmark::State& state, int echo_cpu) {
+    AsyncDeque<Stamped> ping;
+    AsyncDeque<Stamped> pong;
+    std::atomic<bool> echo_pinned{false};
+    const bench::AffinityGuard restore_affinity;
+    const bool pinned = bench::pin_to_cpu(0);
+    auto histogram = std::make_unique<bench::LatencyHistogram>();
+
+    // Started before the echo thread exists and stopped after it has exited,
+    // so its half of each round trip is counted too
+    bench::PerfCounters perf;
+    perf.start();
+    std::thread echo([&] {
+        echo_pinned = bench::pin_to_cpu(echo_cpu);
+        while (auto item = ping.pop_front()) {
+            pong.push_back(*item);
+        }
+    });
+
+    for (auto _ : state) {
+        const uint64_t start = detail::steady_now_ns();
+        ping.push_back(Stamped{start});
+        auto item = pong.pop_front();
+        benchmark::DoNotOptimize(item);
+        histogram->record(detail::steady_now_ns() - start);
+    }
+    ping.close();
+    echo.join();
+    const bench::PerfSample sample = perf.stop();
+
+    state.SetItemsProcessed(state.iterations());
+    state.counters["pinned"] = pinned && echo_pinned;
+    report_percentiles(state, *histogram);
+    bench::report_per_item(state, sample, static_cast<double>(state.iterations()));
+}
+
+struct Load {
+    const char* name;
+    int producers;
+    uint64_t gap_ns;    ///< Time between items of one producer; 0 = flat out
+    size_t capacity;
+};
+
+void BM_OneWay(benchmark::State& state, Load load) {
+    constexpr int items_per_round = 2048;
+    const int per_producer = items_per_round / load.producers;
+    auto histogram = std::make_unique<bench::LatencyHistogram>();
+    bench::PerfCounters perf;
+
+    // Worker 0 is the consumer, on CPU 1; producer p is on CPU 0 for the
+    // first and p + 1 after that. Each worker pins itself in its first round.
+    const int workers_count = load.producers + 1;
+    std::vector<char> pin_tried(workers_count, 0);
+    std::atomic<bool> all_pinned{true};
+    auto pin_once = [&](int index) {
+        if (pin_tried[index]) return;
+        pin_tried[index] = 1;
+        const int cpu = index == 0 ? 1 : index == 1 ? 0 : index;
+        if (!bench::pin_to_cpu(cpu)) all_pinned = false;
+    };
+
+    // Set before each round; run_round() orders these writes before the workers read them
+    std::unique_ptr<AsyncDeque<Stamped>> queue;
+    std::atomic<int> producers_left{0};
+    bench::RoundWorkers workers(workers_count, [&](int index) {
+        pin_once(index);
+        if (index == 0) {
+            while (auto item = queue->pop_front()) {
+                histogram->record(detail::steady_now_ns() - item->sent_ns);
+            }
+            return;
+        }
+        uint64_t next = detail::steady_now_ns();
+        for (int i = 0; i < per_producer; ++i) {
+            if (load.gap_ns != 0) {
+                next += load.gap_ns;
+                bench::spin_until(next);
+            }
+            queue->push_back(Stamped{detail::steady_now_ns()});
+        }
+        if (producers_left.fetch_sub(1) == 1) queue->close();
+    });
+
+    perf.start();
+    for (auto _ : state) {
+        queue = std::make_unique<AsyncDeque<Stamped>>(load.capacity);
+        producers_left = load.producers;
+        workers.run_round();
+    }
+    workers.join();
+    const bench::PerfSample sample = perf.stop();
+
+    const double items = static_cast<double>(state.iterations()) * per_producer * load.producers;
+    state.SetItemsProcessed(static_cast<int64_t>(items));
+    state.counters["pinned"] = all_pinned.load();
+    report_percentiles(state, *histogram);
+    bench::report_per_item(state, sample, items);
+}
+
+void register_all() {
+    benchmark::RegisterBenchmark("PingPong/cross_cpu", BM_PingPong, 1)
+        ->UseRealTime()->Unit(benchmark::kMicrosecond);
+    benchmark::RegisterBenchmark("PingPong/same_cpu", BM_PingPong, 0)
+        ->UseRealTime()->Unit(benchmark::kMicrosecond);
+
+    const Load loads[] = {
+        {"idle", 1, 50000, std::numeric_limits<size_t>::max()},
+        {"moderate", 4, 20000, std::numeric_limits<size_t>::max()},
+        {"saturated", 4, 0, 1024},
+    };
+    for (const Load& load : loads) {
+        benchmark::RegisterBenchmark((std::string("OneWay/") + load.name).c_str(), BM_OneWay, load)
+            ->UseRealTime()->Unit(benchmark::kMillisecond)->MinTime(0.5);
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    register_all();
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
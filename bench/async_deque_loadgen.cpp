@@ -0,0 +1,227 @@
+/**
+ * @file async_deque_loadgen.cpp
+ * @brief Open-loop load generator for AsyncDeque backends
+ *
+ * Producers push on a precomputed schedule that does not depend on how fast
+ * the queue accepts items. Each item carries its intended send time, and
+ * latency is measured from that time to the moment a consumer finishes it.
+ * When the queue falls behind, a producer that is late pushes at once
+ * instead of skipping ahead, so the time the item should already have been
+ * in flight is counted. A closed-loop driver would leave that time out
+ * (coordinated omission).
+ *
+ * The tool sweeps a list of offered rates and writes one CSV row per rate:
+ *
+ *   backend,arrival,offered_per_s,achieved_per_s,items,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,mean_ns
+ *
+ * Options (all --name=value):
+ *   --backend=async_deque|sojourn   queue type under test (async_deque)
+ *   --arrival=constant|poisson|bursty
+ *                                  inter-arrival distribution (poisson)
+ *   --burst=N                      items per burst for bursty arrivals (32)
+ *   --rates=R1,R2,...              offered items/s, summed over producers
+ *                                  (10000,50000,100000,200000,400000)
+ *   --duration=S                   seconds per rate (2)
+ *   --producers=N --consumers=N    thread counts (1, 1)
+ *   --capacity=N                   queue capacity, 0 = unbounded (1024)
+ *   --service_ns=N                 busy time a consumer spends per item (0)
+ *   --seed=N                       seed for Poisson arrivals (1)
+ *   --csv=PATH                     write the CSV to PATH instead of stdout
+ *
+ * Example:
+ *   async_deque_loadgen --arrival=bursty --rates=1000,10000,100000 --csv=curve.csv
+ */
+#include <async_deque/async_deque.hpp>
+#include <async_deque/sojourn.hpp>
+#include <async_deque/stats.hpp>
+
+#include "bench_common.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace async_deque;
+using bench::Arrival;
+
+namespace {
+
+struct Options {
+    std::string backend = "async_deque";
+    Arrival arrival = Arrival::poisson;
+    std::string arrival_name = "poisson";
+    int burst = 32;
+    std::vector<double> rates = {10000, 50000, 100000, 200000, 400000};
+    double duration_s = 2.0;
+    int producers = 1;
+    int consumers = 1;
+    size_t capacity = 1024;
+    uint64_t service_ns = 0;
+    uint64_t seed = 1;
+    std::string csv;
+};
+
+struct Item {
+    uint64_t intended_ns;
+};
+
+struct Result {
+    double achieved_per_s = 0.0;
+    HistogramSnapshot latency;
+};
+
+template<typename Queue>
+Result run_rate(const Options& options, double rate) {
+    Queue queue(options.capacity == 0 ? std::numeric_limits<size_t>::max() : options.capacity);
+    bench::LatencyRecorder latency;
+
+    const uint64_t start = detail::steady_now_ns() + 1000000;
+    const uint64_t end = start + static_cast<uint64_t>(options.duration_s * 1e9);
+    const double per_producer = rate / options.producers;
+
+    std::vector<std::thread> consumers;
+    for (int c = 0; c < options.consumers; ++c) {
+        consumers.emplace_back([&] {
+            while (auto item = queue.pop_front()) {
+                if (options.service_ns != 0) {
+                    const uint64_t busy_until = detail::steady_now_ns() + options.service_ns;
+                    while (detail::steady_now_ns() < busy_until) {
+                    }
+                }
+                latency.record(item->intended_ns);
+            }
+        });
+    }
+    std::vector<std::thread> producers;
+    for (int p = 0; p < options.producers; ++p) {
+        producers.emplace_back([&, p] {
+            bench::OpenLoopSchedule schedule(options.arrival, per_producer, start, options.burst,
+                                             options.seed + p);
+            for (uint64_t at = schedule.next(); at < end; at = schedule.next()) {
+                bench::spin_until(at);
+                queue.push_back(Item{at});
+            }
+        });
+    }
+    for (auto& producer : producers) producer.join();
+    queue.close();
+    for (auto& consumer : consumers) consumer.join();
+
+    Result result;
+    const uint64_t finished = detail::steady_now_ns();
+    result.latency = latency.snapshot();
+    result.achieved_per_s = static_cast<double>(result.latency.count) /
+                            (static_cast<double>(finished - start) / 1e9);
+    return result;
+}
+
+Result run_backend(const Options& options, double rate) {
+    if (options.backend == "sojourn") {
+        return run_rate<SojournDeque<Item>>(options, rate);
+    }
+    return run_rate<AsyncDeque<Item>>(options, rate);
+}
+
+bool parse(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const size_t eq = arg.find('=');
+        if (arg.rfind("--", 0) != 0 || eq == std::string::npos) {
+            std::cerr << "unrecognized argument: " << arg << '\n';
+            return false;
+        }
+        const std::string name = arg.substr(2, eq - 2);
+        const std::string value = arg.substr(eq + 1);
+        if (name == "backend") {
+            options.backend = value;
+        } else if (name == "arrival") {
+            options.arrival_name = value;
+            if (value == "constant") {
+                options.arrival = Arrival::constant;
+            } else if (value == "bursty") {
+                options.arrival = Arrival::bursty;
+            } else if (value == "poisson") {
+                options.arrival = Arrival::poisson;
+            } else {
+                std::cerr << "unknown arrival distribution: " << value << '\n';
+                return false;
+            }
+        } else if (name == "burst") {
+            options.burst = std::stoi(value);
+        } else if (name == "rates") {
+            options.rates.clear();
+            std::istringstream list(value);
+            for (std::string rate; std::getline(list, rate, ',');) {
+                options.rates.push_back(std::stod(rate));
+            }
+        } else if (name == "duration") {
+            options.duration_s = std::stod(value);
+        } else if (name == "producers") {
+            options.producers = std::max(1, std::stoi(value));
+        } else if (name == "consumers") {
+            options.consumers = std::max(1, std::stoi(value));
+        } else if (name == "capacity") {
+            options.capacity = std::stoull(value);
+        } else if (name == "service_ns") {
+            options.service_ns = std::stoull(value);
+        } else if (name == "seed") {
+            options.seed = std::stoull(value);
+        } else if (name == "csv") {
+            options.csv = value;
+        } else {
+            std::cerr << "unrecognized option: --" << name << '\n';
+            return false;
+        }
+    }
+    if (options.backend != "async_deque" && options.backend != "sojourn") {
+        std::cerr << "unknown backend: " << options.backend << '\n';
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    try {
+        if (!parse(argc, argv, options)) return 2;
+    } catch (const std::exception& e) {
+        std::cerr << "invalid option value: " << e.what() << '\n';
+        return 2;
+    }
+
+    std::ofstream file;
+    if (!options.csv.empty()) {
+        file.open(options.csv, std::ios::out | std::ios::trunc);
+        if (!file) {
+            std::cerr << "cannot write " << options.csv << '\n';
+            return 1;
+        }
+    }
+    std::ostream& out = options.csv.empty() ? std::cout : file;
+
+    out << "backend,arrival,offered_per_s,achieved_per_s,items,"
+           "p50_ns,p90_ns,p99_ns,p999_ns,max_ns,mean_ns\n";
+    for (double rate : options.rates) {
+        if (rate <= 0) continue;
+        const Result result = run_backend(options, rate);
+        const HistogramSnapshot& latency = result.latency;
+        out << options.backend << ',' << options.arrival_name << ','
+            << static_cast<uint64_t>(rate) << ','
+            << static_cast<uint64_t>(result.achieved_per_s) << ','
+            << latency.count << ','
+            << latency.percentile(0.50) << ',' << latency.percentile(0.90) << ','
+            << latency.percentile(0.99) << ',' << latency.percentile(0.999) << ','
+            << latency.max << ',' << static_cast<uint64_t>(latency.mean()) << '\n';
+        out.flush();
+    }
+    return 0;
+}
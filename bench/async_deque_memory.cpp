@@ -0,0 +1,268 @@
+/**
+ * @file async_deque_memory.cpp
+ * @brief Memory footprint of AsyncDeque: per idle queue and per queued element
+ *
+ * Every heap allocation of the process goes through a counting operator new,
+ * so the heap figures are exact and independent of the allocator. RSS comes
+ * from /proc/self/statm, and glibc's own view from mallinfo2().
+ *
+ * For each backend, storage mode and element size the tool reports:
+ * - idle: sizeof the queue object plus the heap it allocates when empty,
+ *   averaged over 1000 queues
+ * - filled: heap bytes and allocations per element with N elements queued,
+ *   compared to the payload size
+ * - drained: heap still held once every element has been popped, and RSS
+ *   before and after malloc_trim(0), i.e. whether memory goes back to the OS
+ *
+ * Backends are AsyncDeque and SojournDeque (one extra stamp per element).
+ * Storage modes are "value" (the payload is stored in the deque) and
+ * "boxed" (the deque stores a std::unique_ptr to a heap payload).
+ *
+ * Options: --csv=PATH writes the table as CSV instead of text to stdout.
+ */
+#include <async_deque/async_deque.hpp>
+#include <async_deque/sojourn.hpp>
+
+#include "bench_common.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+// Counting global allocator. Each block carries a header holding its size,
+// so unsized deletes are counted correctly.
+namespace {
+
+std::atomic<int64_t> live_bytes{0};
+std::atomic<uint64_t> allocations{0};
+
+constexpr size_t header_size = alignof(std::max_align_t);
+
+void* counted_alloc(size_t size, size_t alignment) {
+    const size_t header = alignment > header_size ? alignment : header_size;
+    void* base = nullptr;
+    if (posix_memalign(&base, header, header + size) != 0) throw std::bad_alloc();
+    char* user = static_cast<char*>(base) + header;
+    reinterpret_cast<size_t*>(user)[-1] = size;
+    live_bytes.fetch_add(static_cast<int64_t>(size), std::memory_order_relaxed);
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return user;
+}
+
+void counted_free(void* pointer, size_t alignment) {
+    if (!pointer) return;
+    const size_t header = alignment > header_size ? alignment : header_size;
+    char* user = static_cast<char*>(pointer);
+    live_bytes.fetch_sub(static_cast<int64_t>(reinterpret_cast<size_t*>(user)[-1]),
+                         std::memory_order_relaxed);
+    std::free(user - header);
+}
+
+} // namespace
+
+void* operator new(size_t size) { return counted_alloc(size, 0); }
+void* operator new[](size_t size) { return counted_alloc(size, 0); }
+void* operator new(size_t size, std::align_val_t al) { return counted_alloc(size, static_cast<size_t>(al)); }
+void* operator new[](size_t size, std::align_val_t al) { return counted_alloc(size, static_cast<size_t>(al)); }
+void operator delete(void* p) noexcept { counted_free(p, 0); }
+void operator delete[](void* p) noexcept { counted_free(p, 0); }
+void operator delete(void* p, size_t) noexcept { counted_free(p, 0); }
+void operator delete[](void* p, size_t) noexcept { counted_free(p, 0); }
+void operator delete(void* p, std::align_val_t al) noexcept { counted_free(p, static_cast<size_t>(al)); }
+void operator delete[](void* p, std::align_val_t al) noexcept { counted_free(p, static_cast<size_t>(al)); }
+void operator delete(void* p, size_t, std::align_val_t al) noexcept { counted_free(p, static_cast<size_t>(al)); }
+void operator delete[](void* p, size_t, std::align_val_t al) noexcept { counted_free(p, static_cast<size_t>(al)); }
+
+using namespace async_deque;
+
+namespace {
+
+struct Usage {
+    int64_t heap_bytes;
+    uint64_t allocations;
+    int64_t rss_bytes;
+    int64_t malloc_in_use;   ///< mallinfo2().uordblks, -1 if unavailable
+};
+
+Usage usage() {
+    return Usage{live_bytes.load(), allocations.load(), bench::rss_bytes(),
+                 bench::malloc_in_use_bytes()};
+}
+
+void trim() {
+#if defined(__GLIBC__)
+    malloc_trim(0);
+#endif
+}
+
+struct Row {
+    std::string backend;
+    std::string storage;
+    size_t payload_bytes = 0;
+    size_t elements = 0;
+    size_t queue_object_bytes = 0;
+    double idle_heap_bytes = 0;        ///< Per queue
+    double idle_rss_bytes = 0;         ///< Per queue
+    double heap_bytes_per_element = 0;
+    double allocations_per_element = 0;
+    double rss_bytes_per_element = 0;
+    int64_t drained_heap_bytes = 0;    ///< Still allocated after popping everything
+    int64_t drained_rss_bytes = 0;     ///< RSS above the pre-fill baseline after drain
+    int64_t trimmed_rss_bytes = 0;     ///< Same, after malloc_trim(0)
+    int64_t malloc_in_use_bytes = 0;   ///< glibc's count of bytes in use when filled
+};
+
+template<size_t N>
+struct Storage {
+    using Value = bench::Payload<N>;
+    using Boxed = std::unique_ptr<bench::Payload<N>>;
+
+    static Value make_value(uint64_t i) { return Value(i); }
+    static Boxed make_boxed(uint64_t i) { return std::make_unique<bench::Payload<N>>(i); }
+};
+
+template<typename Queue, typename Make>
+Row measure(const std::string& backend, const std::string& storage, size_t payload_bytes,
+            size_t elements, Make make) {
+    Row row{backend, storage, payload_bytes, elements, sizeof(Queue)};
+
+    // Idle queues
+    constexpr size_t idle_queues = 1000;
+    {
+        trim();
+        const Usage before = usage();
+        std::vector<std::unique_ptr<Queue>> queues;
+        queues.reserve(idle_queues);
+        const Usage reserved = usage();
+        for (size_t i = 0; i < idle_queues; ++i) queues.push_back(std::make_unique<Queue>());
+        const Usage after = usage();
+        // Heap per queue includes the queue object itself, which make_unique allocated
+        row.idle_heap_bytes =
+            static_cast<double>(after.heap_bytes - reserved.heap_bytes) / idle_queues -
+            static_cast<double>(sizeof(Queue));
+        row.idle_rss_bytes = static_cast<double>(after.rss_bytes - before.rss_bytes) / idle_queues;
+    }
+
+    // Filled, then drained
+    trim();
+    const Usage baseline = usage();
+    {
+        Queue queue;
+        const Usage empty = usage();
+        for (size_t i = 0; i < elements; ++i) queue.push_back(make(i));
+        const Usage filled = usage();
+        row.heap_bytes_per_element =
+            static_cast<double>(filled.heap_bytes - empty.heap_bytes) / elements;
+        row.allocations_per_element =
+            static_cast<double>(filled.allocations - empty.allocations) / elements;
+        row.rss_bytes_per_element =
+            static_cast<double>(filled.rss_bytes - empty.rss_bytes) / elements;
+        row.malloc_in_use_bytes = filled.malloc_in_use < 0 ? -1
+            : filled.malloc_in_use - baseline.malloc_in_use;
+
+        for (size_t i = 0; i < elements; ++i) {
+            auto item = queue.pop_front();
+            (void)item;
+        }
+        const Usage drained = usage();
+        row.drained_heap_bytes = drained.heap_bytes - empty.heap_bytes;
+        row.drained_rss_bytes = drained.rss_bytes - baseline.rss_bytes;
+        trim();
+        row.trimmed_rss_bytes = usage().rss_bytes - baseline.rss_bytes;
+    }
+    return row;
+}
+
+template<size_t N>
+void measure_size(std::vector<Row>& rows) {
+    // Keep each run around 256MB of payload at most
+    const size_t elements = N >= 4096 ? 50000 : N >= 512 ? 200000 : 1000000;
+    using S = Storage<N>;
+    rows.push_back(measure<AsyncDeque<typename S::Value>>(
+        "async_deque", "value", N, elements, S::make_value));
+    rows.push_back(measure<AsyncDeque<typename S::Boxed>>(
+        "async_deque", "boxed", N, elements, S::make_boxed));
+    rows.push_back(measure<SojournDeque<typename S::Value, CoarseClock>>(
+        "sojourn", "value", N, elements, S::make_value));
+    rows.push_back(measure<SojournDeque<typename S::Boxed, CoarseClock>>(
+        "sojourn", "boxed", N, elements, S::make_boxed));
+}
+
+void write_csv(std::ostream& out, const std::vector<Row>& rows) {
+    out << "backend,storage,payload_bytes,elements,queue_object_bytes,idle_heap_bytes,"
+           "idle_rss_bytes,heap_bytes_per_element,allocations_per_element,"
+           "rss_bytes_per_element,drained_heap_bytes,drained_rss_bytes,trimmed_rss_bytes,"
+           "malloc_in_use_bytes\n";
+    for (const Row& r : rows) {
+        out << r.backend << ',' << r.storage << ',' << r.payload_bytes << ',' << r.elements << ','
+            << r.queue_object_bytes << ',' << r.idle_heap_bytes << ',' << r.idle_rss_bytes << ','
+            << r.heap_bytes_per_element << ',' << r.allocations_per_element << ','
+            << r.rss_bytes_per_element << ',' << r.drained_heap_bytes << ','
+            << r.drained_rss_bytes << ',' << r.trimmed_rss_bytes << ','
+            << r.malloc_in_use_bytes << '\n';
+    }
+}
+
+void write_table(std::ostream& out, const std::vector<Row>& rows) {
+    out << std::left << std::setw(12) << "backend" << std::setw(8) << "storage" << std::right
+        << std::setw(8) << "payload" << std::setw(9) << "elements" << std::setw(8) << "sizeof"
+        << std::setw(10) << "idle_heap" << std::setw(11) << "heap/elem" << std::setw(13)
+        << "allocs/elem" << std::setw(10) << "rss/elem" << std::setw(13) << "drained_heap"
+        << std::setw(13) << "drained_rss" << std::setw(13) << "trimmed_rss" << '\n';
+    out << std::fixed << std::setprecision(1);
+    for (const Row& r : rows) {
+        out << std::left << std::setw(12) << r.backend << std::setw(8) << r.storage << std::right
+            << std::setw(8) << r.payload_bytes << std::setw(9) << r.elements << std::setw(8)
+            << r.queue_object_bytes << std::setw(10) << r.idle_heap_bytes << std::setw(11)
+            << r.heap_bytes_per_element << std::setw(13) << std::setprecision(3)
+            << r.allocations_per_element << std::setprecision(1) << std::setw(10)
+            << r.rss_bytes_per_element << std::setw(13) << r.drained_heap_bytes << std::setw(13)
+            << r.drained_rss_bytes << std::setw(13) << r.trimmed_rss_bytes << '\n';
+    }
+    out << std::defaultfloat;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string csv;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg.rfind("--csv=", 0) == 0) {
+            csv = arg.substr(6);
+        } else {
+            std::cerr << "unrecognized argument: " << arg << '\n';
+            return 2;
+        }
+    }
+
+    std::vector<Row> rows;
+    measure_size<8>(rows);
+    measure_size<64>(rows);
+    measure_size<512>(rows);
+    measure_size<4096>(rows);
+
+    if (csv.empty()) {
+        write_table(std::cout, rows);
+        return 0;
+    }
+    std::ofstream file(csv, std::ios::out | std::ios::trunc);
+    if (!file) {
+        std::cerr << "cannot write " << csv << '\n';
+        return 1;
+    }
+    write_csv(file, rows);
+    return 0;
+}
@@ -0,0 +1,306 @@
+/**
+ * @file async_deque_replay.cpp
+ * @brief Re-drives queue backends with traffic recorded by CaptureDeque
+ *
+ * Each thread that pushed in the capture becomes a producer that pushes
+ * items of the recorded sizes, at the recorded ends, at the recorded times
+ * (open loop, as in async_deque_loadgen). Each thread that popped becomes a
+ * consumer that pops from the recorded ends and then stays busy for the
+ * recorded service time before its next pop.
+ *
+ * A pop-only trace does not show when a consumer finished an item, so the
+ * service time is estimated from its next pop. If the queue still held items
+ * after a pop, the consumer went straight back for more, and the gap between
+ * its two pops is the service time. Otherwise the consumer may have idled,
+ * and the median of its non-idle gaps is used instead (0 if it never had a
+ * backlog).
+ *
+ * Latency is measured from an item's recorded push time to the moment a
+ * consumer pops it. One CSV row per backend:
+ *
+ *   backend,items,recorded_s,replayed_s,achieved_per_s,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,mean_ns
+ *
+ * Options (all --name=value):
+ *   --capture=PATH              file written by CaptureDeque (required)
+ *   --backends=a,b,...          async_deque, sojourn (async_deque,sojourn)
+ *   --speed=X                   replay X times faster than recorded (1)
+ *   --capacity=N                queue capacity, 0 = unbounded (as recorded)
+ *   --csv=PATH                  write the CSV to PATH instead of stdout
+ *
+ * Example:
+ *   async_deque_replay --capture=orders.adqcap --speed=2 --csv=replay.csv
+ */
+#include <async_deque/async_deque.hpp>
+#include <async_deque/capture.hpp>
+#include <async_deque/sojourn.hpp>
+#include <async_deque/stats.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace async_deque;
+
+namespace {
+
+using LatencyHistogram = LogLinearHistogram<5, 40>;
+
+struct Options {
+    std::string capture;
+    std::vector<std::string> backends = {"async_deque", "sojourn"};
+    double speed = 1.0;
+    std::optional<size_t> capacity;
+    std::string csv;
+};
+
+struct Item {
+    uint64_t intended_ns;
+    std::vector<unsigned char> payload;
+};
+
+struct Push {
+    uint64_t at_ns;   ///< Relative to the start of the capture
+    uint32_t size;
+    bool front;
+};
+
+struct Pop {
+    bool back;
+    uint64_t service_ns;
+};
+
+/// What each recorded thread did, in the order it did it
+struct Workload {
+    std::vector<std::vector<Push>> producers;
+    std::vector<std::vector<Pop>> consumers;
+    uint64_t duration_ns = 0;
+    uint64_t items = 0;
+};
+
+bool is_push(CaptureKind kind) {
+    return kind == CaptureKind::push_back || kind == CaptureKind::push_front;
+}
+
+bool is_pop(CaptureKind kind) {
+    return kind == CaptureKind::pop_back || kind == CaptureKind::pop_front;
+}
+
+Workload build_workload(const Capture& capture) {
+    struct Popped {
+        uint64_t at_ns;
+        bool back;
+        bool backlog;   ///< Items were left in the queue after this pop
+    };
+    std::map<uint16_t, std::vector<Push>> pushes;
+    std::map<uint16_t, std::vector<Popped>> pops;
+    int64_t depth = 0;
+    Workload workload;
+    for (const CaptureRecord& r : capture.records) {
+        if (is_push(r.kind)) {
+            ++depth;
+            ++workload.items;
+            pushes[r.thread].push_back({r.time_ns, r.size, r.kind == CaptureKind::push_front});
+        } else if (is_pop(r.kind)) {
+            --depth;
+            pops[r.thread].push_back({r.time_ns, r.kind == CaptureKind::pop_back, depth > 0});
+        }
+        workload.duration_ns = std::max(workload.duration_ns, r.time_ns);
+    }
+
+    for (auto& [thread, list] : pushes) workload.producers.push_back(std::move(list));
+    for (const auto& [thread, list] : pops) {
+        std::vector<uint64_t> busy_gaps;
+        for (size_t i = 0; i + 1 < list.size(); ++i) {
+            if (list[i].backlog) busy_gaps.push_back(list[i + 1].at_ns - list[i].at_ns);
+        }
+        uint64_t typical = 0;
+        if (!busy_gaps.empty()) {
+            std::nth_element(busy_gaps.begin(), busy_gaps.begin() + busy_gaps.size() / 2,
+                             busy_gaps.end());
+            typical = busy_gaps[busy_gaps.size() / 2];
+        }
+        std::vector<Pop> consumer;
+        for (size_t i = 0; i < list.size(); ++i) {
+            const bool measured = list[i].backlog && i + 1 < list.size();
+            consumer.push_back({list[i].back,
+                                measured ? list[i + 1].at_ns - list[i].at_ns : typical});
+        }
+        workload.consumers.push_back(std::move(consumer));
+    }
+    return workload;
+}
+
+void busy_until(uint64_t deadline_ns) {
+    while (detail::steady_now_ns() < deadline_ns) {
+        std::this_thread::yield();
+    }
+}
+
+struct Result {
+    double replayed_s = 0.0;
+    HistogramSnapshot latency;
+};
+
+template<typename Queue>
+Result replay(const Workload& workload, double speed, size_t capacity) {
+    Queue queue(capacity == 0 ? std::numeric_limits<size_t>::max() : capacity);
+    auto histogram = std::make_unique<LatencyHistogram>();
+    const uint64_t start = detail::steady_now_ns() + 1000000;
+    auto scaled = [speed](uint64_t ns) { return static_cast<uint64_t>(static_cast<double>(ns) / speed); };
+
+    auto consume = [&](const std::optional<Item>& item) {
+        if (!item) return false;
+        const uint64_t now = detail::steady_now_ns();
+        histogram->record(now > item->intended_ns ? now - item->intended_ns : 0);
+        return true;
+    };
+
+    std::vector<std::thread> consumers;
+    for (const std::vector<Pop>& pops : workload.consumers) {
+        consumers.emplace_back([&] {
+            busy_until(start);
+            for (const Pop& pop : pops) {
+                if (!consume(pop.back ? queue.pop_back() : queue.pop_front())) return;
+                busy_until(detail::steady_now_ns() + scaled(pop.service_ns));
+            }
+            // Items the capture left queued still have to leave for producers to finish
+            while (consume(queue.pop_front())) {
+            }
+        });
+    }
+    std::vector<std::thread> producers;
+    for (const std::vector<Push>& pushes : workload.producers) {
+        producers.emplace_back([&] {
+            for (const Push& push : pushes) {
+                const uint64_t at = start + scaled(push.at_ns);
+                busy_until(at);
+                Item item{at, std::vector<unsigned char>(push.size)};
+                if (push.front) {
+                    queue.push_front(std::move(item));
+                } else {
+                    queue.push_back(std::move(item));
+                }
+            }
+        });
+    }
+    for (auto& producer : producers) producer.join();
+    queue.close();
+    for (auto& consumer : consumers) consumer.join();
+
+    Result result;
+    result.replayed_s = static_cast<double>(detail::steady_now_ns() - start) / 1e9;
+    result.latency = histogram->snapshot();
+    return result;
+}
+
+std::vector<std::string> split(const std::string& list) {
+    std::vector<std::string> items;
+    std::istringstream in(list);
+    for (std::string item; std::getline(in, item, ',');) {
+        if (!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+bool parse(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const size_t eq = arg.find('=');
+        if (arg.rfind("--", 0) != 0 || eq == std::string::npos) {
+            std::cerr << "unrecognized argument: " << arg << '\n';
+            return false;
+        }
+        const std::string name = arg.substr(2, eq - 2);
+        const std::string value = arg.substr(eq + 1);
+        if (name == "capture") {
+            options.capture = value;
+        } else if (name == "backends") {
+            options.backends = split(value);
+        } else if (name == "speed") {
+            options.speed = std::stod(value);
+        } else if (name == "capacity") {
+            options.capacity = std::stoull(value);
+        } else if (name == "csv") {
+            options.csv = value;
+        } else {
+            std::cerr << "unrecognized option: --" << name << '\n';
+            return false;
+        }
+    }
+    if (options.capture.empty()) {
+        std::cerr << "--capture=PATH is required\n";
+        return false;
+    }
+    if (options.speed <= 0) {
+        std::cerr << "--speed must be positive\n";
+        return false;
+    }
+    for (const std::string& backend : options.backends) {
+        if (backend != "async_deque" && backend != "sojourn") {
+            std::cerr << "unknown backend: " << backend << '\n';
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    try {
+        if (!parse(argc, argv, options)) return 2;
+    } catch (const std::exception& e) {
+        std::cerr << "invalid option value: " << e.what() << '\n';
+        return 2;
+    }
+
+    Capture capture;
+    if (!read_capture(options.capture, capture)) {
+        std::cerr << "cannot read capture file " << options.capture << '\n';
+        return 1;
+    }
+    const Workload workload = build_workload(capture);
+    const size_t capacity = options.capacity.value_or(
+        capture.capacity > std::numeric_limits<size_t>::max() ? 0 : static_cast<size_t>(capture.capacity));
+    std::cerr << capture.records.size() << " events, " << workload.items << " items, "
+              << workload.producers.size() << " producer(s), " << workload.consumers.size()
+              << " consumer(s), " << static_cast<double>(workload.duration_ns) / 1e9
+              << "s recorded\n";
+
+    std::ofstream file;
+    if (!options.csv.empty()) {
+        file.open(options.csv, std::ios::out | std::ios::trunc);
+        if (!file) {
+            std::cerr << "cannot write " << options.csv << '\n';
+            return 1;
+        }
+    }
+    std::ostream& out = options.csv.empty() ? std::cout : file;
+
+    out << "backend,items,recorded_s,replayed_s,achieved_per_s,"
+           "p50_ns,p90_ns,p99_ns,p999_ns,max_ns,mean_ns\n";
+    for (const std::string& backend : options.backends) {
+        const Result result = backend == "sojourn"
+            ? replay<SojournDeque<Item>>(workload, options.speed, capacity)
+            : replay<AsyncDeque<Item>>(workload, options.speed, capacity);
+        const HistogramSnapshot& latency = result.latency;
+        out << backend << ',' << latency.count << ','
+            << static_cast<double>(workload.duration_ns) / 1e9 << ',' << result.replayed_s << ','
+            << static_cast<uint64_t>(result.replayed_s > 0 ? latency.count / result.replayed_s : 0)
+            << ',' << latency.percentile(0.50) << ',' << latency.percentile(0.90) << ','
+            << latency.percentile(0.99) << ',' << latency.percentile(0.999) << ','
+            << latency.max << ',' << static_cast<uint64_t>(latency.mean()) << '\n';
+        out.flush();
+    }
+    return 0;
+}
@@ -0,0 +1,319 @@
+/**
+ * @file async_deque_scaling.cpp
+ * @brief Throughput scaling of AsyncDeque across thread counts and CPU placements
+ *
+ * Runs N producers and N consumers through one queue for N = 1, 2, 4, ... up
+ * to half the usable CPUs, under each pinning layout the machine supports:
+ *
+ * - unpinned: the scheduler places threads (baseline)
+ * - same_cpu: every thread on one logical CPU
+ * - smt_siblings: threads on the hyperthreads of one physical core
+ * - same_socket: threads on distinct physical cores of one socket first,
+ *   then on their SMT siblings
+ * - cross_socket: producers on one socket, consumers on another
+ *
+ * The topology is read from /sys/devices/system/cpu/cpuN/topology and
+ * limited to the CPUs in the process affinity mask. Layouts that need more
+ * CPUs (or sockets, or SMT) than the machine has are skipped.
+ *
+ * Results go to a CSV (layout,producers,consumers,cpus,items_per_s,speedup,
+ * contended_per_item) and an ASCII chart on stdout, one bar per point,
+ * scaled to the best throughput seen.
+ *
+ * Options (all --name=value):
+ *   --duration=S          seconds per point (0.5)
+ *   --capacity=N          queue capacity (1024)
+ *   --max_pairs=N         largest producer/consumer count (half the CPUs)
+ *   --layouts=a,b,...     subset of the layouts above (all)
+ *   --csv=PATH            CSV output (async_deque_scaling.csv)
+ */
+#include <async_deque/async_deque.hpp>
+
+#include "bench_common.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+using namespace async_deque;
+
+namespace {
+
+struct Cpu {
+    int id;
+    int core;      ///< core_id, unique within a socket
+    int socket;    ///< physical_package_id
+};
+
+int read_int(const std::string& path, int fallback) {
+    std::ifstream file(path);
+    int value = fallback;
+    file >> value;
+    return file ? value : fallback;
+}
+
+/// CPUs this process may run on, ordered by socket, core, then id
+std::vector<Cpu> read_topology() {
+    std::vector<Cpu> cpus;
+#if defined(__linux__)
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int id = 0; id < CPU_SETSIZE; ++id) {
+            if (!CPU_ISSET(id, &allowed)) continue;
+            const std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(id) + "/topology/";
+            cpus.push_back({id, read_int(base + "core_id", id),
+                            read_int(base + "physical_package_id", 0)});
+        }
+    }
+#endif
+    if (cpus.empty()) {
+        const int count = std::max(1u, std::thread::hardware_concurrency());
+        for (int id = 0; id < count; ++id) cpus.push_back({id, id, 0});
+    }
+    std::sort(cpus.begin(), cpus.end(), [](const Cpu& a, const Cpu& b) {
+        return std::tie(a.socket, a.core, a.id) < std::tie(b.socket, b.core, b.id);
+    });
+    return cpus;
+}
+
+/// CPU for each thread (producers first, then consumers); -1 means unpinned
+using Placement = std::vector<int>;
+
+/**
+ * @brief Places @p producers and @p consumers threads according to @p layout
+ * @return false if the machine cannot provide that layout
+ */
+bool place(const std::string& layout, const std::vector<Cpu>& cpus, int producers,
+           int consumers, Placement& placement) {
+    const int threads = producers + consumers;
+    placement.assign(threads, -1);
+    if (layout == "unpinned") return true;
+    if (layout == "same_cpu") {
+        placement.assign(threads, cpus.front().id);
+        return true;
+    }
+
+    // Group CPUs into physical cores
+    std::map<std::pair<int, int>, std::vector<int>> cores;   // (socket, core) -> cpu ids
+    std::set<int> sockets;
+    for (const Cpu& cpu : cpus) {
+        cores[{cpu.socket, cpu.core}].push_back(cpu.id);
+        sockets.insert(cpu.socket);
+    }
+
+    if (layout == "smt_siblings") {
+        const std::vector<int>& siblings = cores.begin()->second;
+        if (siblings.size() < 2) return false;
+        for (int t = 0; t < threads; ++t) placement[t] = siblings[t % siblings.size()];
+        return true;
+    }
+
+    // One CPU per physical core of a socket, then the second sibling of each, ...
+    auto socket_order = [&](int socket) {
+        std::vector<int> order;
+        for (size_t level = 0;; ++level) {
+            bool any = false;
+            for (const auto& [key, ids] : cores) {
+                if (key.first != socket || level >= ids.size()) continue;
+                order.push_back(ids[level]);
+                any = true;
+            }
+            if (!any) break;
+        }
+        return order;
+    };
+
+    if (layout == "same_socket") {
+        const std::vector<int> order = socket_order(*sockets.begin());
+        if (static_cast<int>(order.size()) < threads) return false;
+        std::copy_n(order.begin(), threads, placement.begin());
+        return true;
+    }
+    if (layout == "cross_socket") {
+        if (sockets.size() < 2) return false;
+        const std::vector<int> first = socket_order(*sockets.begin());
+        const std::vector<int> second = socket_order(*std::next(sockets.begin()));
+        if (static_cast<int>(first.size()) < producers ||
+            static_cast<int>(second.size()) < consumers) {
+            return false;
+        }
+        std::copy_n(first.begin(), producers, placement.begin());
+        std::copy_n(second.begin(), consumers, placement.begin() + producers);
+        return true;
+    }
+    return false;
+}
+
+struct Point {
+    std::string layout;
+    int producers;
+    int consumers;
+    std::string cpus;
+    double items_per_s;
+    double speedup;
+    double contended_per_item;
+};
+
+Point run_point(const std::string& layout, int pairs, const Placement& placement,
+                double duration_s, size_t capacity) {
+    AsyncDeque<uint64_t> queue(capacity);
+    std::atomic<bool> stop{false};
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 2 * pairs; ++t) {
+        const bool producer = t < pairs;
+        threads.emplace_back([&, t, producer] {
+            if (placement[t] >= 0) bench::pin_to_cpu(placement[t]);
+            if (producer) {
+                for (uint64_t i = 0; !stop.load(std::memory_order_relaxed); ++i) {
+                    if (!queue.push_back(i)) break;
+                }
+            } else {
+                while (queue.pop_front()) {
+                }
+            }
+        });
+    }
+
+    const DequeStats before = queue.stats();
+    const uint64_t start = detail::steady_now_ns();
+    std::this_thread::sleep_for(std::chrono::duration<double>(duration_s));
+    const DequeStats after = queue.stats();
+    const uint64_t elapsed = detail::steady_now_ns() - start;
+    stop = true;
+    queue.close();
+    for (auto& thread : threads) thread.join();
+
+    const double popped = static_cast<double>(after.pops - before.pops);
+    std::ostringstream cpus;
+    for (size_t t = 0; t < placement.size(); ++t) {
+        cpus << (t ? " " : "") << (placement[t] < 0 ? std::string("*") : std::to_string(placement[t]));
+    }
+    return Point{layout, pairs, pairs, cpus.str(), popped / (static_cast<double>(elapsed) / 1e9),
+                 0.0,
+                 popped == 0 ? 0.0
+                             : static_cast<double>(after.lock_contentions - before.lock_contentions) / popped};
+}
+
+void draw_chart(std::ostream& out, const std::vector<Point>& points) {
+    double best = 0;
+    for (const Point& p : points) best = std::max(best, p.items_per_s);
+    if (best <= 0) return;
+    constexpr int width = 50;
+    std::string layout;
+    for (const Point& p : points) {
+        if (p.layout != layout) {
+            layout = p.layout;
+            out << '\n' << layout << '\n';
+        }
+        const int bar = static_cast<int>(p.items_per_s / best * width + 0.5);
+        out << std::setw(4) << p.producers << "x" << std::left << std::setw(4) << p.consumers
+            << std::right << " |" << std::string(bar, '#') << std::string(width - bar, ' ') << "| "
+            << std::fixed << std::setprecision(2) << p.items_per_s / 1e6 << " M/s  x"
+            << p.speedup << std::defaultfloat << '\n';
+    }
+}
+
+std::vector<std::string> split(const std::string& list) {
+    std::vector<std::string> items;
+    std::istringstream in(list);
+    for (std::string item; std::getline(in, item, ',');) {
+        if (!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const std::vector<Cpu> cpus = read_topology();
+    double duration_s = 0.5;
+    size_t capacity = 1024;
+    int max_pairs = std::max(1, static_cast<int>(cpus.size()) / 2);
+    std::vector<std::string> layouts = {"unpinned", "same_cpu", "smt_siblings", "same_socket",
+                                        "cross_socket"};
+    std::string csv = "async_deque_scaling.csv";
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            const size_t eq = arg.find('=');
+            const std::string name = eq == std::string::npos ? arg : arg.substr(0, eq);
+            const std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+            if (name == "--duration") {
+                duration_s = std::stod(value);
+            } else if (name == "--capacity") {
+                capacity = std::stoull(value);
+            } else if (name == "--max_pairs") {
+                max_pairs = std::max(1, std::stoi(value));
+            } else if (name == "--layouts") {
+                layouts = split(value);
+            } else if (name == "--csv") {
+                csv = value;
+            } else {
+                std::cerr << "unrecognized argument: " << arg << '\n';
+                return 2;
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "invalid option value: " << e.what() << '\n';
+        return 2;
+    }
+
+    std::set<int> sockets;
+    for (const Cpu& cpu : cpus) sockets.insert(cpu.socket);
+    std::cout << cpus.size() << " CPUs, " << sockets.size() << " socket(s)\n";
+
+    std::vector<int> counts;
+    for (int n = 1; n < max_pairs; n *= 2) counts.push_back(n);
+    counts.push_back(max_pairs);
+
+    std::vector<Point> points;
+    for (const std::string& layout : layouts) {
+        double baseline = 0;
+        for (int n : counts) {
+            Placement placement;
+            if (!place(layout, cpus, n, n, placement)) {
+                std::cout << layout << ": skipped from " << n << "x" << n
+                          << " (not enough CPUs for this layout)\n";
+                break;
+            }
+            Point point = run_point(layout, n, placement, duration_s, capacity);
+            if (baseline == 0) baseline = point.items_per_s;
+            point.speedup = baseline > 0 ? point.items_per_s / baseline : 0.0;
+            points.push_back(point);
+        }
+    }
+
+    std::ofstream file(csv, std::ios::out | std::ios::trunc);
+    if (!file) {
+        std::cerr << "cannot write " << csv << '\n';
+        return 1;
+    }
+    file << "layout,producers,consumers,cpus,items_per_s,speedup,contended_per_item\n";
+    for (const Point& p : points) {
+        file << p.layout << ',' << p.producers << ',' << p.consumers << ",\"" << p.cpus << "\","
+             << static_cast<uint64_t>(p.items_per_s) << ',' << p.speedup << ','
+             << p.contended_per_item << '\n';
+    }
+
+    draw_chart(std::cout, points);
+    std::cout << "\nwrote " << csv << '\n';
+    return 0;
+}
@@ -0,0 +1,311 @@
+/**
+ * @file async_deque_soak.cpp
+ * @brief Long-running soak of AsyncDeque that flags latency drift and memory growth
+ *
+ * Producers push variable-sized items on a fixed open-loop schedule (as in
+ * async_deque_loadgen) for the whole run, and consumers pop them. Payload
+ * sizes are drawn at random, so the std::deque chunks and the payload
+ * buffers keep being allocated and freed in a changing order. Fragmentation
+ * from that churn shows up as slowly growing RSS or allocator arenas, or as
+ * latency that worsens over hours.
+ *
+ * Every interval the tool records one sample:
+ *
+ *   elapsed_s,items_per_s,p50_ns,p99_ns,p999_ns,max_ns,depth,rss_bytes,
+ *   malloc_in_use_bytes,malloc_arena_bytes
+ *
+ * Latency percentiles cover only the items finished in that interval.
+ *
+ * At the end the median of the first --window samples after warm-up is
+ * compared with the median of the last --window samples. A metric that moved
+ * the wrong way by more than --threshold percent is reported as drift, and
+ * the tool exits with status 1. Memory metrics must also grow by more than
+ * --slack_bytes, so small absolute changes do not trip the check.
+ *
+ * Options (all --name=value):
+ *   --duration=S          total run time in seconds (600)
+ *   --interval=S          seconds per sample (10)
+ *   --rate=R              offered items/s, summed over producers (100000)
+ *   --producers=N --consumers=N    thread counts (1, 1)
+ *   --capacity=N          queue capacity, 0 = unbounded (4096)
+ *   --payload_max=N       payload sizes are uniform in [0, N] bytes (1024)
+ *   --warmup=N            samples skipped before the baseline (1)
+ *   --window=N            samples in the baseline and final medians (3)
+ *   --threshold=PCT       allowed drift in percent (25)
+ *   --slack_bytes=N       memory growth always allowed (4194304)
+ *   --seed=N              seed for payload sizes (1)
+ *   --csv=PATH            also write the samples to PATH
+ *
+ * Example:
+ *   async_deque_soak --duration=14400 --interval=60 --csv=soak.csv
+ */
+#include <async_deque/async_deque.hpp>
+#include <async_deque/stats.hpp>
+
+#include "bench_common.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace async_deque;
+
+namespace {
+
+struct Options {
+    double duration_s = 600.0;
+    double interval_s = 10.0;
+    double rate = 100000.0;
+    int producers = 1;
+    int consumers = 1;
+    size_t capacity = 4096;
+    size_t payload_max = 1024;
+    size_t warmup = 1;
+    size_t window = 3;
+    double threshold_pct = 25.0;
+    int64_t slack_bytes = int64_t{4} << 20;
+    uint64_t seed = 1;
+    std::string csv;
+};
+
+struct Item {
+    uint64_t intended_ns;
+    std::vector<unsigned char> payload;
+};
+
+struct Sample {
+    double elapsed_s;
+    double items_per_s;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+    uint64_t max_ns;
+    size_t depth;
+    int64_t rss_bytes;
+    int64_t malloc_in_use_bytes;
+    int64_t malloc_arena_bytes;
+};
+
+void write_header(std::ostream& out) {
+    out << "elapsed_s,items_per_s,p50_ns,p99_ns,p999_ns,max_ns,depth,rss_bytes,"
+           "malloc_in_use_bytes,malloc_arena_bytes\n";
+}
+
+void write_sample(std::ostream& out, const Sample& s) {
+    out << s.elapsed_s << ',' << static_cast<uint64_t>(s.items_per_s) << ',' << s.p50_ns << ','
+        << s.p99_ns << ',' << s.p999_ns << ',' << s.max_ns << ',' << s.depth << ','
+        << s.rss_bytes << ',' << s.malloc_in_use_bytes << ',' << s.malloc_arena_bytes << '\n';
+}
+
+std::vector<Sample> run(const Options& options, std::ostream* csv) {
+    AsyncDeque<Item> queue(options.capacity == 0 ? std::numeric_limits<size_t>::max()
+                                                  : options.capacity);
+    bench::LatencyRecorder recorder;
+
+    const uint64_t start = detail::steady_now_ns() + 1000000;
+    const uint64_t end = start + static_cast<uint64_t>(options.duration_s * 1e9);
+    const double per_producer = options.rate / options.producers;
+
+    std::vector<std::thread> consumers;
+    for (int c = 0; c < options.consumers; ++c) {
+        consumers.emplace_back([&] {
+            while (auto item = queue.pop_front()) {
+                recorder.record(item->intended_ns);
+            }
+        });
+    }
+    std::vector<std::thread> producers;
+    for (int p = 0; p < options.producers; ++p) {
+        producers.emplace_back([&, p] {
+            std::mt19937_64 random(options.seed + p);
+            std::uniform_int_distribution<size_t> size(0, options.payload_max);
+            // Producers are staggered evenly within one gap
+            const double gap_ns = 1e9 / per_producer;
+            const uint64_t offset = static_cast<uint64_t>(gap_ns * p / options.producers);
+            bench::OpenLoopSchedule schedule(bench::Arrival::constant, per_producer,
+                                             start + offset);
+            for (uint64_t at = schedule.next(); at < end; at = schedule.next()) {
+                bench::spin_until(at);
+                queue.push_back(Item{at, std::vector<unsigned char>(size(random))});
+            }
+        });
+    }
+
+    std::vector<Sample> samples;
+    const auto step = std::chrono::duration<double>(options.interval_s);
+    auto wake = std::chrono::steady_clock::now();
+    uint64_t before_ns = detail::steady_now_ns();
+    // Whole intervals only: a short one at the end would skew the final window
+    const auto intervals = static_cast<size_t>(options.duration_s / options.interval_s);
+    for (size_t n = 0; n < intervals; ++n) {
+        wake += std::chrono::duration_cast<std::chrono::steady_clock::duration>(step);
+        std::this_thread::sleep_until(wake);
+
+        const uint64_t now_ns = detail::steady_now_ns();
+        const HistogramSnapshot latency = recorder.interval();
+        const Sample sample{
+            now_ns > start ? static_cast<double>(now_ns - start) / 1e9 : 0.0,
+            static_cast<double>(latency.count) / (static_cast<double>(now_ns - before_ns) / 1e9),
+            latency.percentile(0.50), latency.percentile(0.99), latency.percentile(0.999),
+            latency.max, queue.size(), bench::rss_bytes(), bench::malloc_in_use_bytes(),
+            bench::malloc_arena_bytes()};
+        samples.push_back(sample);
+        if (csv) {
+            write_sample(*csv, sample);
+            csv->flush();
+        }
+        std::cout << std::fixed << std::setprecision(0) << std::setw(8) << sample.elapsed_s
+                  << "s " << std::setw(10) << sample.items_per_s << "/s  p99 " << std::setw(9)
+                  << sample.p99_ns << "ns  p99.9 " << std::setw(9) << sample.p999_ns
+                  << "ns  rss " << std::setw(7) << sample.rss_bytes / 1024 << "KiB  arena "
+                  << std::setw(7) << sample.malloc_arena_bytes / 1024 << "KiB\n"
+                  << std::defaultfloat << std::flush;
+        before_ns = now_ns;
+    }
+
+    for (auto& producer : producers) producer.join();
+    queue.close();
+    for (auto& consumer : consumers) consumer.join();
+    return samples;
+}
+
+template<typename Field>
+double median(std::vector<Sample>::const_iterator first, std::vector<Sample>::const_iterator last,
+              Field field) {
+    std::vector<double> values;
+    for (auto it = first; it != last; ++it) values.push_back(static_cast<double>(field(*it)));
+    std::sort(values.begin(), values.end());
+    const size_t n = values.size();
+    return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+/**
+ * @brief Compares the baseline and final windows of @p samples
+ * @return Number of metrics that drifted beyond the threshold
+ */
+int report_drift(const Options& options, const std::vector<Sample>& samples) {
+    const size_t window = std::max<size_t>(options.window, 1);
+    if (samples.size() < options.warmup + 2 * window) {
+        std::cout << "\nonly " << samples.size() << " samples; drift check needs "
+                  << options.warmup + 2 * window << " (--warmup + 2 x --window)\n";
+        return 0;
+    }
+    const auto base_first = samples.begin() + static_cast<std::ptrdiff_t>(options.warmup);
+    const auto base_last = base_first + static_cast<std::ptrdiff_t>(window);
+    const auto final_first = samples.end() - static_cast<std::ptrdiff_t>(window);
+
+    int drifted = 0;
+    std::cout << "\nmetric                 baseline        final   change\n";
+    // higher_is_worse: latency and memory; lower_is_worse: throughput
+    auto check = [&](const char* name, auto field, bool higher_is_worse, double slack) {
+        const double base = median(base_first, base_last, field);
+        const double last = median(final_first, samples.end(), field);
+        if (base < 0 || last < 0) return;   // not available on this platform
+        const double change = base > 0 ? (last - base) / base * 100.0 : 0.0;
+        const double worse = higher_is_worse ? change : -change;
+        const bool drift = worse > options.threshold_pct && std::abs(last - base) > slack;
+        std::cout << std::left << std::setw(20) << name << std::right << std::fixed
+                  << std::setprecision(0) << std::setw(12) << base << std::setw(13) << last
+                  << std::setprecision(1) << std::setw(8) << std::showpos << change << '%'
+                  << std::noshowpos << std::defaultfloat << (drift ? "  DRIFT" : "") << '\n';
+        drifted += drift;
+    };
+    const double slack = static_cast<double>(options.slack_bytes);
+    check("items_per_s", [](const Sample& s) { return s.items_per_s; }, false, 0.0);
+    check("p50_ns", [](const Sample& s) { return s.p50_ns; }, true, 0.0);
+    check("p99_ns", [](const Sample& s) { return s.p99_ns; }, true, 0.0);
+    check("p999_ns", [](const Sample& s) { return s.p999_ns; }, true, 0.0);
+    check("rss_bytes", [](const Sample& s) { return s.rss_bytes; }, true, slack);
+    check("malloc_in_use_bytes", [](const Sample& s) { return s.malloc_in_use_bytes; }, true,
+          slack);
+    check("malloc_arena_bytes", [](const Sample& s) { return s.malloc_arena_bytes; }, true, slack);
+    return drifted;
+}
+
+bool parse(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const size_t eq = arg.find('=');
+        if (arg.rfind("--", 0) != 0 || eq == std::string::npos) {
+            std::cerr << "unrecognized argument: " << arg << '\n';
+            return false;
+        }
+        const std::string name = arg.substr(2, eq - 2);
+        const std::string value = arg.substr(eq + 1);
+        if (name == "duration") {
+            options.duration_s = std::stod(value);
+        } else if (name == "interval") {
+            options.interval_s = std::stod(value);
+        } else if (name == "rate") {
+            options.rate = std::stod(value);
+        } else if (name == "producers") {
+            options.producers = std::max(1, std::stoi(value));
+        } else if (name == "consumers") {
+            options.consumers = std::max(1, std::stoi(value));
+        } else if (name == "capacity") {
+            options.capacity = std::stoull(value);
+        } else if (name == "payload_max") {
+            options.payload_max = std::stoull(value);
+        } else if (name == "warmup") {
+            options.warmup = std::stoull(value);
+        } else if (name == "window") {
+            options.window = std::stoull(value);
+        } else if (name == "threshold") {
+            options.threshold_pct = std::stod(value);
+        } else if (name == "slack_bytes") {
+            options.slack_bytes = std::stoll(value);
+        } else if (name == "seed") {
+            options.seed = std::stoull(value);
+        } else if (name == "csv") {
+            options.csv = value;
+        } else {
+            std::cerr << "unrecognized option: --" << name << '\n';
+            return false;
+        }
+    }
+    if (options.rate <= 0 || options.interval_s <= 0 || options.duration_s < options.interval_s) {
+        std::cerr << "--rate and --interval must be positive, and --duration at least --interval\n";
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    try {
+        if (!parse(argc, argv, options)) return 2;
+    } catch (const std::exception& e) {
+        std::cerr << "invalid option value: " << e.what() << '\n';
+        return 2;
+    }
+
+    std::ofstream file;
+    if (!options.csv.empty()) {
+        file.open(options.csv, std::ios::out | std::ios::trunc);
+        if (!file) {
+            std::cerr << "cannot write " << options.csv << '\n';
+            return 1;
+        }
+        write_header(file);
+    }
+
+    const std::vector<Sample> samples = run(options, options.csv.empty() ? nullptr : &file);
+    const int drifted = report_drift(options, samples);
+    if (drifted != 0) {
+        std::cout << drifted << " metric(s) drifted more than " << std::setprecision(6)
+                  << options.threshold_pct << "%\n";
+        return 1;
+    }
+    return 0;
+}
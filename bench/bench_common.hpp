@@ -0,0 +1,298 @@
+#pragma once
+#include <async_deque/stats.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @file bench_common.hpp
+ * @brief Helpers shared by the AsyncDeque benchmark programs
+ */
+
+namespace bench {
+
+/**
+ * @brief Trivially copyable payload of N bytes
+ *
+ * Moving it costs the same as copying it, which is the worst case for a queue
+ * that stores elements by value.
+ */
+template<size_t N>
+struct Payload {
+    std::array<unsigned char, N> bytes{};
+
+    Payload() = default;
+    explicit Payload(uint64_t value) {
+        bytes[0] = static_cast<unsigned char>(value);
+    }
+};
+
+template<typename T>
+std::string payload_name() {
+    return std::to_string(sizeof(T)) + "B";
+}
+
+/// Pins the calling thread to @p cpu; returns false if that is not possible
+inline bool pin_to_cpu(int cpu) {
+#if defined(__linux__)
+    if (cpu < 0 || cpu >= CPU_SETSIZE) return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+/**
+ * @brief Restores the calling thread's CPU affinity on destruction
+ *
+ * Benchmarks that pin the benchmark thread itself use it, so that the
+ * benchmarks after them, and the threads those spawn, are not left on one CPU.
+ */
+class AffinityGuard {
+public:
+    AffinityGuard() {
+#if defined(__linux__)
+        saved_ = pthread_getaffinity_np(pthread_self(), sizeof(set_), &set_) == 0;
+#endif
+    }
+
+    ~AffinityGuard() {
+#if defined(__linux__)
+        if (saved_) pthread_setaffinity_np(pthread_self(), sizeof(set_), &set_);
+#endif
+    }
+
+    AffinityGuard(const AffinityGuard&) = delete;
+    AffinityGuard& operator=(const AffinityGuard&) = delete;
+
+private:
+#if defined(__linux__)
+    cpu_set_t set_;
+    bool saved_ = false;
+#endif
+};
+
+/**
+ * @brief Threads spawned once per benchmark and run again for every iteration
+ *
+ * Keeps thread creation and teardown out of the timed loop: run_round()
+ * releases every worker into @p body and returns when all of them are done.
+ */
+class RoundWorkers {
+public:
+    RoundWorkers(int count, std::function<void(int)> body) : body_(std::move(body)) {
+        threads_.reserve(count);
+        for (int i = 0; i < count; ++i) {
+            threads_.emplace_back([this, i] { work(i); });
+        }
+    }
+
+    RoundWorkers(const RoundWorkers&) = delete;
+    RoundWorkers& operator=(const RoundWorkers&) = delete;
+
+    ~RoundWorkers() {
+        join();
+    }
+
+    void run_round() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        finished_ = 0;
+        ++round_;
+        start_.notify_all();
+        done_.wait(lock, [&] { return finished_ == threads_.size(); });
+    }
+
+    /// Ends the workers; their hardware counters are folded into the process's as they exit
+    void join() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        start_.notify_all();
+        for (auto& thread : threads_) {
+            if (thread.joinable()) thread.join();
+        }
+    }
+
+private:
+    void work(int index) {
+        uint64_t seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                start_.wait(lock, [&] { return stopping_ || round_ != seen; });
+                if (stopping_) return;
+                seen = round_;
+            }
+            body_(index);
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (++finished_ == threads_.size()) done_.notify_one();
+        }
+    }
+
+    const std::function<void(int)> body_;
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable start_;
+    std::condition_variable done_;
+    uint64_t round_ = 0;
+    size_t finished_ = 0;
+    bool stopping_ = false;
+};
+
+/// Resident set size of the process from /proc/self/statm; -1 if unavailable
+inline int64_t rss_bytes() {
+#if defined(__linux__)
+    std::ifstream statm("/proc/self/statm");
+    int64_t pages = 0;
+    int64_t resident = 0;
+    if (statm >> pages >> resident) return resident * ::sysconf(_SC_PAGESIZE);
+#endif
+    return -1;
+}
+
+/// Bytes glibc reports as handed out (mallinfo2().uordblks); -1 if unavailable
+inline int64_t malloc_in_use_bytes() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    return static_cast<int64_t>(mallinfo2().uordblks);
+#else
+    return -1;
+#endif
+}
+
+/// Latency histogram of the open-loop drivers
+using LatencyHistogram = async_deque::LogLinearHistogram<5, 40>;
+
+/// Inter-arrival distribution of an open-loop producer
+enum class Arrival { constant, poisson, bursty };
+
+/**
+ * @brief Intended send times of one open-loop producer
+ *
+ * Times advance by the drawn gap regardless of when the previous item was
+ * actually pushed, so a producer that falls behind pushes at once instead
+ * of skipping ahead, and the time it was late counts toward latency.
+ */
+class OpenLoopSchedule {
+public:
+    /**
+     * @param rate Items per second from this producer
+     * @param start_ns steady_now_ns() time of the first item
+     * @param burst Items per burst for Arrival::bursty
+     * @param seed Seed for Arrival::poisson
+     */
+    OpenLoopSchedule(Arrival arrival, double rate, uint64_t start_ns, int burst = 1,
+                     uint64_t seed = 1)
+        : arrival_(arrival), burst_(std::max(burst, 1)), mean_gap_ns_(1e9 / rate),
+          next_ns_(static_cast<double>(start_ns)), random_(seed) {}
+
+    uint64_t next() {
+        const uint64_t at = static_cast<uint64_t>(next_ns_);
+        if (arrival_ == Arrival::constant) {
+            next_ns_ += mean_gap_ns_;
+        } else if (arrival_ == Arrival::bursty) {
+            // burst_ items back to back, then a gap that keeps the mean rate
+            if (++in_burst_ == burst_) {
+                in_burst_ = 0;
+                next_ns_ += mean_gap_ns_ * burst_;
+            }
+        } else {
+            next_ns_ += std::exponential_distribution<double>(1.0 / mean_gap_ns_)(random_);
+        }
+        return at;
+    }
+
+private:
+    const Arrival arrival_;
+    const int burst_;
+    const double mean_gap_ns_;
+    double next_ns_;
+    int in_burst_ = 0;
+    std::mt19937_64 random_;
+};
+
+/// Yields until steady_now_ns() reaches @p deadline_ns
+inline void spin_until(uint64_t deadline_ns) {
+    while (async_deque::detail::steady_now_ns() < deadline_ns) {
+        std::this_thread::yield();
+    }
+}
+
+/**
+ * @brief Open-loop latencies, measured from each item's intended send time
+ *
+ * record() may be called from any number of consumer threads; interval()
+ * from one reporting thread.
+ */
+class LatencyRecorder {
+public:
+    /// Records the latency of an item meant to be sent at @p intended_ns
+    void record(uint64_t intended_ns) {
+        const uint64_t now = async_deque::detail::steady_now_ns();
+        const uint64_t latency = now > intended_ns ? now - intended_ns : 0;
+        histogram_->record(latency);
+        uint64_t seen = interval_max_.load(std::memory_order_relaxed);
+        while (latency > seen &&
+               !interval_max_.compare_exchange_weak(seen, latency, std::memory_order_relaxed)) {
+        }
+    }
+
+    /// Every latency recorded so far
+    async_deque::HistogramSnapshot snapshot() const {
+        return histogram_->snapshot();
+    }
+
+    /// Latencies recorded since the previous call, with the exact maximum of that interval
+    async_deque::HistogramSnapshot interval() {
+        const async_deque::HistogramSnapshot now = histogram_->snapshot();
+        async_deque::HistogramSnapshot diff = now;
+        for (size_t i = 0; i < diff.counts.size() && i < last_.counts.size(); ++i) {
+            diff.counts[i] -= last_.counts[i];
+        }
+        diff.count -= last_.count;
+        diff.sum -= last_.sum;
+        diff.max = interval_max_.exchange(0, std::memory_order_relaxed);
+        last_ = now;
+        return diff;
+    }
+
+private:
+    std::unique_ptr<LatencyHistogram> histogram_ = std::make_unique<LatencyHistogram>();
+    std::atomic<uint64_t> interval_max_{0};
+    async_deque::HistogramSnapshot last_;
+};
+
+/// Bytes glibc holds in its arenas, in use or free (mallinfo2().arena + hblkhd); -1 if unavailable
+inline int64_t malloc_arena_bytes() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    const struct mallinfo2 info = mallinfo2();
+    return static_cast<int64_t>(info.arena + info.hblkhd);
+#else
+    return -1;
+#endif
+}
+
+} // namespace bench
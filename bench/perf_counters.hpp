@@ -0,0 +1,183 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @file perf_counters.hpp
+ * @brief Hardware and scheduler counters around a benchmark run
+ *
+ * @details PerfCounters opens one perf_event_open counter per event for the
+ * calling process. The counters are inherited by threads created after
+ * start(), which covers the producer and consumer threads of a benchmark
+ * round. Events the kernel refuses (no PMU in a VM, perf_event_paranoid,
+ * seccomp) are left empty. Context switches fall back to getrusage()
+ * voluntary plus involuntary switches, which covers every thread of the
+ * process, so they are always available.
+ *
+ * Example:
+ * @code{.cpp}
+ * bench::PerfCounters perf;
+ * perf.start();
+ * for (auto _ : state) { ... }
+ * bench::report_per_item(state, perf.stop(), items);
+ * @endcode
+ */
+
+namespace bench {
+
+/// Counter deltas between PerfCounters::start() and stop()
+struct PerfSample {
+    std::optional<uint64_t> cycles;
+    std::optional<uint64_t> instructions;
+    std::optional<uint64_t> cache_misses;       ///< PERF_COUNT_HW_CACHE_MISSES
+    std::optional<uint64_t> llc_misses;         ///< Last-level cache read misses
+    uint64_t context_switches = 0;
+    bool context_switches_from_perf = false;    ///< false: from getrusage()
+};
+
+class PerfCounters {
+public:
+    PerfCounters() {
+#if defined(__linux__)
+        fds_[cycles] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        fds_[instructions] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        fds_[cache_misses] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+        fds_[llc_misses] = open(PERF_TYPE_HW_CACHE,
+                                PERF_COUNT_HW_CACHE_LL |
+                                    (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+        fds_[context_switches] = open(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES);
+#endif
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    ~PerfCounters() {
+#if defined(__linux__)
+        for (int fd : fds_) {
+            if (fd >= 0) ::close(fd);
+        }
+#endif
+    }
+
+    /// True if at least one hardware event could be opened
+    bool has_hardware() const {
+        return fds_[cycles] >= 0 || fds_[instructions] >= 0 ||
+               fds_[cache_misses] >= 0 || fds_[llc_misses] >= 0;
+    }
+
+    void start() {
+#if defined(__linux__)
+        for (int fd : fds_) {
+            if (fd < 0) continue;
+            ::ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ::ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+        rusage_switches_ = rusage_context_switches();
+    }
+
+    PerfSample stop() {
+        PerfSample sample;
+#if defined(__linux__)
+        for (int fd : fds_) {
+            if (fd >= 0) ::ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        }
+        sample.cycles = read(fds_[cycles]);
+        sample.instructions = read(fds_[instructions]);
+        sample.cache_misses = read(fds_[cache_misses]);
+        sample.llc_misses = read(fds_[llc_misses]);
+        if (auto switches = read(fds_[context_switches])) {
+            sample.context_switches = *switches;
+            sample.context_switches_from_perf = true;
+            return sample;
+        }
+#endif
+        sample.context_switches = rusage_context_switches() - rusage_switches_;
+        return sample;
+    }
+
+private:
+    enum Event { cycles, instructions, cache_misses, llc_misses, context_switches, event_count };
+
+#if defined(__linux__)
+    static int open(uint32_t type, uint64_t config) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_hv = 1;
+        // User-space only for hardware events, which perf_event_paranoid=2 allows
+        attr.exclude_kernel = type != PERF_TYPE_SOFTWARE;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+
+    /// Reads a counter, scaled up if the PMU was multiplexed between events
+    static std::optional<uint64_t> read(int fd) {
+        if (fd < 0) return std::nullopt;
+        uint64_t values[3] = {};   // value, time enabled, time running
+        if (::read(fd, values, sizeof(values)) != static_cast<ssize_t>(sizeof(values))) {
+            return std::nullopt;
+        }
+        if (values[2] == 0) return values[1] == 0 ? std::optional<uint64_t>(0) : std::nullopt;
+        if (values[2] == values[1]) return values[0];
+        return static_cast<uint64_t>(static_cast<double>(values[0]) *
+                                     static_cast<double>(values[1]) /
+                                     static_cast<double>(values[2]));
+    }
+#endif
+
+    static uint64_t rusage_context_switches() {
+#if defined(__linux__)
+        rusage usage;
+        if (::getrusage(RUSAGE_SELF, &usage) == 0) {
+            return static_cast<uint64_t>(usage.ru_nvcsw) + static_cast<uint64_t>(usage.ru_nivcsw);
+        }
+#endif
+        return 0;
+    }
+
+    std::array<int, event_count> fds_ = {-1, -1, -1, -1, -1};
+    uint64_t rusage_switches_ = 0;
+};
+
+/**
+ * @brief Adds the counters of @p sample divided by @p items to a benchmark
+ *
+ * Events that could not be measured are left out rather than reported as 0.
+ *
+ * @tparam State benchmark::State
+ */
+template<typename State>
+void report_per_item(State& state, const PerfSample& sample, double items) {
+    if (items <= 0) return;
+    auto add = [&](const char* name, const std::optional<uint64_t>& value) {
+        if (value) state.counters[name] = static_cast<double>(*value) / items;
+    };
+    add("cycles/item", sample.cycles);
+    add("instructions/item", sample.instructions);
+    add("cache_misses/item", sample.cache_misses);
+    add("llc_misses/item", sample.llc_misses);
+    if (sample.cycles && sample.instructions && *sample.cycles != 0) {
+        state.counters["ipc"] = static_cast<double>(*sample.instructions) /
+                                static_cast<double>(*sample.cycles);
+    }
+    state.counters["ctx_switches/item"] = static_cast<double>(sample.context_switches) / items;
+}
+
+} // namespace bench
@@ -1,10 +1,24 @@
 #pragma once
+#include <algorithm>
 #include <deque>
 #include <mutex>
 #include <optional>
 #include <condition_variable>
 #include <chrono>
+#include <atomic>
+#include <memory>
 #include <type_traits>
+#include <limits>
+#include <utility>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "probes.hpp"
+#include "serializer.hpp"
+#include "stats.hpp"
+#include "sync.hpp"
+#include "trace.hpp"
 
 /**
  * @file async_deque.hpp
@@ -42,6 +56,42 @@ namespace async_deque {
 template<typename T, typename... Extensions>
 class AsyncDeque;
 
+/**
+ * @brief Selects when the extension hooks of an AsyncDeque are invoked
+ */
+enum class HookMode {
+    immediate,  ///< Hooks run inside the critical section, before the mutex is released
+    deferred    ///< Hooks run after the mutex is released, so their cost is not paid under the lock
+};
+
+namespace detail {
+
+/**
+ * @brief Leading bytes of the stream written by AsyncDeque::snapshot()
+ *
+ * Followed by count elements: with the raw flag, element_size bytes each,
+ * otherwise a 4-byte length and that many serialized bytes each. Integers
+ * are in host byte order, so a snapshot is restored on the same platform.
+ */
+struct SnapshotHeader {
+    char magic[8];           ///< "ADQSNAP" and a NUL
+    uint32_t version;
+    uint32_t flags;
+    uint64_t element_size;   ///< sizeof(T) with the raw flag, otherwise 0
+    uint64_t count;
+
+    static constexpr char expected_magic[8] = {'A', 'D', 'Q', 'S', 'N', 'A', 'P', '\0'};
+    static constexpr uint32_t current_version = 1;
+    static constexpr uint32_t raw = 1;   ///< Elements are the bytes of trivially copyable objects
+    static constexpr size_t buffer_bytes = 64 * 1024;   ///< Batching of serialized elements
+};
+static_assert(sizeof(SnapshotHeader) == 32, "snapshot header layout");
+
+/// Queue whose mutex the calling thread holds through AsyncDeque::Lock, if any
+inline thread_local const void* held_queue = nullptr;
+
+} // namespace detail
+
 /**
  * @brief A thread-safe asynchronous double-ended queue
  *
@@ -64,11 +114,17 @@ class AsyncDeque;
 template<typename T>
 class AsyncDeque<T> {
 protected:
-    mutable std::mutex mutex_;              ///< Mutex for thread-safety
-    std::condition_variable cv_;            ///< Condition variable for blocking operations
+    mutable detail::Mutex mutex_;           ///< Mutex for thread-safety
+    detail::ConditionVariable not_empty_;   ///< Consumers wait here for an item
+    detail::ConditionVariable not_full_;    ///< Producers wait here for space
     std::deque<T> deque_;                  ///< Underlying container
     bool closed_ = false;                   ///< Queue state flag
     const size_t capacity_;                 ///< Maximum queue capacity
+    const HookMode hook_mode_;              ///< When the extension hooks are invoked
+    mutable detail::DequeMetrics metrics_;  ///< Counters behind stats()
+    std::atomic<detail::LockProfile*> lock_profile_{nullptr};  ///< Set once by enable_lock_profiling()
+    std::unique_ptr<detail::LockProfile> lock_profile_storage_;  ///< Owns *lock_profile_
+    size_t checked_out_ = 0;                ///< Items a derived class took out and may put back; they count toward capacity_ and keep a closed queue from reading as drained
 
     /**
      * @name Extension Hooks
@@ -79,39 +135,63 @@ protected:
     /**
      * @brief Called after an item is pushed to the back
      * @param item Reference to the item that was pushed
-     * @note Thread-safe: called while holding the mutex
+     * @note Thread-safe: called while holding the mutex (see HookMode)
      */
     virtual void on_push_back(const T& item) {}
 
     /**
      * @brief Called after an item is pushed to the front
      * @param item Reference to the item that was pushed
-     * @note Thread-safe: called while holding the mutex
+     * @note Thread-safe: called while holding the mutex (see HookMode)
      */
     virtual void on_push_front(const T& item) {}
 
     /**
      * @brief Called after an item is popped from the back
      * @param item Reference to the item that was popped
-     * @note Thread-safe: called while holding the mutex
+     * @note Thread-safe: called while holding the mutex (see HookMode)
      */
     virtual void on_pop_back(const T& item) {}
 
     /**
      * @brief Called after an item is popped from the front
      * @param item Reference to the item that was popped
-     * @note Thread-safe: called while holding the mutex
+     * @note Thread-safe: called while holding the mutex (see HookMode)
      */
     virtual void on_pop_front(const T& item) {}
 
     /**
      * @brief Called when the queue is closed
-     * @note Thread-safe: called while holding the mutex
+     * @note Thread-safe: called while holding the mutex, or right after it
+     *       is released when hook_mode() is HookMode::deferred
      */
     virtual void on_close() {}
 
     /** @} */  // End of Extension Hooks
 
+    /**
+     * @brief Constructs an AsyncDeque whose hooks are delivered in the given mode
+     *
+     * Intended for derived classes whose hooks are too expensive to run inside
+     * the critical section (logging, metrics export, ...). In deferred mode:
+     * - pop hooks receive the popped item after the mutex has been released;
+     * - push hooks receive the caller's item if it was passed as an lvalue,
+     *   otherwise a copy of the queued element, taken under the mutex once
+     *   the push has succeeded. Move-only
+     *   element types cannot be copied, so their push hooks still run
+     *   under the mutex;
+     * - on_close() runs after the mutex has been released.
+     *
+     * By the time a deferred hook runs, the item may already have been
+     * consumed by another thread, and hooks from different threads may be
+     * observed out of queue order.
+     *
+     * @param capacity Maximum number of items the queue can hold
+     * @param hook_mode When the extension hooks are invoked
+     */
+    AsyncDeque(size_t capacity, HookMode hook_mode)
+        : capacity_(capacity), hook_mode_(hook_mode) {}
+
 public:
     /**
      * @brief Constructs an AsyncDeque with the specified capacity
@@ -124,7 +204,7 @@ public:
      * @post this->capacity() == capacity
      */
     explicit AsyncDeque(size_t capacity = std::numeric_limits<size_t>::max())
-        : capacity_(capacity) {}
+        : AsyncDeque(capacity, HookMode::immediate) {}
 
     /**
      * @brief Destructor
@@ -151,10 +231,12 @@ public:
      * @post other is empty but valid
      */
     AsyncDeque(AsyncDeque&& other) noexcept
-        : capacity_(other.capacity_) {
-        std::lock_guard<std::mutex> lock(other.mutex_);
+        : capacity_(other.capacity_), hook_mode_(other.hook_mode_) {
+        std::lock_guard<detail::Mutex> lock(other.mutex_);
         deque_ = std::move(other.deque_);
         closed_ = other.closed_;
+        metrics_.set_depth(deque_.size());
+        other.metrics_.set_depth(0);
     }
 
     /**
@@ -171,6 +253,8 @@ public:
             std::scoped_lock lock(mutex_, other.mutex_);
             deque_ = std::move(other.deque_);
             closed_ = other.closed_;
+            metrics_.set_depth(deque_.size());
+            other.metrics_.set_depth(other.deque_.size());
         }
         return *this;
     }
@@ -191,12 +275,16 @@ public:
      * @{
      */
     bool empty() const {
-        std::lock_guard<std::mutex> lock(mutex_);
+        Lock lock(*this, CallSite::empty);
         return deque_.empty();
     }
 
+    /**
+     * @brief Returns the number of queued items
+     * @note Acquires the mutex; a monitoring thread can read stats().depth instead
+     */
     size_t size() const {
-        std::lock_guard<std::mutex> lock(mutex_);
+        Lock lock(*this, CallSite::size);
         return deque_.size();
     }
 
@@ -204,20 +292,74 @@ public:
         return capacity_;
     }
 
+    HookMode hook_mode() const {
+        return hook_mode_;
+    }
+
     bool is_closed() const {
-        std::lock_guard<std::mutex> lock(mutex_);
+        Lock lock(*this, CallSite::is_closed);
         return closed_;
     }
 
     void close() {
+        bool closed_now = false;
         {
-            std::lock_guard<std::mutex> lock(mutex_);
+            Lock lock(*this, CallSite::close);
             if (!closed_) {
                 closed_ = true;
-                on_close();
+                closed_now = true;
+                ASYNC_DEQUE_PROBE2(close, this, deque_.size());
+                record_notify(Side::consumer);
+                record_notify(Side::producer);
+                if (hook_mode_ == HookMode::immediate) {
+                    on_close();
+                }
             }
         }
-        cv_.notify_all();
+        if (!closed_now) return;
+        not_empty_.notify_all();
+        not_full_.notify_all();
+        if (hook_mode_ == HookMode::deferred) {
+            on_close();
+        }
+    }
+
+    /**
+     * @brief Returns a snapshot of the queue's statistics
+     *
+     * Does not acquire the queue mutex, so it can be polled from a monitoring
+     * thread without slowing down producers and consumers.
+     *
+     * @note Thread-safe
+     */
+    DequeStats stats() const {
+        DequeStats result = metrics_.snapshot();
+        if (const detail::LockProfile* profile = lock_profile_.load(std::memory_order_acquire)) {
+            result.lock_sites = profile->snapshot();
+        }
+        return result;
+    }
+
+    /**
+     * @brief Starts recording mutex wait and hold times per call site
+     *
+     * From then on every public call that takes the mutex records whether it
+     * found the mutex contended, how long it waited for it and how long it
+     * held it, reported in DequeStats::lock_sites. Profiling costs two clock
+     * reads per call and cannot be switched off again.
+     *
+     * @note Thread-safe; calls already in progress are not profiled
+     */
+    void enable_lock_profiling() {
+        std::lock_guard<detail::Mutex> lock(mutex_);
+        if (!lock_profile_storage_) {
+            lock_profile_storage_ = std::make_unique<detail::LockProfile>();
+            lock_profile_.store(lock_profile_storage_.get(), std::memory_order_release);
+        }
+    }
+
+    bool lock_profiling_enabled() const {
+        return lock_profile_.load(std::memory_order_relaxed) != nullptr;
     }
 
     /** @} */
@@ -241,34 +383,12 @@ public:
      */
     template<typename U>
     bool push_back(U&& item) {
-        std::unique_lock<std::mutex> lock(mutex_);
-        cv_.wait(lock, [this] {
-            return closed_ || deque_.size() < capacity_;
-        });
-
-        if (closed_) return false;
-
-        deque_.push_back(std::forward<U>(item));
-        on_push_back(deque_.back());
-        lock.unlock();
-        cv_.notify_one();
-        return true;
+        return push<End::back>(std::forward<U>(item));
     }
 
     template<typename U>
     bool push_front(U&& item) {
-        std::unique_lock<std::mutex> lock(mutex_);
-        cv_.wait(lock, [this] {
-            return closed_ || deque_.size() < capacity_;
-        });
-
-        if (closed_) return false;
-
-        deque_.push_front(std::forward<U>(item));
-        on_push_front(deque_.front());
-        lock.unlock();
-        cv_.notify_one();
-        return true;
+        return push<End::front>(std::forward<U>(item));
     }
     /**
      * @brief Attempts to push an item to the back with a timeout
@@ -284,38 +404,29 @@ public:
      */
     template<typename Rep, typename Period>
     bool try_push_back(const T& item, const std::chrono::duration<Rep, Period>& timeout) {
-        std::unique_lock<std::mutex> lock(mutex_);
-        if (!cv_.wait_for(lock, timeout, [this] {
-            return closed_ || deque_.size() < capacity_;
-        })) {
-            return false;
-        }
-
-        if (closed_) return false;
+        return push<End::back>(item, timeout);
+    }
 
-        deque_.push_back(item);
-        on_push_back(deque_.back());
-        lock.unlock();
-        cv_.notify_one();
-        return true;
+    /**
+     * @brief Attempts to move an item to the back with a timeout
+     *
+     * The item is only moved from if it was pushed.
+     *
+     * @throws Any exception thrown by T's move constructor
+     */
+    template<typename Rep, typename Period>
+    bool try_push_back(T&& item, const std::chrono::duration<Rep, Period>& timeout) {
+        return push<End::back>(std::move(item), timeout);
     }
 
     template<typename Rep, typename Period>
     bool try_push_front(const T& item, const std::chrono::duration<Rep, Period>& timeout) {
-        std::unique_lock<std::mutex> lock(mutex_);
-        if (!cv_.wait_for(lock, timeout, [this] {
-            return closed_ || deque_.size() < capacity_;
-        })) {
-            return false;
-        }
-
-        if (closed_) return false;
+        return push<End::front>(item, timeout);
+    }
 
-        deque_.push_front(item);
-        on_push_front(deque_.front());
-        lock.unlock();
-        cv_.notify_one();
-        return true;
+    template<typename Rep, typename Period>
+    bool try_push_front(T&& item, const std::chrono::duration<Rep, Period>& timeout) {
+        return push<End::front>(std::move(item), timeout);
     }
 
     /** @} */  // End of Push Operations
@@ -326,75 +437,180 @@ public:
      * @{
      */
     std::optional<T> pop_front() {
-        std::unique_lock<std::mutex> lock(mutex_);
-        cv_.wait(lock, [this] {
-            return closed_ || !deque_.empty();
-        });
-
-        if (deque_.empty()) return std::nullopt;
-
-        T item = std::move(deque_.front());
-        deque_.pop_front();
-        on_pop_front(item);
-        lock.unlock();
-        cv_.notify_one();
-        return item;
+        return pop<End::front>();
     }
 
     std::optional<T> pop_back() {
-        std::unique_lock<std::mutex> lock(mutex_);
-        cv_.wait(lock, [this] {
-            return closed_ || !deque_.empty();
-        });
-
-        if (deque_.empty()) return std::nullopt;
-
-        T item = std::move(deque_.back());
-        deque_.pop_back();
-        on_pop_back(item);
-        lock.unlock();
-        cv_.notify_one();
-        return item;
+        return pop<End::back>();
     }
 
     template<typename Rep, typename Period>
     std::optional<T> try_pop_front(const std::chrono::duration<Rep, Period>& timeout) {
-        std::unique_lock<std::mutex> lock(mutex_);
-        if (!cv_.wait_for(lock, timeout, [this] {
-            return closed_ || !deque_.empty();
-        })) {
-            return std::nullopt;
-        }
-
-        if (deque_.empty()) return std::nullopt;
-
-        T item = std::move(deque_.front());
-        deque_.pop_front();
-        on_pop_front(item);
-        lock.unlock();
-        cv_.notify_one();
-        return item;
+        return pop<End::front>(timeout);
     }
 
     template<typename Rep, typename Period>
     std::optional<T> try_pop_back(const std::chrono::duration<Rep, Period>& timeout) {
-        std::unique_lock<std::mutex> lock(mutex_);
-        if (!cv_.wait_for(lock, timeout, [this] {
-            return closed_ || !deque_.empty();
-        })) {
-            return std::nullopt;
+        return pop<End::back>(timeout);
+    }
+    /** @} */  // End of Pop Operations
+
+    /**
+     * @name Snapshot and Restore
+     * Copying the queued items to another process across a restart
+     * @{
+     */
+
+    /**
+     * @brief Writes every queued item to @p writer, front to back
+     *
+     * All items are written under one acquisition of the mutex, so the
+     * snapshot is a consistent cut, and producers and consumers wait until
+     * it is done. For a restart, close() the queue first so that nothing is
+     * pushed or popped after the cut. The queue is left unchanged.
+     *
+     * With the default serializer the elements are copied as raw bytes,
+     * straight from the deque's storage blocks with one writer call per
+     * block. Other serializers write each element as a 4-byte length and
+     * its bytes, batched through a 64KB buffer.
+     *
+     * @param writer Callable `bool(const void* data, size_t size)` that writes all of data
+     * @param serializer Converts items to bytes; see TrivialSerializer
+     * @return false if the writer failed or an item serialized to 4GB or more
+     *
+     * Example usage:
+     * @code{.cpp}
+     * FILE* file = std::fopen("queue.snapshot", "wb");
+     * queue.close();
+     * queue.snapshot([&](const void* data, size_t size) {
+     *     return std::fwrite(data, 1, size, file) == size;
+     * });
+     * @endcode
+     */
+    template<typename Writer, typename Serializer = TrivialSerializer<T>>
+    bool snapshot(Writer&& writer, const Serializer& serializer = Serializer()) const {
+        constexpr bool raw = std::is_same_v<Serializer, TrivialSerializer<T>>;
+        Lock lock(*this, CallSite::snapshot);
+        detail::SnapshotHeader header{};
+        std::memcpy(header.magic, detail::SnapshotHeader::expected_magic, sizeof(header.magic));
+        header.version = detail::SnapshotHeader::current_version;
+        header.flags = raw ? detail::SnapshotHeader::raw : 0;
+        header.element_size = raw ? sizeof(T) : 0;
+        header.count = deque_.size();
+        if (!writer(static_cast<const void*>(&header), sizeof(header))) return false;
+
+        if constexpr (raw) {
+            // std::deque stores elements in fixed-size blocks; write each run of
+            // adjacent elements in one call
+            for (auto it = deque_.begin(); it != deque_.end();) {
+                const T* run = &*it;
+                size_t n = 1;
+                for (++it; it != deque_.end() && &*it == run + n; ++it) ++n;
+                if (!writer(static_cast<const void*>(run), n * sizeof(T))) return false;
+            }
+            return true;
+        } else {
+            std::vector<unsigned char> buffer;
+            buffer.reserve(detail::SnapshotHeader::buffer_bytes);
+            for (const T& item : deque_) {
+                const size_t bytes = serializer.size(item);
+                if (bytes > std::numeric_limits<uint32_t>::max()) return false;
+                const size_t record = sizeof(uint32_t) + bytes;
+                if (!buffer.empty() && buffer.size() + record > detail::SnapshotHeader::buffer_bytes) {
+                    if (!writer(static_cast<const void*>(buffer.data()), buffer.size())) return false;
+                    buffer.clear();
+                }
+                const size_t offset = buffer.size();
+                const uint32_t length = static_cast<uint32_t>(bytes);
+                buffer.resize(offset + record);
+                std::memcpy(buffer.data() + offset, &length, sizeof(length));
+                serializer.write(item, buffer.data() + offset + sizeof(length));
+            }
+            return buffer.empty() || writer(static_cast<const void*>(buffer.data()), buffer.size());
+        }
+    }
+
+    /**
+     * @brief Appends the items of a snapshot() to the back of the queue
+     *
+     * The stream is decoded before the mutex is taken; the items are then
+     * added under one acquisition, and moved in wholesale if the queue is
+     * empty. on_push_back() runs for each restored item, under the mutex or,
+     * in HookMode::deferred, after it is released; deferred hooks see copies
+     * taken before the mutex, so move-only items always run them under it.
+     *
+     * @param reader Callable `bool(void* data, size_t size)` that fills all of data
+     * @param serializer Rebuilds items from bytes; must match the one given to snapshot()
+     * @return false, leaving the queue unchanged, if the stream is truncated
+     *         or was written for another element type or serializer, if the
+     *         items do not fit in the remaining capacity, or if the queue is closed
+     */
+    template<typename Reader, typename Serializer = TrivialSerializer<T>>
+    bool restore(Reader&& reader, const Serializer& serializer = Serializer()) {
+        constexpr bool raw = std::is_same_v<Serializer, TrivialSerializer<T>>;
+        detail::SnapshotHeader header{};
+        if (!reader(static_cast<void*>(&header), sizeof(header)) ||
+            std::memcmp(header.magic, detail::SnapshotHeader::expected_magic, sizeof(header.magic)) != 0 ||
+            header.version != detail::SnapshotHeader::current_version ||
+            header.flags != (raw ? detail::SnapshotHeader::raw : 0) ||
+            header.element_size != (raw ? sizeof(T) : 0)) {
+            return false;
         }
 
-        if (deque_.empty()) return std::nullopt;
+        std::deque<T> restored;
+        std::vector<unsigned char> buffer;
+        if constexpr (raw) {
+            constexpr size_t per_read = std::max<size_t>(1, detail::SnapshotHeader::buffer_bytes / sizeof(T));
+            buffer.resize(std::min<uint64_t>(header.count, per_read) * sizeof(T));
+            for (uint64_t left = header.count; left != 0;) {
+                const size_t n = static_cast<size_t>(std::min<uint64_t>(left, per_read));
+                if (!reader(static_cast<void*>(buffer.data()), n * sizeof(T))) return false;
+                for (size_t i = 0; i < n; ++i) {
+                    restored.push_back(serializer.read(buffer.data() + i * sizeof(T), sizeof(T)));
+                }
+                left -= n;
+            }
+        } else {
+            for (uint64_t i = 0; i < header.count; ++i) {
+                uint32_t length;
+                if (!reader(static_cast<void*>(&length), sizeof(length))) return false;
+                buffer.resize(length);
+                if (length != 0 && !reader(static_cast<void*>(buffer.data()), length)) return false;
+                restored.push_back(serializer.read(buffer.data(), length));
+            }
+        }
+
+        std::deque<T> seen;
+        bool defer_hooks = false;
+        if constexpr (std::is_copy_constructible_v<T>) {
+            if (hook_mode_ == HookMode::deferred) {
+                seen = restored;
+                defer_hooks = true;
+            }
+        }
 
-        T item = std::move(deque_.back());
-        deque_.pop_back();
-        on_pop_back(item);
+        Lock lock(*this, CallSite::restore);
+        if (closed_ || restored.size() > capacity_ - deque_.size() - checked_out_) return false;
+        if (restored.empty()) return true;
+        const size_t first = deque_.size();
+        if (deque_.empty()) {
+            deque_ = std::move(restored);
+        } else {
+            for (T& item : restored) deque_.push_back(std::move(item));
+        }
+        if (!defer_hooks) {
+            for (size_t i = first; i < deque_.size(); ++i) on_push_back(deque_[i]);
+        }
+        metrics_.pushes.add(deque_.size() - first);
+        metrics_.set_depth(deque_.size());
+        record_notify(Side::consumer);
         lock.unlock();
-        cv_.notify_one();
-        return item;
+        not_empty_.notify_all();
+        for (const T& item : seen) on_push_back(item);
+        return true;
     }
-    /** @} */  // End of Pop Operations
+
+    /** @} */  // End of Snapshot and Restore
 
     /**
      * @brief Queries if a specific extension type is present
@@ -410,6 +626,323 @@ public:
     bool has_extension() const {
         return false;  // Base case - no extensions
     }
+
+protected:
+    // For derived classes that move items in or out of deque_ themselves:
+    // they lock, wait and notify through these so that the statistics, lock
+    // profile, trace and probes see their calls like any other.
+
+    enum class Side { producer, consumer };
+
+    /**
+     * @brief Scoped lock on mutex_ that feeds the lock statistics
+     *
+     * Tries the mutex first and only reads the clock if that fails, so an
+     * uncontended acquisition costs the same as a plain lock. With lock
+     * profiling enabled, wait and hold times are also recorded for the call
+     * site.
+     */
+    class Lock {
+    public:
+        Lock(const AsyncDeque& owner, CallSite site)
+            : owner_(owner), lock_(owner.mutex_, std::try_to_lock),
+              profile_(owner.lock_profile_.load(std::memory_order_acquire)),
+              site_(site) {
+            if (!lock_.owns_lock()) {
+                const uint64_t start = detail::steady_now_ns();
+                lock_.lock();
+                const uint64_t waited = detail::steady_now_ns() - start;
+                owner_.metrics_.lock_contentions.add();
+                owner_.metrics_.lock_wait.record(waited);
+                if (profile_) (*profile_)[site_].wait.record(waited);
+            }
+            owner_.metrics_.lock_acquisitions.add();
+            if (profile_) held_since_ = detail::steady_now_ns();
+            detail::held_queue = &owner_;
+        }
+
+        ~Lock() {
+            if (lock_.owns_lock()) unlock();
+        }
+
+        Lock(const Lock&) = delete;
+        Lock& operator=(const Lock&) = delete;
+
+        void unlock() {
+            if (profile_) (*profile_)[site_].hold.record(held_ns_ + detail::steady_now_ns() - held_since_);
+            detail::held_queue = outer_;
+            lock_.unlock();
+        }
+
+        /// Runs a condition variable wait, excluding the time it spends from the hold time
+        template<typename Wait>
+        auto release_during(Wait&& wait) {
+            if (profile_) held_ns_ += detail::steady_now_ns() - held_since_;
+            detail::held_queue = outer_;
+            auto result = wait(lock_);
+            detail::held_queue = &owner_;
+            if (profile_) held_since_ = detail::steady_now_ns();
+            return result;
+        }
+
+    private:
+        const AsyncDeque& owner_;
+        std::unique_lock<detail::Mutex> lock_;
+        detail::LockProfile* const profile_;
+        const CallSite site_;
+        const void* const outer_ = detail::held_queue;   ///< Queue locked by the caller before this one, restored on unlock
+        uint64_t held_since_ = 0;
+        uint64_t held_ns_ = 0;
+    };
+
+    /// True if the calling thread holds mutex_ through a Lock, as it does inside an immediate hook
+    bool lock_held() const {
+        return detail::held_queue == this;
+    }
+
+    /// Records a queue event if the Tracer is running; must be called with mutex_ held
+    void trace(TraceEventKind kind, bool producer = false) const {
+        if (Tracer::enabled()) {
+            Tracer::instance().record(kind, this, deque_.size(), producer);
+        }
+    }
+
+    /**
+     * @brief Waits until pred holds, or until the optional timeout expires
+     *
+     * Producers wait on not_full_ and consumers on not_empty_. Each condition
+     * variable only ever has waiters of one kind, so a notify_one() always
+     * reaches a thread that can use it; with a single condition variable a
+     * consumer's notification could be absorbed by another consumer while a
+     * producer kept sleeping next to free space.
+     *
+     * Time spent blocked is attributed to the given side and stored in
+     * blocked_ns (left untouched if the call did not block).
+     * @return false if the timeout expired with pred still false
+     */
+    template<typename Pred, typename... Timeout>
+    bool wait(Lock& lock, Side side, uint64_t& blocked_ns, Pred pred,
+              const Timeout&... timeout) {
+        static_assert(sizeof...(Timeout) <= 1, "at most one timeout");
+        if (pred()) return true;
+
+        const bool producer = side == Side::producer;
+        trace(TraceEventKind::block_begin, producer);
+        ASYNC_DEQUE_PROBE3(wait_begin, this, deque_.size(), producer);
+        const uint64_t start = detail::steady_now_ns();
+        detail::ConditionVariable& cv = producer ? not_full_ : not_empty_;
+        size_t& waiting = waiting_[side_index(side)];
+        const bool ready = lock.release_during([&](std::unique_lock<detail::Mutex>& native) {
+            ++waiting;
+            bool satisfied = true;
+            [[maybe_unused]] const auto deadline = make_deadline(timeout...);
+            for (;;) {
+                const uint64_t notify_seq = notify_seq_[side_index(side)];
+                if constexpr (sizeof...(Timeout) == 0) {
+                    cv.wait(native);
+                } else if (cv.wait_until(native, deadline) == std::cv_status::timeout) {
+                    satisfied = pred();
+                    break;
+                }
+                record_wakeup(side, notify_seq);
+                if (pred()) break;
+                (producer ? metrics_.producer_wasted_wakeups
+                          : metrics_.consumer_wasted_wakeups).add();
+            }
+            --waiting;
+            return satisfied;
+        });
+        blocked_ns = detail::steady_now_ns() - start;
+        auto& histogram = producer ? metrics_.producer_wait : metrics_.consumer_wait;
+        histogram.record(blocked_ns);
+        trace(TraceEventKind::block_end, producer);
+        ASYNC_DEQUE_PROBE4(wait_end, this, deque_.size(), blocked_ns, producer);
+        return ready;
+    }
+
+    /// Accounts for a notification of @p side about to be issued; must be called with mutex_ held
+    void record_notify(Side side) {
+        const size_t i = side_index(side);
+        ++notify_seq_[i];
+        metrics_.notifies.add();
+        if (waiting_[i] != 0) {
+            last_notify_ns_[i] = detail::steady_now_ns();
+        }
+    }
+
+private:
+    enum class End { front, back };
+
+    template<End end, bool timed>
+    static constexpr CallSite push_site() {
+        if constexpr (end == End::back) {
+            return timed ? CallSite::try_push_back : CallSite::push_back;
+        } else {
+            return timed ? CallSite::try_push_front : CallSite::push_front;
+        }
+    }
+
+    template<End end, bool timed>
+    static constexpr CallSite pop_site() {
+        if constexpr (end == End::back) {
+            return timed ? CallSite::try_pop_back : CallSite::pop_back;
+        } else {
+            return timed ? CallSite::try_pop_front : CallSite::pop_front;
+        }
+    }
+
+    static int make_deadline() {
+        return 0;
+    }
+
+    template<typename Rep, typename Period>
+    static std::chrono::steady_clock::time_point make_deadline(
+            const std::chrono::duration<Rep, Period>& timeout) {
+        return std::chrono::steady_clock::now() +
+               std::chrono::ceil<std::chrono::steady_clock::duration>(timeout);
+    }
+
+    static constexpr size_t side_index(Side side) {
+        return side == Side::producer ? 0 : 1;
+    }
+
+    /// Accounts for a return from a condition variable wait; must be called with mutex_ held
+    void record_wakeup(Side side, uint64_t notify_seq_at_wait) {
+        const size_t i = side_index(side);
+        (side == Side::producer ? metrics_.producer_wakeups : metrics_.consumer_wakeups).add();
+        if (notify_seq_[i] == notify_seq_at_wait) {
+            metrics_.spurious_wakeups.add();
+        } else {
+            metrics_.wakeup_latency.record(detail::steady_now_ns() - last_notify_ns_[i]);
+        }
+    }
+
+    template<End end>
+    void call_push_hook(const T& item) {
+        if constexpr (end == End::back) {
+            on_push_back(item);
+        } else {
+            on_push_front(item);
+        }
+    }
+
+    template<End end>
+    void call_pop_hook(const T& item) {
+        if constexpr (end == End::back) {
+            on_pop_back(item);
+        } else {
+            on_pop_front(item);
+        }
+    }
+
+    /**
+     * @brief Inserts item at the given end, calling the push hook under the
+     *        lock if run_hook is set
+     *
+     * If @p hook_copy is not null and the item was inserted, it receives a
+     * copy of the inserted element for a deferred push hook.
+     */
+    template<End end, typename U, typename... Timeout>
+    bool insert(U&& item, bool run_hook, std::optional<T>* hook_copy, const Timeout&... timeout) {
+        constexpr CallSite site = push_site<end, sizeof...(Timeout) != 0>();
+        Lock lock(*this, site);
+        uint64_t blocked_ns = 0;
+        if (!wait(lock, Side::producer, blocked_ns, [this] {
+            return closed_ || deque_.size() + checked_out_ < capacity_;
+        }, timeout...)) {
+            metrics_.push_timeouts.add();
+            ASYNC_DEQUE_PROBE4(timeout, this, deque_.size(), blocked_ns, static_cast<int>(site));
+            return false;
+        }
+
+        if (closed_) {
+            metrics_.rejected_pushes.add();
+            return false;
+        }
+
+        if constexpr (end == End::back) {
+            deque_.push_back(std::forward<U>(item));
+            if (run_hook) on_push_back(deque_.back());
+        } else {
+            deque_.push_front(std::forward<U>(item));
+            if (run_hook) on_push_front(deque_.front());
+        }
+        if constexpr (std::is_copy_constructible_v<T>) {
+            if (hook_copy) hook_copy->emplace(end == End::back ? deque_.back() : deque_.front());
+        }
+        metrics_.pushes.add();
+        metrics_.set_depth(deque_.size());
+        trace(TraceEventKind::push);
+        ASYNC_DEQUE_PROBE4(push, this, deque_.size(), blocked_ns, static_cast<int>(site));
+        record_notify(Side::consumer);
+        lock.unlock();
+        not_empty_.notify_one();
+        return true;
+    }
+
+    template<End end, typename U, typename... Timeout>
+    bool push(U&& item, const Timeout&... timeout) {
+        if constexpr (std::is_copy_constructible_v<T>) {
+            if (hook_mode_ == HookMode::deferred) {
+                if constexpr (std::is_lvalue_reference_v<U> &&
+                              std::is_same_v<std::decay_t<U>, T>) {
+                    // The caller's object outlives this call, so the hook can see it directly.
+                    if (!insert<end>(item, false, nullptr, timeout...)) return false;
+                    call_push_hook<end>(item);
+                } else {
+                    // Copied under the lock, and only once the push has succeeded
+                    std::optional<T> seen;
+                    if (!insert<end>(std::forward<U>(item), false, &seen, timeout...)) return false;
+                    call_push_hook<end>(*seen);
+                }
+                return true;
+            }
+        }
+        return insert<end>(std::forward<U>(item), true, nullptr, timeout...);
+    }
+
+    template<End end, typename... Timeout>
+    std::optional<T> pop(const Timeout&... timeout) {
+        constexpr CallSite site = pop_site<end, sizeof...(Timeout) != 0>();
+        // Every path returns this object, so it is constructed in the caller's
+        // storage and the element is moved exactly once.
+        std::optional<T> item;
+        Lock lock(*this, site);
+        uint64_t blocked_ns = 0;
+        if (!wait(lock, Side::consumer, blocked_ns, [this] {
+            // Items a derived class has checked out may still be put back
+            return !deque_.empty() || (closed_ && checked_out_ == 0);
+        }, timeout...)) {
+            metrics_.pop_timeouts.add();
+            ASYNC_DEQUE_PROBE4(timeout, this, deque_.size(), blocked_ns, static_cast<int>(site));
+            return item;
+        }
+
+        if (deque_.empty()) return item;
+
+        item.emplace(std::move(end == End::back ? deque_.back() : deque_.front()));
+        if constexpr (end == End::back) {
+            deque_.pop_back();
+        } else {
+            deque_.pop_front();
+        }
+        metrics_.pops.add();
+        metrics_.set_depth(deque_.size());
+        trace(TraceEventKind::pop);
+        ASYNC_DEQUE_PROBE4(pop, this, deque_.size(), blocked_ns, static_cast<int>(site));
+        const bool deferred = hook_mode_ == HookMode::deferred;
+        if (!deferred) call_pop_hook<end>(*item);
+        record_notify(Side::producer);
+        lock.unlock();
+        not_full_.notify_one();
+        if (deferred) call_pop_hook<end>(*item);
+        return item;
+    }
+
+    // Wakeup accounting per side (producer, consumer), guarded by mutex_
+    size_t waiting_[2] = {0, 0};            ///< Threads blocked in a condition variable wait
+    uint64_t notify_seq_[2] = {0, 0};       ///< Number of notifications issued
+    uint64_t last_notify_ns_[2] = {0, 0};   ///< Time of the latest notification issued while someone waited
 };
 
 /**
@@ -0,0 +1,511 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+
+#include "sync.hpp"
+
+/**
+ * @file byte_queue.hpp
+ * @brief Queue of variable-length byte records stored back to back in one ring
+ *
+ * @details AsyncDeque<std::vector<uint8_t>> costs a heap allocation per
+ * message. ByteQueue instead copies each record into a single buffer
+ * allocated up front. It uses the bip-buffer layout: the buffer holds up to
+ * two regions of records, and a record that does not fit before the end of
+ * the buffer goes to a second region at its start. So records never wrap
+ * and are always contiguous. Producers reserve space, write into it in
+ * place and commit. Consumers read a span that points into the buffer and
+ * release it when done. Neither side allocates or copies through an
+ * intermediate buffer.
+ *
+ * A record is a 4-byte length in host byte order followed by the payload.
+ * Payloads are not aligned. ingest() takes a stream already in this layout
+ * and frames it in place (see read_records_from_fd() in fd_io.hpp).
+ *
+ * One reservation and one read are outstanding at a time. A second producer
+ * waits in reserve() until the first has committed, and a second consumer
+ * waits in read() until the first has released. Writing and reading happen
+ * outside the mutex, on disjoint parts of the buffer.
+ *
+ * Example usage:
+ * @code{.cpp}
+ * ByteQueue queue(1 << 20);
+ *
+ * // Producer thread
+ * if (unsigned char* out = queue.reserve(max_frame)) {
+ *     size_t length = encode_frame(out, max_frame);
+ *     queue.commit(length);
+ * }
+ *
+ * // Consumer thread
+ * while (auto record = queue.read()) {
+ *     handle_frame(record->data, record->size);
+ *     queue.release();
+ * }
+ * @endcode
+ */
+
+namespace async_deque {
+
+/**
+ * @brief Read-only view of a record's payload inside a ByteQueue
+ */
+struct ByteSpan {
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+
+    const unsigned char* begin() const { return data; }
+    const unsigned char* end() const { return data + size; }
+    bool empty() const { return size == 0; }
+};
+
+/**
+ * @brief Writable part of a ByteQueue's buffer, handed out by ByteQueue::ingest()
+ */
+struct ByteRange {
+    unsigned char* data;
+    size_t size;
+};
+
+/**
+ * @brief Bounded queue of byte records in a bip-buffer
+ *
+ * Capacity is in bytes and includes the 4-byte length of every record. At
+ * worst half of the buffer is unusable while a region wraps, so size it for
+ * twice the largest record.
+ *
+ * @note All methods are thread-safe
+ */
+class ByteQueue {
+public:
+    static constexpr size_t header_bytes = sizeof(uint32_t);   ///< Length prefix of every record
+
+    /**
+     * @param capacity_bytes Size of the ring buffer, at least header_bytes + 1
+     */
+    explicit ByteQueue(size_t capacity_bytes)
+        : capacity_(capacity_bytes < header_bytes + 1 ? header_bytes + 1 : capacity_bytes),
+          buffer_(new unsigned char[capacity_]) {}
+
+    ByteQueue(const ByteQueue&) = delete;
+    ByteQueue& operator=(const ByteQueue&) = delete;
+
+    ~ByteQueue() {
+        close();
+    }
+
+    /**
+     * @name Producer side
+     * @{
+     */
+
+    /**
+     * @brief Reserves room for a record of up to @p max_length bytes
+     * @return Where to write the payload, or nullptr if the queue is closed
+     *         or the record can never fit (see max_record_size())
+     * @note Blocks while another reservation is outstanding or there is no
+     *       contiguous room. Follow with commit() or cancel().
+     */
+    unsigned char* reserve(size_t max_length) {
+        return reserve_for(max_length, std::nullopt);
+    }
+
+    template<typename Rep, typename Period>
+    unsigned char* try_reserve(size_t max_length, const std::chrono::duration<Rep, Period>& timeout) {
+        return reserve_for(max_length, detail::deadline_after(timeout));
+    }
+
+    /**
+     * @brief Publishes the reserved record with its final length
+     * @param length Payload bytes written; at most the reserved length
+     * @return false if no reservation is outstanding, or if @p length is
+     *         longer than reserved, in which case the reservation is
+     *         cancelled and nothing is published
+     * @note Commits even if the queue was closed after reserve() returned
+     */
+    bool commit(size_t length) {
+        bool fits;
+        {
+            std::lock_guard<detail::Mutex> lock(mutex_);
+            if (!writing_ || streaming_) return false;
+            fits = length <= reserved_;
+            writing_ = false;
+            if (fits) {
+                const uint32_t prefix = static_cast<uint32_t>(length);
+                unsigned char* record = buffer_.get() + reserved_at_;
+                std::memcpy(record, &prefix, sizeof(prefix));
+                (wrapped_ ? b_end_ : a_end_) = reserved_at_ + header_bytes + length;
+                ++records_;
+                used_ += header_bytes + length;
+            } else {
+                close_empty_region();   // as cancel()
+            }
+        }
+        if (fits) not_empty_.notify_one();
+        not_full_.notify_all();
+        return fits;
+    }
+
+    /// Abandons the outstanding reservation without publishing anything
+    void cancel() {
+        {
+            std::lock_guard<detail::Mutex> lock(mutex_);
+            if (!writing_ || streaming_) return;
+            writing_ = false;
+            close_empty_region();
+        }
+        not_full_.notify_all();
+    }
+
+    /**
+     * @brief Copies @p size bytes in as one record
+     * @return false if the queue is closed or the record can never fit
+     */
+    bool push(const void* data, size_t size) {
+        unsigned char* out = reserve(size);
+        if (!out) return false;
+        if (size != 0) std::memcpy(out, data, size);
+        return commit(size);
+    }
+
+    /**
+     * @brief Reads a stream of records straight into the buffer and commits the complete ones
+     *
+     * The stream holds records in the queue's own layout: a 4-byte length in
+     * host byte order, then the payload. @p fill is called once, outside the
+     * mutex, with the free space of the buffer as one or two ranges. It
+     * stores the next bytes of the stream there, in order, and returns how
+     * many: 0 at end of stream, negative on error. Complete records are
+     * committed where they landed. A record cut off by the end of the data
+     * stays reserved, blocking reserve(), until a later call completes it.
+     *
+     * When @p fill fails with no partial record pending, the stream ends and
+     * reserve() is free again. A partial record from earlier calls stays
+     * reserved through the error, so a retry (after EAGAIN, say) can still
+     * complete it; a call that reaches end of stream or finds the queue
+     * closed discards it.
+     *
+     * The second range is offered when the end of the buffer is nearly full.
+     * It starts far enough from offset 0 that the record straddling the end
+     * can be moved in front of its remainder; moving that one partial record
+     * is the only copy.
+     *
+     * @tparam Fill Callable `std::ptrdiff_t(const ByteRange* ranges, size_t count)`
+     * @param max_bytes Upper bound on the bytes offered to @p fill
+     * @return What @p fill returned; 0 without calling it if the queue is
+     *         closed; -1 if the stream holds a record longer than max_record_size()
+     * @note One stream per queue; concurrent calls wait for each other. A
+     *       partial record at the end of the stream is discarded.
+     */
+    template<typename Fill>
+    std::ptrdiff_t ingest(Fill&& fill, size_t max_bytes = std::numeric_limits<size_t>::max()) {
+        max_bytes = std::max<size_t>(max_bytes, 1);
+        std::unique_lock<detail::Mutex> lock(mutex_);
+        detail::wait_until_deadline(lock, not_full_, [this] {
+            return closed_ || (!ingesting_ && (streaming_ ? make_stream_room() : start_stream()));
+        }, std::nullopt);
+        if (closed_) {
+            if (!ingesting_ && streaming_) end_stream();
+            return 0;
+        }
+        ingesting_ = true;
+
+        const size_t start = reserved_at_;
+        const size_t pending = stream_bytes_;
+        const size_t limit = wrapped_ ? a_start_ : capacity_;
+        ByteRange ranges[2];
+        size_t count = 1;
+        ranges[0] = ByteRange{buffer_.get() + start + pending,
+                              std::min(limit - start - pending, max_bytes)};
+        // Leave room at the head for everything from start to the end of the
+        // buffer, the most the straddling record can have there
+        const size_t head_room = limit - start;
+        if (!wrapped_ && ranges[0].size < max_bytes && a_start_ > head_room) {
+            ranges[1] = ByteRange{buffer_.get() + head_room,
+                                  std::min(a_start_ - head_room, max_bytes - ranges[0].size)};
+            count = 2;
+        }
+        lock.unlock();
+        const std::ptrdiff_t result = fill(static_cast<const ByteRange*>(ranges), count);
+        lock.lock();
+        ingesting_ = false;
+
+        bool valid = true;
+        if (result > 0) {
+            const size_t first = std::min(static_cast<size_t>(result), ranges[0].size);
+            const size_t second = static_cast<size_t>(result) - first;
+            size_t at = start;
+            size_t held = pending + first;
+            size_t framed = commit_stream(at, held, valid);
+            if (valid && second != 0) {
+                // Move the straddling record's head in front of its remainder, opening region B there
+                const size_t head = held - framed;
+                const size_t moved_to = head_room - head;
+                std::memcpy(buffer_.get() + moved_to, buffer_.get() + at + framed, head);
+                wrapped_ = true;
+                b_start_ = b_end_ = moved_to;
+                at = moved_to;
+                held = head + second;
+                framed = commit_stream(at, held, valid);
+                if (a_start_ == a_end_) {
+                    // Nothing was left in region A: region B takes its place
+                    a_start_ = b_start_;
+                    a_end_ = b_end_;
+                    b_start_ = b_end_ = 0;
+                    wrapped_ = false;
+                }
+            }
+            reserved_at_ = at + framed;
+            stream_bytes_ = held - framed;
+            if (stream_bytes_ == 0) end_stream();
+        }
+        if (result == 0 || !valid || (result < 0 && stream_bytes_ == 0)) end_stream();
+        lock.unlock();
+        not_empty_.notify_all();
+        not_full_.notify_all();
+        return valid ? result : -1;
+    }
+
+    /** @} */
+
+    /**
+     * @name Consumer side
+     * @{
+     */
+
+    /**
+     * @brief Returns the oldest record, leaving it in the queue until release()
+     * @return std::nullopt once the queue is closed and empty
+     * @note Blocks while the queue is empty or another read is outstanding.
+     *       The span stays valid until release().
+     */
+    std::optional<ByteSpan> read() {
+        return read_for(std::nullopt);
+    }
+
+    template<typename Rep, typename Period>
+    std::optional<ByteSpan> try_read(const std::chrono::duration<Rep, Period>& timeout) {
+        return read_for(detail::deadline_after(timeout));
+    }
+
+    /// Removes the record returned by the last read()
+    void release() {
+        {
+            std::lock_guard<detail::Mutex> lock(mutex_);
+            if (!reading_) return;
+            uint32_t length;
+            std::memcpy(&length, buffer_.get() + a_start_, sizeof(length));
+            a_start_ += header_bytes + length;
+            used_ -= header_bytes + length;
+            --records_;
+            reading_ = false;
+            if (a_start_ == a_end_) {
+                if (wrapped_) {
+                    // Region A is used up and region B becomes A
+                    a_start_ = b_start_;
+                    a_end_ = b_end_;
+                    b_start_ = b_end_ = 0;
+                    wrapped_ = false;
+                } else if (!writing_) {
+                    // Empty, and no reservation pending at a_end_: start over at offset 0
+                    a_start_ = a_end_ = 0;
+                }
+            }
+        }
+        not_full_.notify_all();
+        not_empty_.notify_one();
+    }
+
+    /** @} */
+
+    void close() {
+        {
+            std::lock_guard<detail::Mutex> lock(mutex_);
+            if (closed_) return;
+            closed_ = true;
+        }
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+    bool is_closed() const {
+        std::lock_guard<detail::Mutex> lock(mutex_);
+        return closed_;
+    }
+
+    /// Number of committed records not yet released
+    size_t size() const {
+        std::lock_guard<detail::Mutex> lock(mutex_);
+        return records_;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    /// Bytes held by committed records, including their length prefixes
+    size_t bytes_used() const {
+        std::lock_guard<detail::Mutex> lock(mutex_);
+        return used_;
+    }
+
+    size_t capacity() const {
+        return capacity_;
+    }
+
+    /// Largest payload that fits, when the queue is empty
+    size_t max_record_size() const {
+        return std::min<size_t>(capacity_ - header_bytes, std::numeric_limits<uint32_t>::max());
+    }
+
+private:
+    using Deadline = detail::Deadline;
+
+    /**
+     * @brief Finds contiguous room for @p bytes, preferring the end of region A
+     *
+     * Once region B is in use, records go there until it reaches the start
+     * of region A. Otherwise a record goes after A if it fits before the end
+     * of the buffer, or starts B at offset 0 if it fits before A.
+     */
+    bool find_room(size_t bytes) {
+        if (wrapped_) {
+            if (a_start_ - b_end_ < bytes) return false;
+            reserved_at_ = b_end_;
+            return true;
+        }
+        if (capacity_ - a_end_ >= bytes) {
+            reserved_at_ = a_end_;
+            return true;
+        }
+        if (a_start_ >= bytes) {
+            wrapped_ = true;
+            b_start_ = b_end_ = 0;
+            reserved_at_ = 0;
+            return true;
+        }
+        return false;
+    }
+
+    /// After a reservation ends uncommitted: drops an empty region B, or resets an empty buffer
+    void close_empty_region() {
+        if (wrapped_ && b_end_ == b_start_) wrapped_ = false;
+        if (records_ == 0) a_start_ = a_end_ = b_start_ = b_end_ = 0;
+    }
+
+    /// Starts an ingest() stream at the first free byte, like find_room() for one byte
+    bool start_stream() {
+        if (writing_ || !find_room(1)) return false;
+        writing_ = streaming_ = true;
+        stream_bytes_ = 0;
+        return true;
+    }
+
+    /**
+     * @brief Makes room after the stream's partial record, moving it to the start if needed
+     * @return false if the consumer has to release records first
+     */
+    bool make_stream_room() {
+        const size_t limit = wrapped_ ? a_start_ : capacity_;
+        if (reserved_at_ + stream_bytes_ < limit) return true;
+        if (records_ == 0 || (!wrapped_ && stream_bytes_ < a_start_)) {
+            std::memmove(buffer_.get(), buffer_.get() + reserved_at_, stream_bytes_);
+            if (records_ == 0) {
+                a_start_ = a_end_ = b_start_ = b_end_ = 0;
+                wrapped_ = false;
+            } else {
+                wrapped_ = true;
+                b_start_ = b_end_ = 0;
+            }
+            reserved_at_ = 0;
+            return true;
+        }
+        return false;
+    }
+
+    void end_stream() {
+        writing_ = streaming_ = false;
+        stream_bytes_ = 0;
+        close_empty_region();
+    }
+
+    /**
+     * @brief Commits the complete records among @p held bytes at offset @p at
+     * @return Bytes committed; @p valid is cleared on a record too long to ever fit
+     */
+    size_t commit_stream(size_t at, size_t held, bool& valid) {
+        size_t framed = 0;
+        while (held - framed >= header_bytes) {
+            uint32_t length;
+            std::memcpy(&length, buffer_.get() + at + framed, sizeof(length));
+            if (length > max_record_size()) {
+                valid = false;
+                break;
+            }
+            if (held - framed - header_bytes < length) break;
+            framed += header_bytes + length;
+            used_ += header_bytes + length;
+            ++records_;
+        }
+        if (framed != 0) (wrapped_ ? b_end_ : a_end_) = at + framed;
+        return framed;
+    }
+
+    unsigned char* reserve_for(size_t max_length, std::optional<Deadline> deadline) {
+        if (max_length > max_record_size()) return nullptr;
+        const size_t bytes = header_bytes + max_length;
+        std::unique_lock<detail::Mutex> lock(mutex_);
+        if (!detail::wait_until_deadline(lock, not_full_, [&] {
+            return closed_ || (!writing_ && find_room(bytes));
+        }, deadline) || closed_) {
+            return nullptr;
+        }
+        writing_ = true;
+        reserved_ = max_length;
+        return buffer_.get() + reserved_at_ + header_bytes;
+    }
+
+    std::optional<ByteSpan> read_for(std::optional<Deadline> deadline) {
+        std::unique_lock<detail::Mutex> lock(mutex_);
+        if (!detail::wait_until_deadline(lock, not_empty_, [this] {
+            return (closed_ && records_ == 0) || (!reading_ && records_ != 0);
+        }, deadline) || records_ == 0) {
+            return std::nullopt;
+        }
+        reading_ = true;
+        uint32_t length;
+        std::memcpy(&length, buffer_.get() + a_start_, sizeof(length));
+        return ByteSpan{buffer_.get() + a_start_ + header_bytes, length};
+    }
+
+    const size_t capacity_;
+    const std::unique_ptr<unsigned char[]> buffer_;
+
+    mutable detail::Mutex mutex_;           ///< Guards everything below, not the buffer contents
+    detail::ConditionVariable not_empty_;
+    detail::ConditionVariable not_full_;
+    size_t a_start_ = 0;       ///< Region A, the oldest records: [a_start_, a_end_)
+    size_t a_end_ = 0;
+    size_t b_start_ = 0;       ///< Region B, newer records before region A: [b_start_, b_end_)
+    size_t b_end_ = 0;
+    bool wrapped_ = false;     ///< Region B is in use, so new records go there
+    size_t reserved_at_ = 0;   ///< Offset of the outstanding reservation's length prefix
+    size_t reserved_ = 0;      ///< Payload bytes reserved
+    size_t records_ = 0;
+    size_t used_ = 0;
+    bool writing_ = false;     ///< A reservation is outstanding
+    bool reading_ = false;     ///< A read is outstanding
+    bool streaming_ = false;   ///< The outstanding reservation belongs to ingest()
+    bool ingesting_ = false;   ///< An ingest() call is filling the buffer
+    size_t stream_bytes_ = 0;  ///< Bytes of ingest()'s partial record at reserved_at_
+    bool closed_ = false;
+};
+
+} // namespace async_deque
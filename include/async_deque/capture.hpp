@@ -0,0 +1,339 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "async_deque.hpp"
+#include "stats.hpp"
+
+/**
+ * @file capture.hpp
+ * @brief Recording of AsyncDeque traffic to a compact binary file
+ *
+ * @details CaptureDeque writes one fixed-size record per push, pop and
+ * close: a timestamp, the payload size, the recording thread and the
+ * operation. The async_deque_replay benchmark reads such a file and
+ * re-drives any queue backend with the recorded arrival pattern and
+ * consumer service times, so backends can be compared on production traffic.
+ *
+ * Records are appended to an in-memory chunk under the queue mutex (one
+ * clock read and a 16-byte store). Full chunks are handed to a writer
+ * thread, so no file I/O happens while the mutex is held.
+ *
+ * File layout, in host byte order:
+ * - CaptureHeader (32 bytes)
+ * - CaptureRecord (16 bytes) repeated until the end of the file. A partial
+ *   record at the end, left by a process that died while writing, is ignored.
+ *
+ * Example usage:
+ * @code{.cpp}
+ * CaptureDeque<std::string> queue("orders.adqcap", 1000);
+ * // ... producers and consumers ...
+ * queue.flush();
+ *
+ * Capture capture;
+ * if (read_capture("orders.adqcap", capture)) {
+ *     std::cout << capture.records.size() << " events\n";
+ * }
+ * @endcode
+ */
+
+namespace async_deque {
+
+/**
+ * @brief Operation of a captured event
+ */
+enum class CaptureKind : uint8_t {
+    push_back,
+    push_front,
+    pop_back,
+    pop_front,
+    close
+};
+
+/**
+ * @brief First bytes of a capture file
+ */
+struct CaptureHeader {
+    char magic[8];            ///< "ADQCAP" followed by two zero bytes
+    uint32_t version;         ///< Format version, currently 1
+    uint32_t record_size;     ///< sizeof(CaptureRecord)
+    uint64_t start_ns;        ///< steady_clock time that record timestamps are relative to
+    uint64_t capacity;        ///< Capacity of the captured queue
+};
+
+/**
+ * @brief One captured event
+ */
+struct CaptureRecord {
+    uint64_t time_ns;   ///< Nanoseconds since CaptureHeader::start_ns
+    uint32_t size;      ///< Payload size of the pushed or popped item, 0 for close
+    uint16_t thread;    ///< Index of the recording thread, in order of first event
+    CaptureKind kind;   ///< Operation
+    uint8_t reserved;   ///< Always 0
+};
+
+static_assert(sizeof(CaptureHeader) == 32, "capture header layout");
+static_assert(sizeof(CaptureRecord) == 16, "capture record layout");
+
+/**
+ * @brief Contents of a capture file
+ */
+struct Capture {
+    uint64_t start_ns = 0;
+    uint64_t capacity = 0;
+    std::vector<CaptureRecord> records;   ///< In queue order
+};
+
+namespace detail {
+
+constexpr char capture_magic[8] = {'A', 'D', 'Q', 'C', 'A', 'P', '\0', '\0'};
+constexpr uint32_t capture_version = 1;
+
+/// Small per-process index of the calling thread; wraps after 65536 threads
+inline uint16_t capture_thread_index() {
+    static std::atomic<uint16_t> next{0};
+    thread_local const uint16_t index = next.fetch_add(1, std::memory_order_relaxed);
+    return index;
+}
+
+template<typename T, typename = void>
+struct has_size : std::false_type {};
+
+template<typename T>
+struct has_size<T, std::void_t<typename T::value_type, decltype(std::declval<const T&>().size())>>
+    : std::true_type {};
+
+} // namespace detail
+
+/**
+ * @brief Default payload size of a captured item
+ *
+ * Returns item.size() times sizeof(T::value_type) for containers and strings,
+ * sizeof(T) for everything else. Specialize it, or pass another functor to
+ * CaptureDeque, when the interesting size lives elsewhere.
+ */
+template<typename T>
+struct CaptureSize {
+    uint32_t operator()(const T& item) const {
+        uint64_t bytes = sizeof(T);
+        if constexpr (detail::has_size<T>::value) {
+            bytes = static_cast<uint64_t>(item.size()) * sizeof(typename T::value_type);
+        }
+        return bytes > std::numeric_limits<uint32_t>::max()
+            ? std::numeric_limits<uint32_t>::max() : static_cast<uint32_t>(bytes);
+    }
+};
+
+/**
+ * @brief Reads a capture file
+ * @return false if the file cannot be read or is not a capture file
+ */
+inline bool read_capture(const std::string& path, Capture& capture) {
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) return false;
+    CaptureHeader header;
+    const bool valid = std::fread(&header, sizeof(header), 1, file) == 1 &&
+                       std::memcmp(header.magic, detail::capture_magic, sizeof(header.magic)) == 0 &&
+                       header.version == detail::capture_version &&
+                       header.record_size == sizeof(CaptureRecord);
+    if (valid) {
+        capture.start_ns = header.start_ns;
+        capture.capacity = header.capacity;
+        capture.records.clear();
+        std::vector<CaptureRecord> chunk(4096);
+        size_t read;
+        while ((read = std::fread(chunk.data(), sizeof(CaptureRecord), chunk.size(), file)) != 0) {
+            capture.records.insert(capture.records.end(), chunk.begin(), chunk.begin() + read);
+        }
+    }
+    const bool failed = std::ferror(file) != 0;
+    std::fclose(file);
+    return valid && !failed;
+}
+
+/**
+ * @brief AsyncDeque that records every push, pop and close to a capture file
+ *
+ * @tparam T The type of elements to store
+ * @tparam Size Functor returning the payload size of an item; see CaptureSize
+ *
+ * Records are taken in the hooks, which run under the queue mutex, so the
+ * file lists events in the order the queue applied them. Classes deriving
+ * from CaptureDeque that override a hook must call the CaptureDeque version.
+ */
+template<typename T, typename Size = CaptureSize<T>>
+class CaptureDeque : public AsyncDeque<T> {
+public:
+    /**
+     * @brief Creates the queue and starts capturing to @p path
+     *
+     * If the file cannot be created the queue still works and capturing()
+     * returns false.
+     *
+     * @param path File to create or truncate
+     * @param capacity Maximum number of items the queue can hold
+     * @param chunk_records Records buffered in memory before a chunk goes to
+     *        the writer thread
+     */
+    explicit CaptureDeque(const std::string& path,
+                          size_t capacity = std::numeric_limits<size_t>::max(),
+                          size_t chunk_records = 4096)
+        : AsyncDeque<T>(capacity), chunk_records_(chunk_records == 0 ? 1 : chunk_records),
+          start_ns_(detail::steady_now_ns()) {
+        file_ = std::fopen(path.c_str(), "wb");
+        if (!file_) return;
+        CaptureHeader header{};
+        std::memcpy(header.magic, detail::capture_magic, sizeof(header.magic));
+        header.version = detail::capture_version;
+        header.record_size = sizeof(CaptureRecord);
+        header.start_ns = start_ns_;
+        header.capacity = capacity;
+        if (std::fwrite(&header, sizeof(header), 1, file_) != 1) failed_ = true;
+        chunk_.reserve(chunk_records_);
+        writer_ = std::thread([this] { write_chunks(); });
+    }
+
+    CaptureDeque(const CaptureDeque&) = delete;
+    CaptureDeque& operator=(const CaptureDeque&) = delete;
+
+    /// Closes the queue, writes the remaining records and closes the file
+    ~CaptureDeque() override {
+        this->close();
+        if (!file_) return;
+        flush();
+        {
+            std::lock_guard<std::mutex> lock(writer_mutex_);
+            stopping_ = true;
+        }
+        chunks_ready_.notify_one();
+        writer_.join();
+        std::fclose(file_);
+    }
+
+    /// True while records are reaching the file (it opened and no write has failed)
+    bool capturing() const {
+        if (!file_) return false;
+        std::lock_guard<std::mutex> lock(writer_mutex_);
+        return !failed_;
+    }
+
+    /**
+     * @brief Writes every record taken so far to the file
+     * @return capturing()
+     */
+    bool flush() {
+        if (!file_) return false;
+        {
+            std::lock_guard<detail::Mutex> lock(this->mutex_);
+            hand_off();
+        }
+        std::unique_lock<std::mutex> lock(writer_mutex_);
+        chunks_written_.wait(lock, [this] { return pending_.empty() && !writing_; });
+        if (std::fflush(file_) != 0) failed_ = true;
+        return !failed_;
+    }
+
+    /// Number of events recorded, whether or not they have reached the file yet
+    uint64_t captured() const {
+        return captured_.load(std::memory_order_relaxed);
+    }
+
+protected:
+    void on_push_back(const T& item) override {
+        record(CaptureKind::push_back, size_(item));
+    }
+
+    void on_push_front(const T& item) override {
+        record(CaptureKind::push_front, size_(item));
+    }
+
+    void on_pop_back(const T& item) override {
+        record(CaptureKind::pop_back, size_(item));
+    }
+
+    void on_pop_front(const T& item) override {
+        record(CaptureKind::pop_front, size_(item));
+    }
+
+    void on_close() override {
+        record(CaptureKind::close, 0);
+    }
+
+private:
+    /// Appends one record to the current chunk; must be called with mutex_ held
+    void record(CaptureKind kind, uint32_t size) {
+        if (!file_) return;
+        const uint64_t now = detail::steady_now_ns();
+        chunk_.push_back(CaptureRecord{now - start_ns_, size, detail::capture_thread_index(),
+                                       kind, 0});
+        captured_.fetch_add(1, std::memory_order_relaxed);
+        if (chunk_.size() >= chunk_records_) hand_off();
+    }
+
+    /// Passes the current chunk to the writer thread; must be called with mutex_ held
+    void hand_off() {
+        if (chunk_.empty()) return;
+        std::vector<CaptureRecord> next;
+        {
+            std::lock_guard<std::mutex> lock(writer_mutex_);
+            pending_.push_back(std::move(chunk_));
+            if (!spare_.empty()) {
+                next = std::move(spare_.back());
+                spare_.pop_back();
+            }
+        }
+        chunks_ready_.notify_one();
+        next.clear();
+        next.reserve(chunk_records_);
+        chunk_ = std::move(next);
+    }
+
+    void write_chunks() {
+        std::unique_lock<std::mutex> lock(writer_mutex_);
+        for (;;) {
+            chunks_ready_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+            if (pending_.empty()) return;
+            std::vector<CaptureRecord> chunk = std::move(pending_.front());
+            pending_.pop_front();
+            writing_ = true;
+            lock.unlock();
+            const bool ok = std::fwrite(chunk.data(), sizeof(CaptureRecord), chunk.size(), file_) ==
+                            chunk.size();
+            lock.lock();
+            writing_ = false;
+            if (!ok) failed_ = true;
+            spare_.push_back(std::move(chunk));
+            if (pending_.empty()) chunks_written_.notify_all();
+        }
+    }
+
+    const size_t chunk_records_;
+    const uint64_t start_ns_;
+    Size size_;
+    std::FILE* file_ = nullptr;
+    std::vector<CaptureRecord> chunk_;   ///< Records not yet handed off, guarded by mutex_
+    std::atomic<uint64_t> captured_{0};
+
+    mutable std::mutex writer_mutex_;    ///< Guards everything below
+    std::condition_variable chunks_ready_;
+    std::condition_variable chunks_written_;
+    std::deque<std::vector<CaptureRecord>> pending_;   ///< Chunks waiting to be written
+    std::vector<std::vector<CaptureRecord>> spare_;    ///< Written chunks, reused to avoid allocation
+    bool writing_ = false;
+    bool failed_ = false;
+    bool stopping_ = false;
+    std::thread writer_;
+};
+
+} // namespace async_deque
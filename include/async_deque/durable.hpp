@@ -0,0 +1,627 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "serializer.hpp"
+#include "sync.hpp"
+
+/**
+ * @file durable.hpp
+ * @brief FIFO queue whose items survive process crashes, backed by an mmap'd log
+ *
+ * @details DurableDeque appends every pushed item to a log of memory-mapped
+ * segment files and keeps a checkpoint of the log head (the oldest item not
+ * yet popped). Reopening the directory after a crash recovers the unconsumed
+ * items by scanning the log forward from the checkpoint. Each record carries
+ * a CRC-32, so the scan stops at the first torn or partially written record.
+ *
+ * The sync policy decides when data reaches stable storage:
+ * - SyncPolicy::group_commit: push_back() returns once its record is durable.
+ *   Concurrent pushes share fdatasync calls. One pusher syncs everything
+ *   appended so far while the others wait for it, so the number of syncs
+ *   grows with time, not with the number of producers.
+ * - SyncPolicy::periodic: a background thread syncs every sync_interval. A
+ *   power failure loses at most that much, a process crash nothing.
+ * - SyncPolicy::none: data reaches the page cache only. It survives a
+ *   process crash, but not an operating system crash or power failure.
+ *
+ * Delivery is at least once. The head is checkpointed with every sync, and
+ * items popped after the last checkpoint are delivered again after a crash,
+ * except those in a segment that was read to its end: a consumed segment is
+ * deleted right away, without waiting for a checkpoint.
+ *
+ * Layout of the directory:
+ * - `<base>.log`: segment files named by the 20-digit log offset of their
+ *   first byte. A record is a 4-byte length, a 4-byte CRC-32 of the length
+ *   and payload, then the payload. A zero length ends the segment.
+ * - `checkpoint`: two 32-byte slots written alternately, so a torn write
+ *   leaves the previous checkpoint intact.
+ *
+ * Example usage:
+ * @code{.cpp}
+ * DurableOptions options;
+ * options.directory = "/var/lib/app/orders";
+ * auto orders = DurableDeque<Order>::open(options, 100000);
+ * if (!orders) return error("cannot open order log");
+ * orders->push_back(order);                  // durable when this returns
+ * while (auto next = orders->pop_front()) {
+ *     process(*next);
+ * }
+ * @endcode
+ */
+
+namespace async_deque {
+
+/**
+ * @brief When a DurableDeque forces its log to stable storage
+ */
+enum class SyncPolicy {
+    none,           ///< Never; data is in the page cache only
+    group_commit,   ///< Before push_back() returns, batching concurrent pushes into one fdatasync
+    periodic        ///< Every DurableOptions::sync_interval, from a background thread
+};
+
+/**
+ * @brief Where a DurableDeque keeps its log and how it syncs it
+ */
+struct DurableOptions {
+    std::string directory;                            ///< Existing directory owned by one queue
+    size_t segment_bytes = size_t{64} << 20;          ///< Size of each segment file (larger if one item needs it)
+    SyncPolicy sync = SyncPolicy::group_commit;
+    std::chrono::milliseconds sync_interval{10};      ///< For SyncPolicy::periodic
+};
+
+/**
+ * @brief Counters of a DurableDeque
+ */
+struct DurableStats {
+    uint64_t recovered = 0;     ///< Unconsumed items found in the log when it was opened
+    uint64_t pushes = 0;
+    uint64_t pops = 0;
+    uint64_t syncs = 0;         ///< Sync rounds; pushes / syncs is the group commit batch size
+    uint64_t sync_errors = 0;   ///< Sync rounds in which fdatasync or the checkpoint write failed
+    uint64_t write_errors = 0;  ///< Pushes rejected because a segment file could not be created
+    uint64_t segments = 0;      ///< Segment files currently in the log
+};
+
+namespace detail {
+
+/// CRC-32 (IEEE 802.3, reflected), continuing from @p crc
+inline uint32_t crc32(const unsigned char* data, size_t size, uint32_t crc = 0) {
+    static const std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int bit = 0; bit < 8; ++bit) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+} // namespace detail
+
+/**
+ * @brief Bounded FIFO queue persisted in an append-only log
+ *
+ * @tparam T The type of elements to store
+ * @tparam Serializer Converts T to and from bytes; see TrivialSerializer
+ *
+ * Open one with DurableDeque::open(); a directory must not be opened by two
+ * queues at the same time. The capacity bounds the number of unconsumed
+ * items. A log recovered with more items than that is kept whole, and
+ * pushes block until it drains below the capacity.
+ *
+ * @note All methods are thread-safe
+ */
+template<typename T, typename Serializer = TrivialSerializer<T>>
+class DurableDeque {
+public:
+    /**
+     * @brief Opens or creates the log in options.directory and recovers it
+     * @return nullptr if the directory or its files cannot be opened
+     */
+    static std::unique_ptr<DurableDeque> open(const DurableOptions& options,
+                                              size_t capacity = std::numeric_limits<size_t>::max(),
+                                              Serializer serializer = Serializer()) {
+        std::unique_ptr<DurableDeque> deque(new DurableDeque(options, capacity, std::move(serializer)));
+        if (!deque->recover()) return nullptr;
+        if (options.sync == SyncPolicy::periodic) {
+            deque->syncer_ = std::thread([raw = deque.get()] { raw->sync_periodically(); });
+        }
+        return deque;
+    }
+
+    DurableDeque(const DurableDeque&) = delete;
+    DurableDeque& operator=(const DurableDeque&) = delete;
+
+    /**
+     * @brief Closes the queue, syncs the log and the checkpoint, and unmaps the segments
+     *
+     * A queue whose recovery failed writes nothing: its head was never
+     * established, and a checkpoint of it would hide the valid one.
+     */
+    ~DurableDeque() {
+        close();
+        if (syncer_.joinable()) {
+            {
+                std::lock_guard<detail::Mutex> lock(mutex_);
+                stopping_ = true;
+            }
+            stop_.notify_all();
+            syncer_.join();
+        }
+        if (recovered_) sync();
+        for (const Segment& segment : segments_) unmap(segment);
+        if (checkpoint_fd_ >= 0) ::close(checkpoint_fd_);
+        if (directory_fd_ >= 0) ::close(directory_fd_);
+    }
+
+    /**
+     * @brief Appends an item to the log
+     * @return false if the queue is closed or a new segment file could not be created
+     * @note Blocks while the queue is at capacity and, with
+     *       SyncPolicy::group_commit, until the record is durable. A failed
+     *       sync is counted in stats().sync_errors; the item stays queued.
+     */
+    bool push_back(const T& item) {
+        return push(item);
+    }
+
+    template<typename Rep, typename Period>
+    bool try_push_back(const T& item, const std::chrono::duration<Rep, Period>& timeout) {
+        return push(item, detail::deadline_after(timeout));
+    }
+
+    /// Pops the oldest item; std::nullopt once the queue is closed and empty
+    std::optional<T> pop_front() {
+        return pop();
+    }
+
+    template<typename Rep, typename Period>
+    std::optional<T> try_pop_front(const std::chrono::duration<Rep, Period>& timeout) {
+        return pop(detail::deadline_after(timeout));
+    }
+
+    /**
+     * @brief Makes every push and pop so far durable, whatever the sync policy
+     * @return false if fdatasync or the checkpoint write failed
+     */
+    bool sync() {
+        std::unique_lock<detail::Mutex> lock(mutex_);
+        while (syncing_) synced_.wait(lock);
+        return sync_round(lock);
+    }
+
+    void close() {
+        {
+            std::lock_guard<detail::Mutex> lock(mutex_);
+            if (closed_) return;
+            closed_ = true;
+        }
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+    bool is_closed() const {
+        std::lock_guard<detail::Mutex> lock(mutex_);
+        return closed_;
+    }
+
+    size_t size() const {
+        std::lock_guard<detail::Mutex> lock(mutex_);
+        return static_cast<size_t>(count_);
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    size_t capacity() const {
+        return capacity_;
+    }
+
+    DurableStats stats() const {
+        std::lock_guard<detail::Mutex> lock(mutex_);
+        DurableStats stats = stats_;
+        stats.segments = segments_.size();
+        return stats;
+    }
+
+private:
+    /// A mapped segment; [0, end) holds records, the rest is zero
+    struct Segment {
+        uint64_t base;   ///< Log offset of the first byte
+        int fd;
+        unsigned char* data;
+        size_t size;
+        size_t end;
+    };
+
+    /// One slot of the checkpoint file
+    struct Checkpoint {
+        uint64_t magic;
+        uint64_t sequence;
+        uint64_t head;
+        uint32_t crc;
+        uint32_t reserved;
+    };
+    static_assert(sizeof(Checkpoint) == 32, "checkpoint slot layout");
+
+    static constexpr uint64_t checkpoint_magic = 0x41445143504b5431;   // "ADQCPKT1"
+    static constexpr size_t record_header = 2 * sizeof(uint32_t);
+
+    using Deadline = detail::Deadline;
+
+    DurableDeque(const DurableOptions& options, size_t capacity, Serializer serializer)
+        : options_(options), capacity_(capacity == 0 ? 1 : capacity),
+          serializer_(std::move(serializer)) {}
+
+    bool push(const T& item, std::optional<Deadline> deadline = std::nullopt) {
+        std::unique_lock<detail::Mutex> lock(mutex_);
+        if (!detail::wait_until_deadline(lock, not_full_, [this] {
+                return closed_ || count_ < capacity_;
+            }, deadline) || closed_) {
+            return false;
+        }
+        if (!append(item)) {
+            ++stats_.write_errors;
+            return false;
+        }
+        ++count_;
+        ++stats_.pushes;
+        not_empty_.notify_one();
+        if (options_.sync == SyncPolicy::group_commit) {
+            const uint64_t written = tail_;
+            while (synced_to_ < written) {
+                if (syncing_) {
+                    synced_.wait(lock);
+                } else if (!sync_round(lock)) {
+                    break;
+                }
+            }
+        }
+        return true;
+    }
+
+    std::optional<T> pop(std::optional<Deadline> deadline = std::nullopt) {
+        std::optional<T> item;
+        std::unique_lock<detail::Mutex> lock(mutex_);
+        if (!detail::wait_until_deadline(lock, not_empty_, [this] {
+                return closed_ || count_ != 0;
+            }, deadline) || count_ == 0) {
+            return item;
+        }
+        drop_consumed_segments();
+        const Segment& segment = segments_.front();
+        const unsigned char* record = segment.data + (head_ - segment.base);
+        uint32_t length;
+        std::memcpy(&length, record, sizeof(length));
+        item.emplace(serializer_.read(record + record_header, length));
+        head_ += record_header + length;
+        --count_;
+        ++stats_.pops;
+        drop_consumed_segments();
+        lock.unlock();
+        not_full_.notify_one();
+        return item;
+    }
+
+    /// Writes one record at the tail, starting a new segment if it does not fit
+    bool append(const T& item) {
+        const size_t bytes = serializer_.size(item);
+        if (bytes > std::numeric_limits<uint32_t>::max() - record_header) return false;
+        const size_t record = record_header + bytes;
+        if (segments_.empty() ||
+            tail_ + record > segments_.back().base + segments_.back().size) {
+            const uint64_t base = segments_.empty() ? tail_
+                                                    : segments_.back().base + segments_.back().size;
+            if (!create_segment(base, std::max(record, options_.segment_bytes))) return false;
+            tail_ = base;
+        }
+        Segment& segment = segments_.back();
+        unsigned char* out = segment.data + (tail_ - segment.base);
+        const uint32_t length = static_cast<uint32_t>(bytes);
+        std::memcpy(out, &length, sizeof(length));
+        serializer_.write(item, out + record_header);
+        uint32_t crc = detail::crc32(out, sizeof(length));
+        crc = detail::crc32(out + record_header, bytes, crc);
+        std::memcpy(out + sizeof(length), &crc, sizeof(crc));
+        tail_ += record;
+        segment.end = tail_ - segment.base;
+        return true;
+    }
+
+    /**
+     * @brief Syncs every segment written since the last round, then the checkpoint
+     *
+     * Called with the mutex held and no other round running. The mutex is
+     * released during the system calls, so pushes keep appending and join
+     * the next round.
+     */
+    bool sync_round(std::unique_lock<detail::Mutex>& lock) {
+        syncing_ = true;
+        const uint64_t target = tail_;
+        const uint64_t head = head_;
+        bool ok = true;
+        // A consumer may remove these segments meanwhile; they stay mapped in retired_
+        std::vector<Segment> dirty;
+        for (const Segment& segment : segments_) {
+            if (segment.base + segment.end <= synced_to_ || segment.base >= target) continue;
+            dirty.push_back(segment);
+        }
+        lock.unlock();
+        for (const Segment& segment : dirty) ok = flush(segment) && ok;
+        ok = ok && write_checkpoint(head);
+        lock.lock();
+        syncing_ = false;
+        for (const Segment& segment : retired_) unmap(segment);
+        retired_.clear();
+        ++stats_.syncs;
+        if (ok) {
+            synced_to_ = std::max(synced_to_, target);
+            checkpointed_head_ = head;
+        } else {
+            ++stats_.sync_errors;
+        }
+        synced_.notify_all();
+        return ok;
+    }
+
+    /// Forces the stores made through a segment's mapping to stable storage
+    static bool flush(const Segment& segment) {
+#if defined(__linux__)
+        // The page cache backs both the mapping and the file, so fdatasync covers the stores
+        return ::fdatasync(segment.fd) == 0;
+#else
+        // POSIX does not promise that fdatasync writes back MAP_SHARED pages
+        return ::msync(segment.data, segment.size, MS_SYNC) == 0;
+#endif
+    }
+
+    /// Only the thread running a sync round writes the checkpoint
+    bool write_checkpoint(uint64_t head) {
+        Checkpoint slot{checkpoint_magic, ++checkpoint_sequence_, head, 0, 0};
+        slot.crc = detail::crc32(reinterpret_cast<const unsigned char*>(&slot),
+                                 offsetof(Checkpoint, crc));
+        const off_t offset = static_cast<off_t>((checkpoint_sequence_ % 2) * sizeof(Checkpoint));
+        return ::pwrite(checkpoint_fd_, &slot, sizeof(slot), offset) == sizeof(slot) &&
+               ::fdatasync(checkpoint_fd_) == 0;
+    }
+
+    void sync_periodically() {
+        std::unique_lock<detail::Mutex> lock(mutex_);
+        while (!stopping_) {
+            stop_.wait_until(lock, std::chrono::steady_clock::now() + options_.sync_interval);
+            if (stopping_) break;
+            if (!syncing_ && (synced_to_ < tail_ || checkpointed_head_ != head_)) {
+                sync_round(lock);
+            }
+        }
+    }
+
+    std::string segment_path(uint64_t base) const {
+        std::string name = std::to_string(base);
+        name.insert(0, 20 - name.size(), '0');
+        return options_.directory + "/" + name + ".log";
+    }
+
+    bool map_segment(uint64_t base, int fd, size_t size) {
+        void* data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            ::close(fd);
+            return false;
+        }
+        segments_.push_back(Segment{base, fd, static_cast<unsigned char*>(data), size, 0});
+        return true;
+    }
+
+    bool create_segment(uint64_t base, size_t size) {
+        const std::string path = segment_path(base);
+        const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0) return false;
+        // Allocating up front keeps fdatasync from having to write metadata
+        // and turns a full disk into an error here rather than SIGBUS later.
+#if defined(__linux__)
+        const bool allocated = ::posix_fallocate(fd, 0, static_cast<off_t>(size)) == 0;
+#else
+        const bool allocated = ::ftruncate(fd, static_cast<off_t>(size)) == 0;
+#endif
+        if (!allocated || !map_segment(base, fd, size)) {
+            if (!allocated) ::close(fd);   // map_segment() closes it on failure
+            ::unlink(path.c_str());
+            return false;
+        }
+        // Make the new file's directory entry durable along with its data
+        if (options_.sync != SyncPolicy::none) ::fsync(directory_fd_);
+        return true;
+    }
+
+    static void unmap(const Segment& segment) {
+        ::munmap(segment.data, segment.size);
+        ::close(segment.fd);
+    }
+
+    /**
+     * @brief Deletes read segments and moves the head into the next one
+     *
+     * The last segment stays until a later one is created. The checkpoint
+     * may lag behind; recovery then starts from the oldest segment left.
+     */
+    void drop_consumed_segments() {
+        while (segments_.size() > 1 && head_ == segments_.front().base + segments_.front().end) {
+            remove_front_segment();
+            head_ = segments_.front().base;
+        }
+    }
+
+    void remove_front_segment() {
+        const Segment segment = segments_.front();
+        ::unlink(segment_path(segment.base).c_str());
+        segments_.pop_front();
+        if (syncing_) {
+            retired_.push_back(segment);
+        } else {
+            unmap(segment);
+        }
+    }
+
+    /// Reads the checkpoint, maps the segments and scans forward from the head
+    bool recover() {
+        directory_fd_ = ::open(options_.directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (directory_fd_ < 0) return false;
+        checkpoint_fd_ = ::openat(directory_fd_, "checkpoint", O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (checkpoint_fd_ < 0) return false;
+
+        uint64_t head = 0;
+        for (size_t i = 0; i < 2; ++i) {
+            Checkpoint slot{};
+            if (::pread(checkpoint_fd_, &slot, sizeof(slot), static_cast<off_t>(i * sizeof(slot))) ==
+                    sizeof(slot) &&
+                slot.magic == checkpoint_magic &&
+                slot.crc == detail::crc32(reinterpret_cast<const unsigned char*>(&slot),
+                                          offsetof(Checkpoint, crc)) &&
+                slot.sequence > checkpoint_sequence_) {
+                checkpoint_sequence_ = slot.sequence;
+                head = slot.head;
+            }
+        }
+
+        std::vector<uint64_t> bases;
+        DIR* dir = ::opendir(options_.directory.c_str());
+        if (!dir) return false;
+        while (const dirent* entry = ::readdir(dir)) {
+            const std::string name = entry->d_name;
+            if (name.size() != 24 || name.compare(20, 4, ".log") != 0 ||
+                name.find_first_not_of("0123456789") != 20) {
+                continue;
+            }
+            bases.push_back(std::strtoull(name.c_str(), nullptr, 10));
+        }
+        ::closedir(dir);
+        std::sort(bases.begin(), bases.end());
+
+        for (uint64_t base : bases) {
+            const std::string path = segment_path(base);
+            const int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+            struct stat info;
+            if (fd < 0 || ::fstat(fd, &info) != 0) {
+                if (fd >= 0) ::close(fd);
+                return false;
+            }
+            const size_t size = static_cast<size_t>(info.st_size);
+            if (size == 0 || base + size <= head) {   // empty, or consumed before the crash
+                ::close(fd);
+                ::unlink(path.c_str());
+                continue;
+            }
+            if (!map_segment(base, fd, size)) return false;
+        }
+
+        head_ = segments_.empty() ? head : std::max(head, segments_.front().base);
+        tail_ = head_;
+        size_t index = 0;
+        bool torn = false;
+        while (index < segments_.size() && tail_ >= segments_[index].base + segments_[index].size) {
+            ++index;
+        }
+        for (; index < segments_.size(); ++index) {
+            Segment& segment = segments_[index];
+            size_t offset = tail_ > segment.base ? tail_ - segment.base : 0;
+            while (offset + record_header <= segment.size) {
+                uint32_t length;
+                uint32_t crc;
+                std::memcpy(&length, segment.data + offset, sizeof(length));
+                std::memcpy(&crc, segment.data + offset + sizeof(length), sizeof(crc));
+                if (length == 0) break;
+                if (length > segment.size - offset - record_header ||
+                    crc != detail::crc32(segment.data + offset + record_header, length,
+                                         detail::crc32(segment.data + offset, sizeof(length)))) {
+                    torn = true;
+                    break;
+                }
+                offset += record_header + length;
+                ++count_;
+            }
+            segment.end = offset;
+            tail_ = segment.base + offset;
+            const bool next_follows = index + 1 < segments_.size() &&
+                                      segments_[index + 1].base == segment.base + segment.size;
+            if (torn || !next_follows) break;
+            tail_ = segments_[index + 1].base;
+        }
+        // Anything after a torn record or a gap cannot be reached
+        while (index + 1 < segments_.size()) {
+            const Segment segment = segments_.back();
+            unmap(segment);
+            ::unlink(segment_path(segment.base).c_str());
+            segments_.pop_back();
+        }
+        // Drop segments before the head's segment; they hold only consumed records
+        while (segments_.size() > 1 && head_ >= segments_.front().base + segments_.front().end) {
+            remove_front_segment();
+            head_ = std::max(head_, segments_.front().base);
+        }
+        // Clear a torn tail so that records appended after it are not followed by stale bytes
+        if (torn) {
+            Segment& last = segments_.back();
+            std::memset(last.data + last.end, 0, last.size - last.end);
+        }
+        synced_to_ = tail_;
+        checkpointed_head_ = head;
+        stats_.recovered = count_;
+        recovered_ = true;
+        return true;
+    }
+
+    const DurableOptions options_;
+    const size_t capacity_;
+    Serializer serializer_;
+    int directory_fd_ = -1;
+    int checkpoint_fd_ = -1;
+    uint64_t checkpoint_sequence_ = 0;   ///< Written only by the thread running a sync round
+    bool recovered_ = false;             ///< recover() succeeded; the log may be synced
+
+    mutable detail::Mutex mutex_;        ///< Guards everything below
+    detail::ConditionVariable not_empty_;
+    detail::ConditionVariable not_full_;
+    detail::ConditionVariable synced_;   ///< A sync round finished
+    detail::ConditionVariable stop_;     ///< Wakes the periodic syncer for shutdown
+    std::deque<Segment> segments_;       ///< Oldest first; the last one is being appended to
+    std::vector<Segment> retired_;       ///< Removed during a sync round, unmapped when it ends
+    uint64_t head_ = 0;                  ///< Log offset of the oldest unconsumed record
+    uint64_t tail_ = 0;                  ///< Log offset where the next record goes
+    uint64_t count_ = 0;                 ///< Unconsumed records
+    uint64_t synced_to_ = 0;             ///< Records below this offset are durable
+    uint64_t checkpointed_head_ = 0;     ///< Head stored by the last successful sync round
+    bool syncing_ = false;
+    bool closed_ = false;
+    bool stopping_ = false;
+    DurableStats stats_;
+    std::thread syncer_;
+};
+
+} // namespace async_deque
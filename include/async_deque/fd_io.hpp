@@ -0,0 +1,308 @@
+#pragma once
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "async_deque.hpp"
+#include "byte_queue.hpp"
+
+/**
+ * @file fd_io.hpp
+ * @brief Moving queued bytes to and from file descriptors with vectored I/O
+ *
+ * @details WritevDeque is an AsyncDeque of byte buffers whose
+ * drain_to_fd() takes up to IOV_MAX queued buffers in one critical section
+ * and writes them with a single writev() call. A writer thread that called
+ * write() once per popped buffer makes one system call per message; draining
+ * makes one per batch.
+ *
+ * On the input side, read_records_from_fd() reads a stream of
+ * length-prefixed records with readv() straight into the free space of a
+ * ByteQueue, and commits them where they landed.
+ *
+ * Example usage:
+ * @code{.cpp}
+ * WritevDeque<std::string> outgoing(10000);
+ *
+ * // Writer thread
+ * while (outgoing.drain_to_fd(socket_fd) > 0) {
+ * }
+ *
+ * ByteQueue incoming(1 << 20);
+ *
+ * // Reader thread
+ * while (read_records_from_fd(incoming, pipe_fd) > 0) {
+ * }
+ * incoming.close();
+ * @endcode
+ */
+
+namespace async_deque {
+
+/**
+ * @brief Counters of a WritevDeque's drain_to_fd() calls
+ */
+struct DrainStats {
+    uint64_t writev_calls = 0;
+    uint64_t buffers_written = 0;   ///< Buffers written in full
+    uint64_t bytes_written = 0;
+    uint64_t partial_writes = 0;    ///< Calls that left part of a buffer to requeue
+    uint64_t requeued = 0;          ///< Buffers put back at the front, whole or in part
+};
+
+namespace detail {
+
+#ifdef IOV_MAX
+constexpr size_t iov_max = IOV_MAX;
+#else
+constexpr size_t iov_max = 1024;
+#endif
+
+// Byte buffer access for WritevDeque: containers of 1-byte elements with
+// data(), size() and erase(), such as std::string and std::vector<uint8_t>,
+// and ByteSpan.
+
+template<typename Buffer>
+const void* buffer_data(const Buffer& buffer) {
+    static_assert(sizeof(*buffer.data()) == 1, "WritevDeque needs buffers of bytes");
+    return buffer.data();
+}
+
+template<typename Buffer>
+size_t buffer_size(const Buffer& buffer) {
+    return buffer.size();
+}
+
+template<typename Buffer>
+void buffer_consume(Buffer& buffer, size_t bytes) {
+    buffer.erase(buffer.begin(), buffer.begin() + static_cast<std::ptrdiff_t>(bytes));
+}
+
+inline const void* buffer_data(const ByteSpan& span) {
+    return span.data;
+}
+
+inline size_t buffer_size(const ByteSpan& span) {
+    return span.size;
+}
+
+inline void buffer_consume(ByteSpan& span, size_t bytes) {
+    span.data += bytes;
+    span.size -= bytes;
+}
+
+} // namespace detail
+
+/**
+ * @brief AsyncDeque of byte buffers that can be drained to a file descriptor
+ *
+ * @tparam Buffer std::string, std::vector<uint8_t> or a similar container
+ *         of bytes, or ByteSpan (the memory it points to must outlive the
+ *         queued span)
+ *
+ * Buffers taken by drain_to_fd() still count toward the capacity while the
+ * write is in progress, so the buffers it puts back always fit.
+ *
+ * @note All methods are thread-safe
+ */
+template<typename Buffer>
+class WritevDeque : public AsyncDeque<Buffer> {
+public:
+    using AsyncDeque<Buffer>::AsyncDeque;
+
+    /**
+     * @brief Writes queued buffers, front first, with one writev() call
+     *
+     * Waits until a buffer is queued, then takes up to IOV_MAX buffers, up
+     * to @p max_bytes in total, under one acquisition of the mutex. Buffers
+     * written in full are popped and on_pop_front() runs for them. If the
+     * write was short, what was not written goes back to the front of the
+     * queue, in order: the tail of a partly written buffer and the buffers
+     * after it. Another consumer popping meanwhile may see later buffers
+     * first. Until they are back, consumers of a closed queue keep waiting
+     * rather than report it drained.
+     *
+     * @param fd File descriptor to write to; may be non-blocking
+     * @param max_bytes Upper bound on the bytes written by this call
+     * @return Bytes written; 0 if the queue is closed and empty or
+     *         @p max_bytes is 0; -1 with errno set if writev() failed, in
+     *         which case every buffer is requeued
+     */
+    ssize_t drain_to_fd(int fd, size_t max_bytes = std::numeric_limits<size_t>::max()) {
+        return drain<CallSite::drain_to_fd>(fd, max_bytes);
+    }
+
+    /**
+     * @brief As drain_to_fd(), waiting at most @p timeout for a buffer
+     * @return 0 if the timeout expired with the queue empty
+     */
+    template<typename Rep, typename Period>
+    ssize_t try_drain_to_fd(int fd, const std::chrono::duration<Rep, Period>& timeout,
+                            size_t max_bytes = std::numeric_limits<size_t>::max()) {
+        return drain<CallSite::try_drain_to_fd>(fd, max_bytes, timeout);
+    }
+
+    /// Does not acquire the queue mutex, like stats()
+    DrainStats drain_stats() const {
+        DrainStats stats;
+        stats.writev_calls = drain_counters_.writev_calls.load();
+        stats.buffers_written = drain_counters_.buffers_written.load();
+        stats.bytes_written = drain_counters_.bytes_written.load();
+        stats.partial_writes = drain_counters_.partial_writes.load();
+        stats.requeued = drain_counters_.requeued.load();
+        return stats;
+    }
+
+private:
+    using Base = AsyncDeque<Buffer>;
+    using Side = typename Base::Side;
+    using Lock = typename Base::Lock;
+
+    /// Live counters behind DrainStats, written with the queue mutex held
+    struct DrainCounters {
+        detail::LockedCounter writev_calls;
+        detail::LockedCounter buffers_written;
+        detail::LockedCounter bytes_written;
+        detail::LockedCounter partial_writes;
+        detail::LockedCounter requeued;
+    };
+
+    template<CallSite site, typename... Timeout>
+    ssize_t drain(int fd, size_t max_bytes, const Timeout&... timeout) {
+        if (max_bytes == 0) return 0;
+        std::vector<Buffer> batch;
+        std::vector<iovec> iov;
+        {
+            Lock lock(*this, site);
+            uint64_t blocked_ns = 0;
+            if (!this->wait(lock, Side::consumer, blocked_ns, [this] {
+                return !this->deque_.empty() || (this->closed_ && this->checked_out_ == 0);
+            }, timeout...)) {
+                this->metrics_.pop_timeouts.add();
+                ASYNC_DEQUE_PROBE4(timeout, this, this->deque_.size(), blocked_ns, static_cast<int>(site));
+                return 0;
+            }
+            if (this->deque_.empty()) return 0;
+
+            const size_t count = std::min(this->deque_.size(), detail::iov_max);
+            batch.reserve(count);
+            iov.reserve(count);
+            size_t bytes = 0;
+            while (batch.size() < count && bytes < max_bytes) {
+                batch.push_back(std::move(this->deque_.front()));
+                this->deque_.pop_front();
+                const size_t size = detail::buffer_size(batch.back());
+                const size_t len = std::min(size, max_bytes - bytes);
+                iov.push_back(iovec{const_cast<void*>(detail::buffer_data(batch.back())), len});
+                bytes += len;
+            }
+            this->checked_out_ += batch.size();
+            this->metrics_.set_depth(this->deque_.size());
+        }
+
+        ssize_t result;
+        do {
+            result = ::writev(fd, iov.data(), static_cast<int>(iov.size()));
+        } while (result < 0 && errno == EINTR);
+        const int saved_errno = errno;
+
+        size_t written = 0;   // buffers written in full
+        const bool deferred = this->hook_mode() == HookMode::deferred;
+        bool drained_closed = false;   // the last checked-out buffer of a closed, empty queue is gone
+        {
+            Lock lock(*this, site);
+            drain_counters_.writev_calls.add();
+            if (result >= 0) {
+                size_t left = static_cast<size_t>(result);
+                while (written < batch.size() && left >= detail::buffer_size(batch[written])) {
+                    left -= detail::buffer_size(batch[written]);
+                    ++written;
+                }
+                if (written < batch.size() && left != 0) {
+                    detail::buffer_consume(batch[written], left);
+                    drain_counters_.partial_writes.add();
+                }
+                drain_counters_.bytes_written.add(static_cast<uint64_t>(result));
+                drain_counters_.buffers_written.add(written);
+            }
+            for (size_t i = batch.size(); i > written; --i) {
+                this->deque_.push_front(std::move(batch[i - 1]));
+            }
+            drain_counters_.requeued.add(batch.size() - written);
+            this->checked_out_ -= batch.size();
+            if (!deferred) {
+                for (size_t i = 0; i < written; ++i) this->on_pop_front(batch[i]);
+            }
+            this->metrics_.pops.add(written);
+            this->metrics_.set_depth(this->deque_.size());
+            for (size_t i = 0; i < written; ++i) {
+                this->trace(TraceEventKind::pop);
+                ASYNC_DEQUE_PROBE4(pop, this, this->deque_.size(), 0, static_cast<int>(site));
+            }
+            drained_closed = this->closed_ && this->checked_out_ == 0 && this->deque_.empty();
+            if (written != 0) this->record_notify(Side::producer);
+            if (written != batch.size() || drained_closed) this->record_notify(Side::consumer);
+        }
+        if (written != 0) this->not_full_.notify_all();
+        if (drained_closed) {
+            this->not_empty_.notify_all();
+        } else if (written != batch.size()) {
+            this->not_empty_.notify_one();
+        }
+        if (deferred) {
+            for (size_t i = 0; i < written; ++i) this->on_pop_front(batch[i]);
+        }
+        errno = saved_errno;
+        return result;
+    }
+
+    DrainCounters drain_counters_;
+};
+
+/**
+ * @brief Reads length-prefixed records from @p fd into @p queue with one readv()
+ *
+ * The stream must use ByteQueue's record layout: a 4-byte length in host
+ * byte order, then the payload. The bytes are read straight into the
+ * queue's free space, at most two ranges of it, and every complete record
+ * is committed in place. A record cut off by the end of a read is completed
+ * by the next call. See ByteQueue::ingest().
+ *
+ * @param max_bytes Upper bound on the bytes read by this call
+ * @return Bytes read; 0 at end of file (a trailing partial record is
+ *         discarded) or if the queue is closed; -1 with errno set if readv()
+ *         failed (a partial record read earlier stays pending for the
+ *         next call), or with errno EBADMSG if a record is longer than
+ *         queue.max_record_size()
+ * @note Blocks while the queue has no free space. One reader per queue.
+ */
+inline ssize_t read_records_from_fd(ByteQueue& queue, int fd,
+                                    size_t max_bytes = std::numeric_limits<size_t>::max()) {
+    bool read_failed = false;
+    const std::ptrdiff_t result = queue.ingest([&](const ByteRange* ranges, size_t count) {
+        iovec iov[2];
+        for (size_t i = 0; i < count; ++i) iov[i] = iovec{ranges[i].data, ranges[i].size};
+        ssize_t n;
+        do {
+            n = ::readv(fd, iov, static_cast<int>(count));
+        } while (n < 0 && errno == EINTR);
+        read_failed = n < 0;
+        return static_cast<std::ptrdiff_t>(n);
+    }, max_bytes);
+    if (result < 0 && !read_failed) errno = EBADMSG;
+    return static_cast<ssize_t>(result);
+}
+
+} // namespace async_deque
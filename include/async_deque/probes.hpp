@@ -0,0 +1,54 @@
+#pragma once
+
+/**
+ * @file probes.hpp
+ * @brief Optional USDT (user statically-defined tracing) probes for AsyncDeque
+ *
+ * @details When ASYNC_DEQUE_USDT is defined (CMake option of the same name),
+ * AsyncDeque places <sys/sdt.h> probes on its push, pop, wait and close
+ * paths. An unattached probe is a single nop instruction plus a note in the
+ * ELF file. bpftrace, perf and SystemTap can attach to it in a running
+ * binary, and no rebuild is needed. Without ASYNC_DEQUE_USDT the probes
+ * compile to nothing.
+ *
+ * All probes are in the provider "async_deque":
+ *
+ * | Probe        | arg0  | arg1  | arg2                 | arg3                        |
+ * |--------------|-------|-------|----------------------|-----------------------------|
+ * | push         | queue | size  | ns blocked this call | CallSite                    |
+ * | pop          | queue | size  | ns blocked this call | CallSite                    |
+ * | timeout      | queue | size  | ns blocked this call | CallSite                    |
+ * | wait_begin   | queue | size  | 1 producer, 0 consumer |                           |
+ * | wait_end     | queue | size  | ns blocked           | 1 producer, 0 consumer      |
+ * | close        | queue | size  |                      |                             |
+ *
+ * "size" is the queue size after the operation. CallSite values follow the
+ * order of the async_deque::CallSite enumeration (push_back = 0, ...).
+ *
+ * Example (p99 blocked time of pop_front, per queue):
+ * @code{.sh}
+ * bpftrace -e 'usdt:./app:async_deque:pop /arg3 == 4/ { @[arg0] = hist(arg2); }'
+ * @endcode
+ */
+
+#if defined(ASYNC_DEQUE_USDT)
+#  if defined(__has_include)
+#    if __has_include(<sys/sdt.h>)
+#      include <sys/sdt.h>
+#      define ASYNC_DEQUE_HAS_USDT 1
+#    endif
+#  endif
+#  ifndef ASYNC_DEQUE_HAS_USDT
+#    error "ASYNC_DEQUE_USDT requires <sys/sdt.h> (systemtap-sdt-dev / systemtap-sdt-devel)"
+#  endif
+#endif
+
+#ifdef ASYNC_DEQUE_HAS_USDT
+#  define ASYNC_DEQUE_PROBE2(name, a1, a2) DTRACE_PROBE2(async_deque, name, a1, a2)
+#  define ASYNC_DEQUE_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(async_deque, name, a1, a2, a3)
+#  define ASYNC_DEQUE_PROBE4(name, a1, a2, a3, a4) DTRACE_PROBE4(async_deque, name, a1, a2, a3, a4)
+#else
+#  define ASYNC_DEQUE_PROBE2(name, a1, a2) do {} while (0)
+#  define ASYNC_DEQUE_PROBE3(name, a1, a2, a3) do {} while (0)
+#  define ASYNC_DEQUE_PROBE4(name, a1, a2, a3, a4) do {} while (0)
+#endif
@@ -0,0 +1,334 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "stats.hpp"
+
+/**
+ * @file prometheus.hpp
+ * @brief Registry of named queues and Prometheus text-format exporter
+ *
+ * @details Queues are registered under a name and rendered together in the
+ * Prometheus exposition format (version 0.0.4), ready to be served from an
+ * HTTP endpoint or written for the node_exporter textfile collector.
+ * Rendering only reads each queue's stats(), which does not acquire the
+ * queue mutex, so scraping never contends with producers and consumers.
+ *
+ * Example usage:
+ * @code{.cpp}
+ * AsyncDeque<Job> jobs(1000);
+ * auto registration = StatsRegistry::global().add("jobs", jobs);
+ *
+ * // In the HTTP handler, or on a timer:
+ * std::string body = render_prometheus();
+ * write_prometheus_file("/var/lib/node_exporter/app.prom");
+ * @endcode
+ */
+
+namespace async_deque {
+
+/**
+ * @brief Set of named queues whose statistics are exported together
+ *
+ * @note All methods are thread-safe
+ */
+class StatsRegistry {
+public:
+    /// Statistics of one registered queue, as returned by collect()
+    struct Entry {
+        std::string name;       ///< Name given at registration
+        size_t capacity = 0;    ///< Capacity of the queue
+        DequeStats stats;       ///< Statistics snapshot
+    };
+
+    /**
+     * @brief Keeps a queue registered for as long as it is alive
+     *
+     * Must not outlive the queue it was created for. Destroying it waits
+     * for a collection in progress to finish.
+     */
+    class Registration {
+    public:
+        Registration() = default;
+
+        Registration(Registration&& other) noexcept
+            : registry_(std::exchange(other.registry_, nullptr)), id_(other.id_) {}
+
+        Registration& operator=(Registration&& other) noexcept {
+            if (this != &other) {
+                reset();
+                registry_ = std::exchange(other.registry_, nullptr);
+                id_ = other.id_;
+            }
+            return *this;
+        }
+
+        Registration(const Registration&) = delete;
+        Registration& operator=(const Registration&) = delete;
+
+        ~Registration() {
+            reset();
+        }
+
+        /// Removes the queue from the registry
+        void reset() {
+            if (registry_) {
+                registry_->remove(id_);
+                registry_ = nullptr;
+            }
+        }
+
+    private:
+        friend class StatsRegistry;
+        Registration(StatsRegistry* registry, uint64_t id) : registry_(registry), id_(id) {}
+
+        StatsRegistry* registry_ = nullptr;
+        uint64_t id_ = 0;
+    };
+
+    /// Process-wide registry used by render_prometheus() by default
+    static StatsRegistry& global() {
+        static StatsRegistry registry;
+        return registry;
+    }
+
+    /**
+     * @brief Registers a queue under a name
+     *
+     * @tparam Queue Any type with stats() and capacity(), e.g. AsyncDeque<T>
+     * @param name Value of the "queue" label; names need not be unique
+     * @param queue Queue to export; must outlive the returned Registration
+     */
+    template<typename Queue>
+    [[nodiscard]] Registration add(std::string name, const Queue& queue) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const uint64_t id = next_id_++;
+        sources_.emplace(id, Source{std::move(name), [&queue] {
+            return std::make_pair(static_cast<size_t>(queue.capacity()), queue.stats());
+        }});
+        return Registration(this, id);
+    }
+
+    /// Number of registered queues
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return sources_.size();
+    }
+
+    /// Snapshots every registered queue, in registration order
+    std::vector<Entry> collect() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<Entry> entries;
+        entries.reserve(sources_.size());
+        for (const auto& [id, source] : sources_) {
+            auto [capacity, stats] = source.read();
+            entries.push_back(Entry{source.name, capacity, std::move(stats)});
+        }
+        return entries;
+    }
+
+private:
+    struct Source {
+        std::string name;
+        std::function<std::pair<size_t, DequeStats>()> read;
+    };
+
+    void remove(uint64_t id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sources_.erase(id);
+    }
+
+    mutable std::mutex mutex_;
+    uint64_t next_id_ = 0;
+    std::map<uint64_t, Source> sources_;
+};
+
+namespace detail {
+
+inline std::string prometheus_label_value(const std::string& value) {
+    std::string escaped;
+    escaped.reserve(value.size());
+    for (char c : value) {
+        switch (c) {
+        case '\\': escaped += "\\\\"; break;
+        case '"': escaped += "\\\""; break;
+        case '\n': escaped += "\\n"; break;
+        default: escaped += c;
+        }
+    }
+    return escaped;
+}
+
+inline std::string prometheus_seconds(uint64_t ns) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.9g", static_cast<double>(ns) / 1e9);
+    return buffer;
+}
+
+/// Upper bounds, in nanoseconds, of the exported wait histogram buckets
+inline const std::vector<uint64_t>& prometheus_wait_buckets() {
+    static const std::vector<uint64_t> bounds = {
+        1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000, 10000000000,
+    };
+    return bounds;
+}
+
+/**
+ * @brief Writes a LogLinearHistogram snapshot as a Prometheus histogram
+ *
+ * A source bucket is counted under the first exported bound that is not
+ * below the source bucket's upper limit, so counts are accurate to the
+ * source histogram's resolution.
+ */
+inline void write_prometheus_histogram(std::ostream& out, const char* metric,
+                                       const std::string& labels,
+                                       const HistogramSnapshot& histogram) {
+    const auto& bounds = prometheus_wait_buckets();
+    std::vector<uint64_t> cumulative(bounds.size(), 0);
+    for (size_t i = 0; i < histogram.counts.size(); ++i) {
+        if (histogram.counts[i] == 0) continue;
+        const uint64_t upper = i + 1 == histogram.counts.size()
+            ? histogram.max : histogram.bucket_upper(i);
+        for (size_t b = 0; b < bounds.size(); ++b) {
+            if (upper <= bounds[b]) cumulative[b] += histogram.counts[i];
+        }
+    }
+    for (size_t b = 0; b < bounds.size(); ++b) {
+        out << metric << "_bucket{" << labels << ",le=\"" << prometheus_seconds(bounds[b])
+            << "\"} " << cumulative[b] << '\n';
+    }
+    out << metric << "_bucket{" << labels << ",le=\"+Inf\"} " << histogram.count << '\n';
+    out << metric << "_sum{" << labels << "} " << prometheus_seconds(histogram.sum) << '\n';
+    out << metric << "_count{" << labels << "} " << histogram.count << '\n';
+}
+
+} // namespace detail
+
+/**
+ * @brief Writes the statistics of all queues in @p registry in Prometheus text format
+ */
+inline void render_prometheus(std::ostream& out,
+                              const StatsRegistry& registry = StatsRegistry::global()) {
+    const std::vector<StatsRegistry::Entry> entries = registry.collect();
+
+    struct Metric {
+        const char* name;
+        const char* type;
+        const char* help;
+    };
+    auto header = [&out](const Metric& metric) {
+        out << "# HELP " << metric.name << ' ' << metric.help << '\n'
+            << "# TYPE " << metric.name << ' ' << metric.type << '\n';
+    };
+    auto label = [](const StatsRegistry::Entry& entry) {
+        return "queue=\"" + detail::prometheus_label_value(entry.name) + "\"";
+    };
+    auto simple = [&](const Metric& metric, auto value_of) {
+        header(metric);
+        for (const auto& entry : entries) {
+            out << metric.name << '{' << label(entry) << "} " << value_of(entry) << '\n';
+        }
+    };
+    auto per_side = [&](const Metric& metric, auto producer_value, auto consumer_value) {
+        header(metric);
+        for (const auto& entry : entries) {
+            out << metric.name << '{' << label(entry) << ",side=\"producer\"} "
+                << producer_value(entry.stats) << '\n';
+            out << metric.name << '{' << label(entry) << ",side=\"consumer\"} "
+                << consumer_value(entry.stats) << '\n';
+        }
+    };
+
+    simple({"async_deque_depth", "gauge", "Number of queued items."},
+           [](const auto& e) { return std::to_string(e.stats.depth); });
+    simple({"async_deque_high_water", "gauge", "Largest number of queued items observed."},
+           [](const auto& e) { return std::to_string(e.stats.high_water); });
+    simple({"async_deque_capacity", "gauge", "Maximum number of queued items."},
+           [](const auto& e) {
+               return e.capacity == std::numeric_limits<size_t>::max()
+                   ? std::string("+Inf") : std::to_string(e.capacity);
+           });
+    simple({"async_deque_pushes_total", "counter", "Items pushed."},
+           [](const auto& e) { return std::to_string(e.stats.pushes); });
+    simple({"async_deque_pops_total", "counter", "Items popped."},
+           [](const auto& e) { return std::to_string(e.stats.pops); });
+    per_side({"async_deque_timeouts_total", "counter", "Timed calls that gave up."},
+             [](const DequeStats& s) { return s.push_timeouts; },
+             [](const DequeStats& s) { return s.pop_timeouts; });
+    simple({"async_deque_dropped_total", "counter", "Pushes refused because the queue was closed."},
+           [](const auto& e) { return std::to_string(e.stats.rejected_pushes); });
+    per_side({"async_deque_blocked_seconds_total", "counter",
+              "Time spent waiting for space (producer) or for an item (consumer)."},
+             [](const DequeStats& s) { return detail::prometheus_seconds(s.producer_blocked_ns); },
+             [](const DequeStats& s) { return detail::prometheus_seconds(s.consumer_blocked_ns); });
+    simple({"async_deque_notifies_total", "counter", "Condition variable notifications issued."},
+           [](const auto& e) { return std::to_string(e.stats.notifies); });
+    per_side({"async_deque_wakeups_total", "counter", "Wakeups of blocked callers."},
+             [](const DequeStats& s) { return s.producer_wakeups; },
+             [](const DequeStats& s) { return s.consumer_wakeups; });
+    per_side({"async_deque_wasted_wakeups_total", "counter",
+              "Wakeups after which the caller had to wait again."},
+             [](const DequeStats& s) { return s.producer_wasted_wakeups; },
+             [](const DequeStats& s) { return s.consumer_wasted_wakeups; });
+    simple({"async_deque_lock_acquisitions_total", "counter", "Acquisitions of the queue mutex."},
+           [](const auto& e) { return std::to_string(e.stats.lock_acquisitions); });
+    simple({"async_deque_lock_contentions_total", "counter",
+            "Acquisitions of the queue mutex that found it already held."},
+           [](const auto& e) { return std::to_string(e.stats.lock_contentions); });
+
+    header({"async_deque_wait_seconds", "histogram",
+            "Duration of each episode of waiting for space (producer) or for an item (consumer)."});
+    for (const auto& entry : entries) {
+        detail::write_prometheus_histogram(out, "async_deque_wait_seconds",
+                                           label(entry) + ",side=\"producer\"",
+                                           entry.stats.producer_wait);
+        detail::write_prometheus_histogram(out, "async_deque_wait_seconds",
+                                           label(entry) + ",side=\"consumer\"",
+                                           entry.stats.consumer_wait);
+    }
+    header({"async_deque_lock_wait_seconds", "histogram",
+            "Time spent acquiring the contended queue mutex."});
+    for (const auto& entry : entries) {
+        detail::write_prometheus_histogram(out, "async_deque_lock_wait_seconds", label(entry),
+                                           entry.stats.lock_wait);
+    }
+}
+
+/// Returns the statistics of all queues in @p registry in Prometheus text format
+inline std::string render_prometheus(const StatsRegistry& registry = StatsRegistry::global()) {
+    std::ostringstream out;
+    render_prometheus(out, registry);
+    return out.str();
+}
+
+/**
+ * @brief Writes render_prometheus() output to @p path for a textfile collector
+ *
+ * Writes to a temporary file next to @p path and renames it into place, so
+ * the collector never reads a partially written file.
+ *
+ * @return false if the file could not be written
+ */
+inline bool write_prometheus_file(const std::string& path,
+                                  const StatsRegistry& registry = StatsRegistry::global()) {
+    const std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::out | std::ios::trunc);
+        if (!file) return false;
+        render_prometheus(file, registry);
+        if (!file.flush()) return false;
+    }
+    return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+} // namespace async_deque
@@ -0,0 +1,45 @@
+#pragma once
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+/**
+ * @file serializer.hpp
+ * @brief Byte serialization of queue elements for the file-backed queues and snapshots
+ */
+
+namespace async_deque {
+
+/**
+ * @brief Serializer for trivially copyable types: the bytes of the object
+ *
+ * A serializer for SpillDeque, DurableDeque and AsyncDeque::snapshot() provides:
+ * - `size_t size(const T&)`: number of bytes write() will produce
+ * - `void write(const T&, unsigned char* out)`: writes exactly size() bytes
+ * - `T read(const unsigned char* data, size_t size)`: rebuilds the item
+ *
+ * write() stores straight into the mapped file, so no intermediate buffer
+ * is needed.
+ */
+template<typename T>
+struct TrivialSerializer {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "TrivialSerializer needs a trivially copyable type; pass a serializer for T");
+
+    size_t size(const T&) const {
+        return sizeof(T);
+    }
+
+    void write(const T& item, unsigned char* out) const {
+        std::memcpy(out, &item, sizeof(T));
+    }
+
+    T read(const unsigned char* data, size_t) const {
+        alignas(T) unsigned char bytes[sizeof(T)];
+        std::memcpy(bytes, data, sizeof(T));
+        return *std::launder(reinterpret_cast<const T*>(bytes));
+    }
+};
+
+} // namespace async_deque
@@ -0,0 +1,537 @@
+#pragma once
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <new>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#if !defined(__linux__)
+#error "shm_deque.hpp needs Linux (memfd, futex and robust process-shared mutexes)"
+#endif
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stats.hpp"
+#include "sync.hpp"
+
+/**
+ * @file shm_deque.hpp
+ * @brief Bounded double-ended queue shared between processes
+ *
+ * @details ShmDeque keeps a fixed ring of trivially copyable elements in a
+ * shared memory region, either a named POSIX shared memory object or an
+ * anonymous memfd that is handed to the other process by fork() or over a
+ * Unix socket. Items are copied in and out with memcpy, so passing a message
+ * costs no serialization and, when nobody has to be woken, no system call.
+ *
+ * Every handle sees the same queue: a push in one process can be popped in
+ * another, and close() in any process releases the waiters of all of them.
+ * Destroying a handle only unmaps the region; the queue lives until the last
+ * mapping and the name (if any) are gone.
+ *
+ * Crash safety: the critical section is guarded by a robust process-shared
+ * mutex, and each operation publishes its effect with one aligned 64-bit
+ * store (ring head and element count packed into one word). If a process dies
+ * while holding the mutex, the next process to lock it sees the queue either
+ * before or after the dead process's operation, never in between, and wakes
+ * every waiter in case the dead process owed one a wake-up. An item popped by
+ * a process that died before using it is lost with that process.
+ *
+ * If the mutex cannot be locked at all (it was left unrecoverable, or the
+ * region is corrupt), the queue reports itself closed: pushes return false,
+ * pops return std::nullopt, and size() is 0.
+ *
+ * Example usage:
+ * @code{.cpp}
+ * struct Job { uint64_t id; char path[240]; };
+ * auto queue = ShmDeque<Job>::create_anonymous(1024);
+ * if (fork() == 0) {
+ *     while (auto job = queue->pop_front()) run(*job);
+ *     _exit(0);
+ * }
+ * queue->push_back(Job{1, "/tmp/input"});
+ * queue->close();
+ * @endcode
+ */
+
+namespace async_deque {
+
+namespace detail {
+
+constexpr uint32_t shm_ready = 0x41445153;   // "ADQS"
+constexpr uint32_t shm_version = 1;
+
+/**
+ * @brief Control block at the start of a ShmDeque region
+ *
+ * Followed by the element slots at ShmDeque::slots_offset().
+ */
+struct ShmHeader {
+    std::atomic<uint32_t> ready;      ///< shm_ready once the creator has initialized the region
+    uint32_t version;
+    uint64_t element_size;
+    uint64_t capacity;
+    pthread_mutex_t mutex;            ///< Robust, process-shared
+    uint64_t ring;                    ///< Head slot (high 32 bits) and count (low 32 bits), guarded by mutex
+    uint32_t closed;                  ///< Guarded by mutex
+    uint32_t waiting[2];              ///< Producers, consumers waiting; guarded by mutex. A waiter
+                                      ///< that dies stays counted, which only costs spare wake-ups
+    std::atomic<uint32_t> seq[2];     ///< Futex words: bumped when space / an item becomes available
+    std::atomic<uint64_t> owner_deaths;
+};
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t) &&
+              std::atomic<uint32_t>::is_always_lock_free,
+              "futex words must be plain 32-bit integers");
+
+inline void futex_wait(std::atomic<uint32_t>& word, uint32_t expected, const timespec* timeout) {
+    ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, timeout,
+              nullptr, 0);
+}
+
+inline void futex_wake(std::atomic<uint32_t>& word, int waiters) {
+    ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, waiters, nullptr,
+              nullptr, 0);
+}
+
+} // namespace detail
+
+/**
+ * @brief Process-shared bounded deque of trivially copyable elements
+ *
+ * @tparam T Element type; must be trivially copyable, since it is copied
+ *         between address spaces byte by byte
+ *
+ * Instances are created with the static factories, which return
+ * std::nullopt when the region cannot be created, opened or mapped. The
+ * capacity is fixed when the region is created, at most 2^32 - 1 elements.
+ *
+ * @note All operations are thread-safe and process-safe
+ */
+template<typename T>
+class ShmDeque {
+    static_assert(std::is_trivially_copyable_v<T>, "ShmDeque elements must be trivially copyable");
+
+    enum class End { front, back };
+    enum Side : size_t { producer = 0, consumer = 1 };
+
+public:
+    /// Byte offset of the first element slot in the region
+    static constexpr size_t slots_offset() {
+        constexpr size_t align = alignof(T) > detail::cache_line_size ? alignof(T) : detail::cache_line_size;
+        return (sizeof(detail::ShmHeader) + align - 1) / align * align;
+    }
+
+    /// Size of the region holding @p capacity elements
+    static constexpr size_t region_size(size_t capacity) {
+        return slots_offset() + capacity * sizeof(T);
+    }
+
+    /**
+     * @brief Creates a named queue with shm_open
+     * @param name POSIX shared memory name, e.g. "/jobs"; must not exist yet
+     */
+    static std::optional<ShmDeque> create(const std::string& name, size_t capacity) {
+        if (!valid_capacity(capacity)) return std::nullopt;
+        const int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0) return std::nullopt;
+        auto queue = initialize(fd, capacity);
+        if (!queue) ::shm_unlink(name.c_str());
+        return queue;
+    }
+
+    /// Opens a named queue created by create() in this or another process
+    static std::optional<ShmDeque> open(const std::string& name) {
+        const int fd = ::shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0) return std::nullopt;
+        return map_existing(fd);
+    }
+
+    /// Removes @p name; processes that have the queue open keep using it
+    static bool unlink(const std::string& name) {
+        return ::shm_unlink(name.c_str()) == 0;
+    }
+
+    /**
+     * @brief Creates an unnamed queue in a memfd
+     *
+     * Share it with children through fork(), or send fd() to another process
+     * over a Unix socket and map it there with attach().
+     */
+    static std::optional<ShmDeque> create_anonymous(size_t capacity) {
+        if (!valid_capacity(capacity)) return std::nullopt;
+        const int fd = ::memfd_create("async_deque", MFD_CLOEXEC);
+        if (fd < 0) return std::nullopt;
+        return initialize(fd, capacity);
+    }
+
+    /// Maps the queue in @p fd; the descriptor is duplicated, the caller keeps its own
+    static std::optional<ShmDeque> attach(int fd) {
+        const int own = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if (own < 0) return std::nullopt;
+        return map_existing(own);
+    }
+
+    ShmDeque(ShmDeque&& other) noexcept
+        : fd_(std::exchange(other.fd_, -1)), header_(std::exchange(other.header_, nullptr)),
+          slots_(std::exchange(other.slots_, nullptr)), capacity_(other.capacity_) {}
+
+    ShmDeque& operator=(ShmDeque&& other) noexcept {
+        if (this != &other) {
+            release();
+            fd_ = std::exchange(other.fd_, -1);
+            header_ = std::exchange(other.header_, nullptr);
+            slots_ = std::exchange(other.slots_, nullptr);
+            capacity_ = other.capacity_;
+        }
+        return *this;
+    }
+
+    ShmDeque(const ShmDeque&) = delete;
+    ShmDeque& operator=(const ShmDeque&) = delete;
+
+    /// Unmaps the region; does not close the queue for other handles
+    ~ShmDeque() {
+        release();
+    }
+
+    /// Descriptor of the shared memory object, for passing to another process
+    int fd() const {
+        return fd_;
+    }
+
+    size_t capacity() const {
+        return capacity_;
+    }
+
+    size_t size() const {
+        Lock lock(*header_);
+        return lock.owns_lock() ? count(header_->ring) : 0;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    /// Also true if the queue mutex cannot be locked
+    bool is_closed() const {
+        Lock lock(*header_);
+        return !lock.owns_lock() || header_->closed != 0;
+    }
+
+    /// Number of times a process died holding the queue mutex and the state was recovered
+    uint64_t owner_deaths() const {
+        return header_->owner_deaths.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Closes the queue in every process
+     *
+     * Pushes fail from now on, pops drain the remaining items and then
+     * return std::nullopt, and all blocked callers are released.
+     */
+    void close() {
+        Lock lock(*header_);
+        if (!lock.owns_lock() || header_->closed) return;
+        header_->closed = 1;
+        wake_all();
+    }
+
+    bool push_back(const T& item) {
+        return push<End::back>(item);
+    }
+
+    bool push_front(const T& item) {
+        return push<End::front>(item);
+    }
+
+    template<typename Rep, typename Period>
+    bool try_push_back(const T& item, const std::chrono::duration<Rep, Period>& timeout) {
+        return push<End::back>(item, detail::deadline_after(timeout));
+    }
+
+    template<typename Rep, typename Period>
+    bool try_push_front(const T& item, const std::chrono::duration<Rep, Period>& timeout) {
+        return push<End::front>(item, detail::deadline_after(timeout));
+    }
+
+    std::optional<T> pop_front() {
+        return pop<End::front>();
+    }
+
+    std::optional<T> pop_back() {
+        return pop<End::back>();
+    }
+
+    template<typename Rep, typename Period>
+    std::optional<T> try_pop_front(const std::chrono::duration<Rep, Period>& timeout) {
+        return pop<End::front>(detail::deadline_after(timeout));
+    }
+
+    template<typename Rep, typename Period>
+    std::optional<T> try_pop_back(const std::chrono::duration<Rep, Period>& timeout) {
+        return pop<End::back>(detail::deadline_after(timeout));
+    }
+
+private:
+    /// Holds the robust mutex, recovering it if its previous owner died; check owns_lock()
+    class Lock {
+    public:
+        explicit Lock(detail::ShmHeader& header) : header_(header) {
+            lock();
+        }
+
+        ~Lock() {
+            if (locked_) pthread_mutex_unlock(&header_.mutex);
+        }
+
+        /// @return false if the mutex could not be locked (ENOTRECOVERABLE, EINVAL, ...)
+        bool lock() {
+            const int result = pthread_mutex_lock(&header_.mutex);
+            if (result == EOWNERDEAD) {
+                if (pthread_mutex_consistent(&header_.mutex) != 0) {
+                    // Unlocking now leaves the mutex unrecoverable for everyone
+                    pthread_mutex_unlock(&header_.mutex);
+                    return false;
+                }
+                // The ring word is always consistent; only the dead process's
+                // pending wake-ups may be missing.
+                header_.owner_deaths.fetch_add(1, std::memory_order_relaxed);
+                for (size_t side = 0; side < 2; ++side) {
+                    header_.seq[side].fetch_add(1, std::memory_order_release);
+                    detail::futex_wake(header_.seq[side], INT_MAX);
+                }
+            } else if (result != 0) {
+                return false;
+            }
+            locked_ = true;
+            return true;
+        }
+
+        bool owns_lock() const {
+            return locked_;
+        }
+
+        void unlock() {
+            pthread_mutex_unlock(&header_.mutex);
+            locked_ = false;
+        }
+
+    private:
+        detail::ShmHeader& header_;
+        bool locked_ = false;
+    };
+
+    using Deadline = detail::Deadline;
+
+    ShmDeque(int fd, void* region, size_t capacity)
+        : fd_(fd), header_(static_cast<detail::ShmHeader*>(region)),
+          slots_(static_cast<unsigned char*>(region) + slots_offset()), capacity_(capacity) {}
+
+    static bool valid_capacity(size_t capacity) {
+        return capacity != 0 && capacity <= UINT32_MAX;
+    }
+
+    static void* map(int fd, size_t size) {
+        void* region = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        return region == MAP_FAILED ? nullptr : region;
+    }
+
+    static std::optional<ShmDeque> initialize(int fd, size_t capacity) {
+        void* region = nullptr;
+        if (::ftruncate(fd, static_cast<off_t>(region_size(capacity))) != 0 ||
+            !(region = map(fd, region_size(capacity)))) {
+            ::close(fd);
+            return std::nullopt;
+        }
+        auto* header = new (region) detail::ShmHeader{};
+        header->version = detail::shm_version;
+        header->element_size = sizeof(T);
+        header->capacity = capacity;
+        pthread_mutexattr_t attributes;
+        pthread_mutexattr_init(&attributes);
+        pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+        const int rc = pthread_mutex_init(&header->mutex, &attributes);
+        pthread_mutexattr_destroy(&attributes);
+        if (rc != 0) {
+            ::munmap(region, region_size(capacity));
+            ::close(fd);
+            return std::nullopt;
+        }
+        header->ready.store(detail::shm_ready, std::memory_order_release);
+        return ShmDeque(fd, region, capacity);
+    }
+
+    static std::optional<ShmDeque> map_existing(int fd) {
+        struct stat info;
+        void* region = nullptr;
+        if (::fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < slots_offset() ||
+            !(region = map(fd, static_cast<size_t>(info.st_size)))) {
+            ::close(fd);
+            return std::nullopt;
+        }
+        const auto* header = static_cast<const detail::ShmHeader*>(region);
+        // The creator may still be initializing a named region it just made
+        for (int tries = 0; header->ready.load(std::memory_order_acquire) != detail::shm_ready &&
+                            tries < 100; ++tries) {
+            ::usleep(1000);
+        }
+        const bool valid = header->ready.load(std::memory_order_acquire) == detail::shm_ready &&
+                           header->version == detail::shm_version &&
+                           header->element_size == sizeof(T) &&
+                           valid_capacity(header->capacity) &&
+                           region_size(header->capacity) <= static_cast<size_t>(info.st_size);
+        if (!valid) {
+            ::munmap(region, static_cast<size_t>(info.st_size));
+            ::close(fd);
+            return std::nullopt;
+        }
+        const size_t capacity = header->capacity;
+        if (region_size(capacity) != static_cast<size_t>(info.st_size)) {
+            ::munmap(region, static_cast<size_t>(info.st_size));
+            region = map(fd, region_size(capacity));
+            if (!region) {
+                ::close(fd);
+                return std::nullopt;
+            }
+        }
+        return ShmDeque(fd, region, capacity);
+    }
+
+    void release() {
+        if (header_) ::munmap(header_, region_size(capacity_));
+        if (fd_ >= 0) ::close(fd_);
+        header_ = nullptr;
+        fd_ = -1;
+    }
+
+    static uint32_t head(uint64_t ring) {
+        return static_cast<uint32_t>(ring >> 32);
+    }
+
+    static uint32_t count(uint64_t ring) {
+        return static_cast<uint32_t>(ring);
+    }
+
+    static uint64_t pack(uint64_t head, uint64_t count) {
+        return head << 32 | count;
+    }
+
+    unsigned char* slot(uint64_t index) {
+        return slots_ + index * sizeof(T);
+    }
+
+    /// Bumps the futex word of @p side and wakes one waiter; called with the mutex held
+    void notify(Side side) {
+        header_->seq[side].fetch_add(1, std::memory_order_release);
+        // Waking under the mutex: if this process dies before the wake-up,
+        // it dies holding the mutex and the next owner wakes everyone.
+        if (header_->waiting[side] != 0) detail::futex_wake(header_->seq[side], 1);
+    }
+
+    void wake_all() {
+        for (Side side : {producer, consumer}) {
+            header_->seq[side].fetch_add(1, std::memory_order_release);
+            if (header_->waiting[side] != 0) detail::futex_wake(header_->seq[side], INT_MAX);
+        }
+    }
+
+    /**
+     * @brief Waits on the futex word of @p side until @p ready() holds
+     * @return false if @p deadline passed first, or if the mutex could not
+     *         be locked again, in which case @p lock no longer owns it
+     */
+    template<typename Ready>
+    bool wait(Lock& lock, Side side, Ready ready, const std::optional<Deadline>& deadline) {
+        while (!ready()) {
+            timespec remaining{};
+            if (deadline) {
+                const auto left = *deadline - std::chrono::steady_clock::now();
+                if (left <= Deadline::duration::zero()) return false;
+                const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+                remaining.tv_sec = static_cast<time_t>(ns / 1000000000);
+                remaining.tv_nsec = static_cast<long>(ns % 1000000000);
+            }
+            // Read under the mutex: any change after this makes futex_wait return at once
+            const uint32_t observed = header_->seq[side].load(std::memory_order_acquire);
+            ++header_->waiting[side];
+            lock.unlock();
+            detail::futex_wait(header_->seq[side], observed, deadline ? &remaining : nullptr);
+            if (!lock.lock()) return false;
+            --header_->waiting[side];
+        }
+        return true;
+    }
+
+    template<End end>
+    bool push(const T& item, std::optional<Deadline> deadline = std::nullopt) {
+        Lock lock(*header_);
+        if (!lock.owns_lock() || !wait(lock, producer, [this] {
+            return header_->closed || count(header_->ring) < capacity_;
+        }, deadline)) {
+            return false;
+        }
+        if (header_->closed) return false;
+
+        uint64_t first = head(header_->ring);
+        const uint64_t n = count(header_->ring);
+        if constexpr (end == End::back) {
+            std::memcpy(slot((first + n) % capacity_), &item, sizeof(T));
+        } else {
+            first = (first + capacity_ - 1) % capacity_;
+            std::memcpy(slot(first), &item, sizeof(T));
+        }
+        header_->ring = pack(first, n + 1);   // commit
+        notify(consumer);
+        return true;
+    }
+
+    template<End end>
+    std::optional<T> pop(std::optional<Deadline> deadline = std::nullopt) {
+        std::optional<T> item;
+        Lock lock(*header_);
+        if (!lock.owns_lock() || !wait(lock, consumer, [this] {
+            return header_->closed || count(header_->ring) != 0;
+        }, deadline)) {
+            return item;
+        }
+        uint64_t first = head(header_->ring);
+        const uint64_t n = count(header_->ring);
+        if (n == 0) return item;   // closed and drained
+
+        // Copied through raw storage so T need not be default constructible
+        alignas(T) unsigned char bytes[sizeof(T)];
+        if constexpr (end == End::front) {
+            std::memcpy(bytes, slot(first), sizeof(T));
+            first = (first + 1) % capacity_;
+        } else {
+            std::memcpy(bytes, slot((first + n - 1) % capacity_), sizeof(T));
+        }
+        item.emplace(*std::launder(reinterpret_cast<const T*>(bytes)));
+        header_->ring = pack(first, n - 1);   // commit
+        notify(producer);
+        return item;
+    }
+
+    int fd_;
+    detail::ShmHeader* header_;
+    unsigned char* slots_;
+    size_t capacity_;
+};
+
+} // namespace async_deque
@@ -0,0 +1,243 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <iomanip>
+#include <ostream>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define ASYNC_DEQUE_HAS_TSC 1
+#endif
+
+#include "async_deque.hpp"
+#include "stats.hpp"
+
+/**
+ * @file sojourn.hpp
+ * @brief Per-element sojourn time (time spent queued) tracking for AsyncDeque
+ *
+ * @details SojournDeque stamps every element when it is pushed and records
+ * how long it waited when it is popped. The stamps are kept in a deque that
+ * runs parallel to the element storage, so T does not need a timestamp field.
+ *
+ * Example usage:
+ * @code{.cpp}
+ * SojournDeque<Job> queue(1000);
+ * // ... producers and consumers ...
+ * auto summary = queue.sojourn();
+ * std::cout << "p99 wait: " << summary.p99_ns << "ns\n";
+ * queue.dump_sojourn(std::cout);
+ * @endcode
+ */
+
+namespace async_deque {
+
+/**
+ * @brief Clock reading the CPU time-stamp counter
+ *
+ * About one cycle of overhead per reading. The tick rate is calibrated
+ * against std::chrono::steady_clock once per process. Assumes an invariant
+ * TSC, which all x86 CPUs of the last decade have. On other architectures
+ * this falls back to steady_clock and ticks are nanoseconds.
+ */
+struct TscClock {
+    static uint64_t now() {
+#ifdef ASYNC_DEQUE_HAS_TSC
+        return __rdtsc();
+#else
+        return detail::steady_now_ns();
+#endif
+    }
+
+    static double ns_per_tick() {
+#ifdef ASYNC_DEQUE_HAS_TSC
+        static const double ratio = [] {
+            const uint64_t ns_start = detail::steady_now_ns();
+            const uint64_t tsc_start = __rdtsc();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            const uint64_t ns_elapsed = detail::steady_now_ns() - ns_start;
+            const uint64_t tsc_elapsed = __rdtsc() - tsc_start;
+            return tsc_elapsed == 0 ? 1.0
+                                    : static_cast<double>(ns_elapsed) / static_cast<double>(tsc_elapsed);
+        }();
+        return ratio;
+#else
+        return 1.0;
+#endif
+    }
+};
+
+/**
+ * @brief Clock reading CLOCK_MONOTONIC_COARSE
+ *
+ * Served from the vDSO without a syscall and cheaper than CLOCK_MONOTONIC.
+ * Resolution is one scheduler tick (typically 1-4ms), so this clock is only
+ * useful for queues where items wait for milliseconds or more. Falls back
+ * to steady_clock where the coarse clock does not exist.
+ */
+struct CoarseClock {
+    static uint64_t now() {
+#ifdef CLOCK_MONOTONIC_COARSE
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000u + static_cast<uint64_t>(ts.tv_nsec);
+#else
+        return detail::steady_now_ns();
+#endif
+    }
+
+    static double ns_per_tick() {
+        return 1.0;
+    }
+};
+
+/**
+ * @brief Sojourn time percentiles, in nanoseconds
+ */
+struct SojournSummary {
+    uint64_t count = 0;     ///< Number of popped items measured
+    double mean_ns = 0.0;   ///< Mean time spent queued
+    uint64_t p50_ns = 0;    ///< Median
+    uint64_t p99_ns = 0;    ///< 99th percentile
+    uint64_t p999_ns = 0;   ///< 99.9th percentile
+    uint64_t max_ns = 0;    ///< Longest time spent queued
+};
+
+/**
+ * @brief AsyncDeque that measures how long each element stays queued
+ *
+ * @tparam T The type of elements to store
+ * @tparam Clock Timestamp source; TscClock or CoarseClock
+ *
+ * Stamps are taken in the push hooks and consumed in the pop hooks, both of
+ * which run under the queue mutex, so each stamp stays paired with its
+ * element even when items are pushed and popped at both ends. Classes
+ * deriving from SojournDeque that override a hook must call the
+ * SojournDeque version.
+ *
+ * Sojourn times are recorded in clock ticks into a lock-free log-linear
+ * histogram and converted to nanoseconds when read, so recording costs one
+ * clock read and a few relaxed atomic increments.
+ */
+template<typename T, typename Clock = TscClock>
+class SojournDeque : public AsyncDeque<T> {
+public:
+    /// Histogram of sojourn times in clock ticks (about 1.6% resolution)
+    using Histogram = LogLinearHistogram<6, 48>;
+
+    explicit SojournDeque(size_t capacity = std::numeric_limits<size_t>::max())
+        : AsyncDeque<T>(capacity), ns_per_tick_(Clock::ns_per_tick()) {}
+
+    SojournDeque(SojournDeque&& other) noexcept
+        : AsyncDeque<T>(std::move(other)), ns_per_tick_(other.ns_per_tick_) {
+        std::lock_guard<detail::Mutex> lock(other.mutex_);
+        stamps_ = std::move(other.stamps_);
+    }
+
+    SojournDeque& operator=(SojournDeque&&) = delete;
+
+    /**
+     * @brief Returns count, mean, p50, p99, p999 and max of the sojourn times
+     * @note Thread-safe, does not acquire the queue mutex
+     */
+    SojournSummary sojourn() const {
+        const HistogramSnapshot snap = histogram_.snapshot();
+        SojournSummary summary;
+        summary.count = snap.count;
+        summary.mean_ns = snap.mean() * ns_per_tick_;
+        summary.p50_ns = to_ns(snap.percentile(0.50));
+        summary.p99_ns = to_ns(snap.percentile(0.99));
+        summary.p999_ns = to_ns(snap.percentile(0.999));
+        summary.max_ns = to_ns(snap.max);
+        return summary;
+    }
+
+    /**
+     * @brief Returns the sojourn time of quantile @p q (0.0 - 1.0) in nanoseconds
+     */
+    uint64_t sojourn_percentile(double q) const {
+        return to_ns(histogram_.snapshot().percentile(q));
+    }
+
+    /**
+     * @brief Snapshot of the underlying histogram, in clock ticks
+     * @see ns_per_tick()
+     */
+    HistogramSnapshot sojourn_histogram() const {
+        return histogram_.snapshot();
+    }
+
+    double ns_per_tick() const {
+        return ns_per_tick_;
+    }
+
+    /**
+     * @brief Writes a text dump of the sojourn distribution
+     *
+     * One summary line followed by one line per non-empty bucket, giving its
+     * upper bound in nanoseconds, its count and the cumulative percentile.
+     */
+    void dump_sojourn(std::ostream& out) const {
+        const HistogramSnapshot snap = histogram_.snapshot();
+        const SojournSummary summary = sojourn();
+        out << "sojourn count=" << summary.count
+            << " mean_ns=" << static_cast<uint64_t>(summary.mean_ns)
+            << " p50_ns=" << summary.p50_ns
+            << " p99_ns=" << summary.p99_ns
+            << " p999_ns=" << summary.p999_ns
+            << " max_ns=" << summary.max_ns << '\n';
+        out << std::setw(16) << "value_ns" << std::setw(12) << "count"
+            << std::setw(12) << "percentile" << '\n';
+        uint64_t seen = 0;
+        for (size_t i = 0; i < snap.counts.size(); ++i) {
+            if (snap.counts[i] == 0) continue;
+            seen += snap.counts[i];
+            const uint64_t upper = i + 1 == snap.counts.size()
+                ? snap.max : std::min(snap.bucket_upper(i), snap.max);
+            out << std::setw(16) << to_ns(upper)
+                << std::setw(12) << snap.counts[i]
+                << std::setw(12) << std::fixed << std::setprecision(6)
+                << static_cast<double>(seen) / static_cast<double>(snap.count) << '\n';
+        }
+        out << std::defaultfloat;
+    }
+
+protected:
+    void on_push_back(const T&) override {
+        stamps_.push_back(Clock::now());
+    }
+
+    void on_push_front(const T&) override {
+        stamps_.push_front(Clock::now());
+    }
+
+    void on_pop_back(const T&) override {
+        record(stamps_.back());
+        stamps_.pop_back();
+    }
+
+    void on_pop_front(const T&) override {
+        record(stamps_.front());
+        stamps_.pop_front();
+    }
+
+private:
+    void record(uint64_t stamp) {
+        const uint64_t now = Clock::now();
+        histogram_.record(now > stamp ? now - stamp : 0);
+    }
+
+    uint64_t to_ns(uint64_t ticks) const {
+        return static_cast<uint64_t>(static_cast<double>(ticks) * ns_per_tick_);
+    }
+
+    const double ns_per_tick_;
+    std::deque<uint64_t> stamps_;   ///< Push stamps, parallel to deque_ and guarded by mutex_
+    Histogram histogram_;
+};
+
+} // namespace async_deque
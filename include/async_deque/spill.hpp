@@ -0,0 +1,337 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "serializer.hpp"
+#include "sync.hpp"
+
+/**
+ * @file spill.hpp
+ * @brief FIFO queue that spills to memory-mapped files instead of blocking
+ *
+ * @details SpillDeque holds up to capacity items in memory like AsyncDeque.
+ * When memory is full, a push does not block. The item is serialized and
+ * appended to a segment file mapped into memory, so a stalled consumer does
+ * not push back on producers until the disk budget (max_spill_bytes) is used
+ * up. As consumers drain memory, spilled items are read back in FIFO order,
+ * and each segment file is deleted once its last item has been read.
+ *
+ * Spilling is for overflow, not durability: segment files belong to one
+ * SpillDeque object, nothing is synced, and the destructor deletes them.
+ *
+ * If a segment file cannot be created (the directory is missing, the disk is
+ * full), pushes fall back to blocking, as they would in AsyncDeque, until a
+ * pop finds nothing left on disk; the next overflow then tries again.
+ *
+ * Example usage:
+ * @code{.cpp}
+ * SpillOptions options;
+ * options.directory = "/var/spool/ingest";
+ * options.max_spill_bytes = uint64_t{8} << 30;
+ * SpillDeque<Event> events(10000, options);   // Event is trivially copyable
+ * events.push_back(event);                    // never blocks while under 8GB on disk
+ * @endcode
+ */
+
+namespace async_deque {
+
+/**
+ * @brief Where and how much a SpillDeque may spill
+ */
+struct SpillOptions {
+    std::string directory = ".";                   ///< Existing directory for segment files
+    size_t segment_bytes = size_t{64} << 20;       ///< Size of each segment file (larger if one item needs it)
+    uint64_t max_spill_bytes = std::numeric_limits<uint64_t>::max();   ///< Producers block beyond this
+};
+
+/**
+ * @brief Current spill state of a SpillDeque
+ */
+struct SpillStats {
+    uint64_t spilled_items = 0;    ///< Items currently on disk
+    uint64_t spilled_bytes = 0;    ///< Bytes of those items, including 4-byte length prefixes
+    uint64_t segments = 0;         ///< Segment files currently on disk
+    uint64_t total_spilled = 0;    ///< Items ever spilled
+    uint64_t spill_failures = 0;   ///< Segment files that could not be created
+};
+
+/**
+ * @brief Bounded FIFO queue with overflow to memory-mapped segment files
+ *
+ * @tparam T The type of elements to store
+ * @tparam Serializer Converts T to and from bytes; see TrivialSerializer
+ *
+ * Invariant: while any item is spilled, memory holds capacity items, all of
+ * them older than every spilled item. Each pop that takes an item from
+ * memory moves the oldest spilled item into memory, so items leave in the
+ * order they were pushed.
+ *
+ * Serialization and the copy into the segment happen under the queue mutex.
+ *
+ * Like DurableDeque, SpillDeque is not an AsyncDeque and reports only its
+ * own SpillStats: it has no DequeStats, lock profile, Tracer events or USDT
+ * probes, and no extension hooks.
+ *
+ * @note All methods are thread-safe
+ */
+template<typename T, typename Serializer = TrivialSerializer<T>>
+class SpillDeque {
+public:
+    /**
+     * @param capacity Items held in memory before pushes start to spill
+     * @param options Spill directory and limits
+     * @param serializer Converts items to and from bytes
+     */
+    SpillDeque(size_t capacity, SpillOptions options, Serializer serializer = Serializer())
+        : capacity_(capacity == 0 ? 1 : capacity), options_(std::move(options)),
+          serializer_(std::move(serializer)), prefix_(options_.directory + "/spill-" +
+                                                      std::to_string(::getpid()) + "-" +
+                                                      std::to_string(next_instance()) + "-") {}
+
+    SpillDeque(const SpillDeque&) = delete;
+    SpillDeque& operator=(const SpillDeque&) = delete;
+
+    /// Closes the queue and deletes any remaining segment files
+    ~SpillDeque() {
+        close();
+        std::lock_guard<detail::Mutex> lock(mutex_);
+        while (!segments_.empty()) drop_segment();
+    }
+
+    /**
+     * @brief Pushes an item to the back, spilling it to disk if memory is full
+     * @return false if the queue is closed, or if the item would have to
+     *         spill but serializes to 4GB or more
+     * @note Blocks only while the spill budget is used up or spilling failed
+     */
+    template<typename U>
+    bool push_back(U&& item) {
+        return push(std::forward<U>(item));
+    }
+
+    template<typename Rep, typename Period>
+    bool try_push_back(const T& item, const std::chrono::duration<Rep, Period>& timeout) {
+        return push(item, detail::deadline_after(timeout));
+    }
+
+    template<typename Rep, typename Period>
+    bool try_push_back(T&& item, const std::chrono::duration<Rep, Period>& timeout) {
+        return push(std::move(item), detail::deadline_after(timeout));
+    }
+
+    /**
+     * @brief Pops the oldest item, from memory or, once memory has drained, from disk
+     * @return std::nullopt once the queue is closed and empty
+     */
+    std::optional<T> pop_front() {
+        return pop();
+    }
+
+    template<typename Rep, typename Period>
+    std::optional<T> try_pop_front(const std::chrono::duration<Rep, Period>& timeout) {
+        return pop(detail::deadline_after(timeout));
+    }
+
+    void close() {
+        {
+            std::lock_guard<detail::Mutex> lock(mutex_);
+            if (closed_) return;
+            closed_ = true;
+        }
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+    bool is_closed() const {
+        std::lock_guard<detail::Mutex> lock(mutex_);
+        return closed_;
+    }
+
+    /// Items in memory plus items spilled to disk
+    size_t size() const {
+        std::lock_guard<detail::Mutex> lock(mutex_);
+        return memory_.size() + static_cast<size_t>(stats_.spilled_items);
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    /// Number of items held in memory before pushes spill
+    size_t capacity() const {
+        return capacity_;
+    }
+
+    SpillStats spill_stats() const {
+        std::lock_guard<detail::Mutex> lock(mutex_);
+        return stats_;
+    }
+
+private:
+    /// One mapped segment file; records are a 4-byte length followed by the bytes
+    struct Segment {
+        std::string path;
+        unsigned char* data;
+        size_t size;
+        size_t write_offset;
+        size_t read_offset;
+    };
+
+    using Deadline = detail::Deadline;
+
+    static uint64_t next_instance() {
+        static std::atomic<uint64_t> instances{0};
+        return instances.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    template<typename U>
+    bool push(U&& item, std::optional<Deadline> deadline = std::nullopt) {
+        std::unique_lock<detail::Mutex> lock(mutex_);
+        for (;;) {
+            if (!detail::wait_until_deadline(lock, not_full_, [this] {
+                return closed_ || fits_in_memory() ||
+                       (!spill_blocked_ && stats_.spilled_bytes < options_.max_spill_bytes);
+            }, deadline)) {
+                return false;
+            }
+            if (closed_) return false;
+            if (fits_in_memory()) {
+                memory_.push_back(std::forward<U>(item));
+                break;
+            }
+            const size_t bytes = serializer_.size(item);
+            if (bytes > std::numeric_limits<uint32_t>::max()) return false;   // no length prefix for it
+            if (spill(item, bytes)) break;
+            // Could not create a segment: block like AsyncDeque until the spill drains
+        }
+        lock.unlock();
+        not_empty_.notify_one();
+        return true;
+    }
+
+    std::optional<T> pop(std::optional<Deadline> deadline = std::nullopt) {
+        std::optional<T> item;
+        std::unique_lock<detail::Mutex> lock(mutex_);
+        if (!detail::wait_until_deadline(lock, not_empty_, [this] {
+                return closed_ || !memory_.empty();
+            }, deadline) || memory_.empty()) {
+            return item;
+        }
+        item.emplace(std::move(memory_.front()));
+        memory_.pop_front();
+        if (stats_.spilled_items != 0) memory_.push_back(unspill());
+        // Nothing is on disk, so a failed segment no longer holds up the next overflow
+        const bool unblocked = spill_blocked_ && stats_.spilled_items == 0;
+        if (unblocked) spill_blocked_ = false;
+        lock.unlock();
+        if (unblocked) {
+            not_full_.notify_all();
+        } else {
+            not_full_.notify_one();
+        }
+        return item;
+    }
+
+    /// A push may go to memory: there is room, and nothing older is on disk
+    bool fits_in_memory() const {
+        return stats_.spilled_items == 0 && memory_.size() < capacity_;
+    }
+
+    /// Appends @p item, of @p bytes serialized, to the last segment, opening a new one if it does not fit
+    bool spill(const T& item, size_t bytes) {
+        const size_t record = sizeof(uint32_t) + bytes;
+        if (segments_.empty() || segments_.back().size - segments_.back().write_offset < record) {
+            if (!open_segment(record > options_.segment_bytes ? record : options_.segment_bytes)) {
+                ++stats_.spill_failures;
+                spill_blocked_ = true;
+                return false;
+            }
+        }
+        Segment& segment = segments_.back();
+        const uint32_t length = static_cast<uint32_t>(bytes);
+        std::memcpy(segment.data + segment.write_offset, &length, sizeof(length));
+        serializer_.write(item, segment.data + segment.write_offset + sizeof(length));
+        segment.write_offset += record;
+        ++stats_.spilled_items;
+        ++stats_.total_spilled;
+        stats_.spilled_bytes += record;
+        return true;
+    }
+
+    /// Reads the oldest spilled item, deleting its segment once it is used up
+    T unspill() {
+        Segment& segment = segments_.front();
+        uint32_t length;
+        std::memcpy(&length, segment.data + segment.read_offset, sizeof(length));
+        T item = serializer_.read(segment.data + segment.read_offset + sizeof(length), length);
+        segment.read_offset += sizeof(length) + length;
+        --stats_.spilled_items;
+        stats_.spilled_bytes -= sizeof(length) + length;
+        if (segment.read_offset == segment.write_offset &&
+            (segments_.size() > 1 || stats_.spilled_items == 0)) {
+            drop_segment();
+        }
+        return item;
+    }
+
+    bool open_segment(size_t size) {
+        const std::string path = prefix_ + std::to_string(next_segment_++) + ".seg";
+        const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (fd < 0) return false;
+        // Allocate the blocks now: a full disk fails here instead of raising
+        // SIGBUS on a later store into the mapping.
+        void* data = MAP_FAILED;
+#if defined(__linux__)
+        const bool allocated = ::posix_fallocate(fd, 0, static_cast<off_t>(size)) == 0;
+#else
+        const bool allocated = ::ftruncate(fd, static_cast<off_t>(size)) == 0;
+#endif
+        if (allocated) {
+            data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            ::unlink(path.c_str());
+            return false;
+        }
+        segments_.push_back(Segment{path, static_cast<unsigned char*>(data), size, 0, 0});
+        ++stats_.segments;
+        return true;
+    }
+
+    void drop_segment() {
+        const Segment& segment = segments_.front();
+        ::munmap(segment.data, segment.size);
+        ::unlink(segment.path.c_str());
+        segments_.pop_front();
+        --stats_.segments;
+    }
+
+    mutable detail::Mutex mutex_;
+    detail::ConditionVariable not_empty_;
+    detail::ConditionVariable not_full_;
+    std::deque<T> memory_;
+    std::deque<Segment> segments_;   ///< Oldest (being read) first, newest (being written) last
+    SpillStats stats_;
+    bool closed_ = false;
+    bool spill_blocked_ = false;     ///< A segment could not be created; cleared by a pop with nothing on disk
+    uint64_t next_segment_ = 0;
+    const size_t capacity_;
+    const SpillOptions options_;
+    Serializer serializer_;
+    const std::string prefix_;
+};
+
+} // namespace async_deque
@@ -0,0 +1,406 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+/**
+ * @file stats.hpp
+ * @brief Counters, histograms and the statistics snapshot exposed by AsyncDeque
+ *
+ * @details Everything in here is updated with relaxed atomics, so a snapshot
+ * can be taken at any time without acquiring the queue's mutex. Individual
+ * fields of a snapshot are each exact, but they are not read atomically with
+ * respect to one another.
+ */
+
+namespace async_deque {
+
+namespace detail {
+
+constexpr size_t cache_line_size = 64;
+
+inline uint64_t steady_now_ns() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+/**
+ * @brief Counter whose writers are already serialized by a lock
+ *
+ * Only the readers are concurrent, so a relaxed load/store pair is enough
+ * and no read-modify-write instruction is needed.
+ */
+class LockedCounter {
+public:
+    void add(uint64_t n = 1) {
+        value_.store(value_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    uint64_t load() const {
+        return value_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> value_{0};
+};
+
+} // namespace detail
+
+/**
+ * @brief Point-in-time copy of a LogLinearHistogram
+ */
+struct HistogramSnapshot {
+    unsigned precision = 0;         ///< Sub-bucket bits of the source histogram
+    std::vector<uint64_t> counts;   ///< Per-bucket counts
+    uint64_t count = 0;             ///< Number of recorded values
+    uint64_t sum = 0;               ///< Sum of recorded values
+    uint64_t max = 0;               ///< Largest recorded value
+
+    /// Smallest value that falls into bucket @p index
+    uint64_t bucket_lower(size_t index) const {
+        const uint64_t linear = uint64_t{1} << precision;
+        if (index < linear) return index;
+        const unsigned shift = static_cast<unsigned>(index >> precision) - 1;
+        return (linear + (index & (linear - 1))) << shift;
+    }
+
+    /// Largest value that falls into bucket @p index
+    uint64_t bucket_upper(size_t index) const {
+        const uint64_t linear = uint64_t{1} << precision;
+        if (index < linear) return index;
+        const unsigned shift = static_cast<unsigned>(index >> precision) - 1;
+        return bucket_lower(index) + (uint64_t{1} << shift) - 1;
+    }
+
+    /**
+     * @brief Value at quantile @p q (0.0 - 1.0), by the nearest-rank method
+     *
+     * The value reported is that of the ceil(q * count)-th smallest sample
+     * (at least the first), so the p50 of 100 samples is the 50th.
+     *
+     * @return Upper bound of the bucket holding the quantile, capped at max
+     *         (the open-ended last bucket reports max); 0 if nothing was recorded
+     */
+    uint64_t percentile(double q) const {
+        if (count == 0) return 0;
+        if (q <= 0.0) q = 0.0;
+        if (q >= 1.0) return max;
+        // Shaved by a relative 1e-12 so that 0.07 * 100 == 7.000000000000001 ranks as 7
+        const double exact = q * static_cast<double>(count);
+        uint64_t rank = static_cast<uint64_t>(std::ceil(exact * (1.0 - 1e-12)));
+        if (rank < 1) rank = 1;
+        if (rank > count) rank = count;
+        uint64_t seen = 0;
+        for (size_t i = 0; i + 1 < counts.size(); ++i) {
+            seen += counts[i];
+            if (seen >= rank) {
+                const uint64_t upper = bucket_upper(i);
+                return upper < max ? upper : max;
+            }
+        }
+        return max;
+    }
+
+    double mean() const {
+        return count == 0 ? 0.0 : static_cast<double>(sum) / static_cast<double>(count);
+    }
+};
+
+/**
+ * @brief Lock-free log-linear histogram of non-negative integers
+ *
+ * Values below 2^Precision are counted exactly; above that each power of two
+ * is split into 2^Precision equal sub-buckets, bounding the relative error
+ * of any reported value by 2^-Precision. Values of 2^MaxBits and above are
+ * counted in the last bucket (max() is still exact).
+ *
+ * @tparam Precision Number of sub-bucket bits per power of two
+ * @tparam MaxBits Number of value bits covered by distinct buckets
+ */
+template<unsigned Precision = 3, unsigned MaxBits = 40>
+class LogLinearHistogram {
+    static_assert(Precision >= 1 && Precision < MaxBits && MaxBits < 64,
+                  "invalid histogram geometry");
+
+public:
+    static constexpr size_t bucket_count = size_t{MaxBits - Precision + 1} << Precision;
+
+    static size_t bucket_index(uint64_t value) {
+        constexpr uint64_t linear = uint64_t{1} << Precision;
+        if (value < linear) return static_cast<size_t>(value);
+        const unsigned msb = 63u - static_cast<unsigned>(count_leading_zeros(value));
+        if (msb >= MaxBits) return bucket_count - 1;
+        const unsigned shift = msb - Precision;
+        return (size_t{shift + 1} << Precision) + static_cast<size_t>((value >> shift) - linear);
+    }
+
+    void record(uint64_t value) {
+        buckets_[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+        uint64_t seen = max_.load(std::memory_order_relaxed);
+        while (value > seen &&
+               !max_.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+
+    HistogramSnapshot snapshot() const {
+        HistogramSnapshot snap;
+        snap.precision = Precision;
+        snap.counts.resize(bucket_count);
+        for (size_t i = 0; i < bucket_count; ++i) {
+            snap.counts[i] = buckets_[i].load(std::memory_order_relaxed);
+        }
+        snap.count = count_.load(std::memory_order_relaxed);
+        snap.sum = sum_.load(std::memory_order_relaxed);
+        snap.max = max_.load(std::memory_order_relaxed);
+        return snap;
+    }
+
+private:
+    static int count_leading_zeros(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_clzll(value);
+#else
+        int n = 0;
+        for (uint64_t bit = uint64_t{1} << 63; !(value & bit); bit >>= 1) ++n;
+        return n;
+#endif
+    }
+
+    std::array<std::atomic<uint64_t>, bucket_count> buckets_{};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> max_{0};
+};
+
+namespace detail {
+
+/**
+ * @brief LogLinearHistogram whose buckets are allocated by the first record()
+ *
+ * Like LockedCounter, its writers must be serialized by a lock; snapshot()
+ * may run concurrently. Until something is recorded it is one pointer wide.
+ */
+template<unsigned Precision = 3, unsigned MaxBits = 40>
+class LazyHistogram {
+public:
+    using Histogram = LogLinearHistogram<Precision, MaxBits>;
+
+    void record(uint64_t value) {
+        if (!storage_) {
+            storage_ = std::make_unique<Histogram>();
+            histogram_.store(storage_.get(), std::memory_order_release);
+        }
+        storage_->record(value);
+    }
+
+    HistogramSnapshot snapshot() const {
+        if (const Histogram* histogram = histogram_.load(std::memory_order_acquire)) {
+            return histogram->snapshot();
+        }
+        HistogramSnapshot empty;
+        empty.precision = Precision;
+        empty.counts.resize(Histogram::bucket_count);
+        return empty;
+    }
+
+private:
+    std::atomic<const Histogram*> histogram_{nullptr};   ///< Set once, for readers
+    std::unique_ptr<Histogram> storage_;                   ///< Owns *histogram_
+};
+
+} // namespace detail
+
+/**
+ * @brief Public AsyncDeque calls, and those of its derived queues, that acquire the queue mutex
+ */
+enum class CallSite {
+    push_back,
+    push_front,
+    try_push_back,
+    try_push_front,
+    pop_front,
+    pop_back,
+    try_pop_front,
+    try_pop_back,
+    empty,
+    size,
+    is_closed,
+    close,
+    snapshot,
+    restore,
+    drain_to_fd,
+    try_drain_to_fd,
+    count_  ///< Number of call sites, not a call site
+};
+
+inline const char* call_site_name(CallSite site) {
+    static const char* const names[] = {
+        "push_back", "push_front", "try_push_back", "try_push_front",
+        "pop_front", "pop_back", "try_pop_front", "try_pop_back",
+        "empty", "size", "is_closed", "close", "snapshot", "restore",
+        "drain_to_fd", "try_drain_to_fd",
+    };
+    static_assert(sizeof(names) / sizeof(names[0]) == static_cast<size_t>(CallSite::count_),
+                  "call site names out of sync");
+    return names[static_cast<size_t>(site)];
+}
+
+/**
+ * @brief Lock profile of one call site
+ *
+ * Hold time covers the whole call, excluding the time spent blocked on the
+ * condition variable (during which the mutex is released).
+ */
+struct LockSiteStats {
+    CallSite site = CallSite::count_;   ///< Call site described
+    uint64_t acquisitions = 0;          ///< Times the call acquired the mutex
+    uint64_t contentions = 0;           ///< Acquisitions that found the mutex already held
+    HistogramSnapshot wait;             ///< Time spent acquiring the mutex, contended acquisitions only
+    HistogramSnapshot hold;             ///< Time the mutex was held, per call
+};
+
+/**
+ * @brief Snapshot of the statistics of one AsyncDeque
+ *
+ * Times are in nanoseconds. "Blocked" means waiting on the condition variable
+ * for space (producers) or for an item (consumers); a call that finds the
+ * queue ready does not count as blocked.
+ */
+struct DequeStats {
+    uint64_t pushes = 0;                ///< Successful pushes at either end
+    uint64_t pops = 0;                  ///< Successful pops at either end
+    uint64_t push_timeouts = 0;         ///< try_push_* calls that timed out
+    uint64_t pop_timeouts = 0;          ///< try_pop_* calls that timed out
+    uint64_t rejected_pushes = 0;       ///< Pushes refused because the queue was closed
+    size_t depth = 0;                   ///< Number of queued items
+    size_t high_water = 0;              ///< Largest depth observed so far
+    uint64_t producer_blocks = 0;       ///< Number of times a producer had to wait for space
+    uint64_t consumer_blocks = 0;       ///< Number of times a consumer had to wait for an item
+    uint64_t producer_blocked_ns = 0;   ///< Total time producers spent waiting for space
+    uint64_t consumer_blocked_ns = 0;   ///< Total time consumers spent waiting for an item
+    uint64_t notifies = 0;              ///< Condition variable notifications issued
+    uint64_t producer_wakeups = 0;      ///< Times a blocked producer was woken up (timeouts excluded)
+    uint64_t consumer_wakeups = 0;      ///< Times a blocked consumer was woken up (timeouts excluded)
+    uint64_t producer_wasted_wakeups = 0;  ///< Producer wakeups that found no space and went back to sleep
+    uint64_t consumer_wasted_wakeups = 0;  ///< Consumer wakeups that found no item and went back to sleep
+    uint64_t spurious_wakeups = 0;      ///< Wakeups with no notification issued since the wait began
+    HistogramSnapshot wakeup_latency;   ///< Time from the latest notification to the woken thread holding the mutex
+    uint64_t lock_acquisitions = 0;     ///< Acquisitions of the queue mutex by public calls
+    uint64_t lock_contentions = 0;      ///< Acquisitions that found the mutex already held
+    HistogramSnapshot lock_wait;        ///< Time spent acquiring a contended mutex
+    HistogramSnapshot producer_wait;    ///< Duration of each producer blocking episode
+    HistogramSnapshot consumer_wait;    ///< Duration of each consumer blocking episode
+    std::vector<LockSiteStats> lock_sites;  ///< Per call site profile; empty unless lock profiling is enabled
+};
+
+namespace detail {
+
+/**
+ * @brief Live counters behind DequeStats
+ *
+ * Every field is written with the queue mutex held. The histograms are
+ * allocated when they first record, so a queue that never blocks or
+ * contends carries only the counters.
+ */
+struct DequeMetrics {
+    LockedCounter pushes;
+    LockedCounter pops;
+    LockedCounter push_timeouts;
+    LockedCounter pop_timeouts;
+    LockedCounter rejected_pushes;
+    LockedCounter lock_acquisitions;
+    LockedCounter notifies;
+    LockedCounter producer_wakeups;
+    LockedCounter consumer_wakeups;
+    LockedCounter producer_wasted_wakeups;
+    LockedCounter consumer_wasted_wakeups;
+    LockedCounter spurious_wakeups;
+    std::atomic<size_t> depth{0};
+    std::atomic<size_t> high_water{0};
+    LockedCounter lock_contentions;
+    LazyHistogram<> lock_wait;
+    LazyHistogram<> producer_wait;
+    LazyHistogram<> consumer_wait;
+    LazyHistogram<> wakeup_latency;
+
+    /// Publishes the new depth; must be called with the queue mutex held
+    void set_depth(size_t value) {
+        depth.store(value, std::memory_order_relaxed);
+        if (value > high_water.load(std::memory_order_relaxed)) {
+            high_water.store(value, std::memory_order_relaxed);
+        }
+    }
+
+    DequeStats snapshot() const {
+        DequeStats stats;
+        stats.pushes = pushes.load();
+        stats.pops = pops.load();
+        stats.push_timeouts = push_timeouts.load();
+        stats.pop_timeouts = pop_timeouts.load();
+        stats.rejected_pushes = rejected_pushes.load();
+        stats.depth = depth.load(std::memory_order_relaxed);
+        stats.high_water = high_water.load(std::memory_order_relaxed);
+        stats.notifies = notifies.load();
+        stats.producer_wakeups = producer_wakeups.load();
+        stats.consumer_wakeups = consumer_wakeups.load();
+        stats.producer_wasted_wakeups = producer_wasted_wakeups.load();
+        stats.consumer_wasted_wakeups = consumer_wasted_wakeups.load();
+        stats.spurious_wakeups = spurious_wakeups.load();
+        stats.wakeup_latency = wakeup_latency.snapshot();
+        stats.lock_acquisitions = lock_acquisitions.load();
+        stats.lock_contentions = lock_contentions.load();
+        stats.lock_wait = lock_wait.snapshot();
+        stats.producer_wait = producer_wait.snapshot();
+        stats.consumer_wait = consumer_wait.snapshot();
+        stats.producer_blocks = stats.producer_wait.count;
+        stats.consumer_blocks = stats.consumer_wait.count;
+        stats.producer_blocked_ns = stats.producer_wait.sum;
+        stats.consumer_blocked_ns = stats.consumer_wait.sum;
+        return stats;
+    }
+};
+
+/**
+ * @brief Per call site lock timings, allocated when lock profiling is enabled
+ */
+struct LockProfile {
+    struct Site {
+        LogLinearHistogram<> wait;
+        LogLinearHistogram<> hold;
+    };
+    std::array<Site, static_cast<size_t>(CallSite::count_)> sites;
+
+    Site& operator[](CallSite site) {
+        return sites[static_cast<size_t>(site)];
+    }
+
+    std::vector<LockSiteStats> snapshot() const {
+        std::vector<LockSiteStats> result;
+        result.reserve(sites.size());
+        for (size_t i = 0; i < sites.size(); ++i) {
+            LockSiteStats site;
+            site.site = static_cast<CallSite>(i);
+            site.wait = sites[i].wait.snapshot();
+            site.hold = sites[i].hold.snapshot();
+            site.acquisitions = site.hold.count;
+            site.contentions = site.wait.count;
+            result.push_back(std::move(site));
+        }
+        return result;
+    }
+};
+
+} // namespace detail
+
+} // namespace async_deque
@@ -0,0 +1,75 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+
+/**
+ * @file sync.hpp
+ * @brief Mutex and condition variable types used by AsyncDeque
+ *
+ * @details AsyncDeque takes its mutex and condition variable from the policy
+ * named by the ASYNC_DEQUE_SYNC macro, which defaults to std::mutex and
+ * std::condition_variable. A test build can point it at a struct with
+ * `mutex` and `condition_variable` members offering the same interface, for
+ * example instrumented primitives driven by a deterministic scheduler:
+ *
+ * @code{.cpp}
+ * // Compiled with -DASYNC_DEQUE_SYNC=::model::Sync
+ * #include "model/model.hpp"   // defines model::Sync
+ * #include <async_deque/async_deque.hpp>
+ * @endcode
+ *
+ * The policy must be the same in every translation unit of a program.
+ */
+
+namespace async_deque {
+namespace detail {
+
+/// Default synchronization policy
+struct StdSync {
+    using mutex = std::mutex;
+    using condition_variable = std::condition_variable;
+};
+
+} // namespace detail
+} // namespace async_deque
+
+#ifndef ASYNC_DEQUE_SYNC
+#define ASYNC_DEQUE_SYNC ::async_deque::detail::StdSync
+#endif
+
+namespace async_deque {
+namespace detail {
+
+using Mutex = ASYNC_DEQUE_SYNC::mutex;
+using ConditionVariable = ASYNC_DEQUE_SYNC::condition_variable;
+
+using Deadline = std::chrono::steady_clock::time_point;
+
+/// Deadline @p timeout from now, rounded up to the clock's resolution
+template<typename Rep, typename Period>
+Deadline deadline_after(const std::chrono::duration<Rep, Period>& timeout) {
+    return std::chrono::steady_clock::now() +
+           std::chrono::ceil<std::chrono::steady_clock::duration>(timeout);
+}
+
+/**
+ * @brief Waits on @p cv until @p pred holds, or until @p deadline if there is one
+ * @return The final value of @p pred
+ */
+template<typename Pred>
+bool wait_until_deadline(std::unique_lock<Mutex>& lock, ConditionVariable& cv, Pred pred,
+                         const std::optional<Deadline>& deadline) {
+    while (!pred()) {
+        if (!deadline) {
+            cv.wait(lock);
+        } else if (cv.wait_until(lock, *deadline) == std::cv_status::timeout) {
+            return pred();
+        }
+    }
+    return true;
+}
+
+} // namespace detail
+} // namespace async_deque
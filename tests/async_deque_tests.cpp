@@ -4,6 +4,8 @@
 #include <vector>
 #include <atomic>
 #include <chrono>
+#include <cstring>
+#include <string>
 
 using namespace async_deque;
 using namespace std::chrono_literals;
@@ -291,6 +293,45 @@ TEST_F(AsyncDequeTest, ConcurrentPushPop) {
     EXPECT_EQ(sum, expected_sum);
 }
 
+TEST_F(AsyncDequeTest, ConcurrentPushPopCapacityOne) {
+    // With one slot, producers and consumers are blocked at the same time all
+    // the time. When both waited on one condition variable, a pop's
+    // notify_one() could wake another consumer while a producer slept next to
+    // the free slot, and this workload stalled within the first thousand items.
+    AsyncDeque<int> deque(1);
+    std::atomic<int> received{0};
+    constexpr int num_threads = 4;
+    constexpr int items_per_producer = 2000;
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; ++i) {
+        threads.emplace_back([&deque]() {
+            for (int j = 0; j < items_per_producer; ++j) {
+                EXPECT_TRUE(deque.push_back(j));
+            }
+        });
+        threads.emplace_back([&deque, &received]() {
+            while (deque.pop_back().has_value()) {
+                received++;
+            }
+        });
+    }
+
+    // A lost wakeup stalls every thread; close() then releases them, so the
+    // test fails instead of hanging
+    const auto deadline = std::chrono::steady_clock::now() + 30s;
+    while (received < num_threads * items_per_producer &&
+           std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(1ms);
+    }
+    const int received_before_close = received;
+    deque.close();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(received_before_close, num_threads * items_per_producer) << "stalled: lost wakeup";
+}
+
 // Extension mechanism tests
 class TestExtension : public AsyncDeque<int> {
 public:
@@ -299,11 +340,13 @@ public:
     int push_count() const { return push_count_; }
     int pop_count() const { return pop_count_; }
     bool close_called() const { return close_called_; }
+    bool push_hook_held_lock() const { return push_hook_held_lock_; }
     
 protected:
     void on_push_back(const int& item) override {
         push_count_++;
         last_pushed_ = item;
+        push_hook_held_lock_ = lock_held();
     }
     
     void on_push_front(const int& item) override {
@@ -331,6 +374,7 @@ private:
     std::atomic<int> last_pushed_{0};
     std::atomic<int> last_popped_{0};
     std::atomic<bool> close_called_{false};
+    std::atomic<bool> push_hook_held_lock_{false};
 };
 
 TEST_F(AsyncDequeTest, ExtensionHooks) {
@@ -350,3 +394,207 @@ TEST_F(AsyncDequeTest, ExtensionHooks) {
     EXPECT_TRUE(deque.close_called());
 }
 
+
+// Deferred hook tests
+class DeferredExtension : public AsyncDeque<int> {
+public:
+    explicit DeferredExtension(size_t capacity)
+        : AsyncDeque<int>(capacity, HookMode::deferred) {}
+
+    int pushed_sum() const { return pushed_sum_; }
+    int popped_sum() const { return popped_sum_; }
+    bool hooks_saw_lock() const { return hooks_saw_lock_; }
+    bool close_called() const { return close_called_; }
+
+protected:
+    void on_push_back(const int& item) override { record(pushed_sum_, item); }
+    void on_push_front(const int& item) override { record(pushed_sum_, item); }
+    void on_pop_back(const int& item) override { record(popped_sum_, item); }
+    void on_pop_front(const int& item) override { record(popped_sum_, item); }
+
+    void on_close() override {
+        check_unlocked();
+        close_called_ = true;
+    }
+
+private:
+    void record(std::atomic<int>& sum, int item) {
+        check_unlocked();
+        sum += item;
+    }
+
+    void check_unlocked() {
+        if (lock_held()) {
+            hooks_saw_lock_ = true;
+        }
+    }
+
+    std::atomic<int> pushed_sum_{0};
+    std::atomic<int> popped_sum_{0};
+    std::atomic<bool> hooks_saw_lock_{false};
+    std::atomic<bool> close_called_{false};
+};
+
+TEST_F(AsyncDequeTest, DeferredHooksRunOutsideLock) {
+    DeferredExtension deque(5);
+    EXPECT_EQ(deque.hook_mode(), HookMode::deferred);
+
+    int lvalue = 1;
+    EXPECT_TRUE(deque.push_back(lvalue));
+    EXPECT_TRUE(deque.push_front(2));
+    EXPECT_TRUE(deque.try_push_back(4, 10ms));
+    EXPECT_EQ(deque.pushed_sum(), 7);
+
+    EXPECT_TRUE(deque.pop_back().has_value());
+    EXPECT_TRUE(deque.try_pop_front(10ms).has_value());
+    EXPECT_EQ(deque.popped_sum(), 6);
+
+    deque.close();
+    EXPECT_TRUE(deque.close_called());
+    EXPECT_FALSE(deque.hooks_saw_lock());
+}
+
+TEST_F(AsyncDequeTest, DeferredHooksSeeMovedItems) {
+    class Recorder : public AsyncDeque<TrackedItem> {
+    public:
+        Recorder() : AsyncDeque<TrackedItem>(5, HookMode::deferred) {}
+        int last_pushed = 0;
+    protected:
+        void on_push_back(const TrackedItem& item) override {
+            last_pushed = item.value();
+        }
+    } deque;
+
+    EXPECT_TRUE(deque.push_back(TrackedItem(42)));
+    EXPECT_EQ(deque.last_pushed, 42);
+
+    auto val = deque.pop_front();
+    ASSERT_TRUE(val.has_value());
+    EXPECT_EQ(val->value(), 42);
+}
+
+// Snapshot and restore tests
+namespace {
+
+/// Writer and reader over an in-memory byte stream
+struct SnapshotBuffer {
+    std::string bytes;
+    size_t read_offset = 0;
+    size_t writes = 0;
+
+    auto writer() {
+        return [this](const void* data, size_t size) {
+            bytes.append(static_cast<const char*>(data), size);
+            ++writes;
+            return true;
+        };
+    }
+
+    auto reader() {
+        return [this](void* data, size_t size) {
+            if (bytes.size() - read_offset < size) return false;
+            std::memcpy(data, bytes.data() + read_offset, size);
+            read_offset += size;
+            return true;
+        };
+    }
+};
+
+struct StringSerializer {
+    size_t size(const std::string& item) const { return item.size(); }
+    void write(const std::string& item, unsigned char* out) const {
+        std::memcpy(out, item.data(), item.size());
+    }
+    std::string read(const unsigned char* data, size_t size) const {
+        return std::string(reinterpret_cast<const char*>(data), size);
+    }
+};
+
+} // namespace
+
+TEST_F(AsyncDequeTest, SnapshotRestoresTriviallyCopyableItems) {
+    AsyncDeque<uint64_t> source;
+    for (uint64_t i = 1; i <= 10000; ++i) source.push_back(i);
+    source.push_front(uint64_t{0});
+    source.close();
+
+    SnapshotBuffer buffer;
+    ASSERT_TRUE(source.snapshot(buffer.writer()));
+    EXPECT_EQ(buffer.bytes.size(), sizeof(detail::SnapshotHeader) + 10001 * sizeof(uint64_t));
+    EXPECT_LT(buffer.writes, 200u);   // one write per storage block, not per item
+    EXPECT_EQ(source.size(), 10001u);
+
+    AsyncDeque<uint64_t> target;
+    ASSERT_TRUE(target.restore(buffer.reader()));
+    EXPECT_EQ(target.stats().pushes, 10001u);
+    for (uint64_t i = 0; i <= 10000; ++i) ASSERT_EQ(target.pop_front(), i);
+    EXPECT_TRUE(target.empty());
+}
+
+TEST_F(AsyncDequeTest, SnapshotUsesSerializerForOtherTypes) {
+    AsyncDeque<std::string> source;
+    source.push_back(std::string("first"));
+    source.push_back(std::string());
+    source.push_back(std::string(100000, 'x'));   // larger than the write buffer
+
+    SnapshotBuffer buffer;
+    ASSERT_TRUE(source.snapshot(buffer.writer(), StringSerializer()));
+
+    AsyncDeque<std::string> target(10);
+    target.push_back(std::string("already queued"));
+    ASSERT_TRUE(target.restore(buffer.reader(), StringSerializer()));
+    EXPECT_EQ(*target.pop_front(), "already queued");
+    EXPECT_EQ(*target.pop_front(), "first");
+    EXPECT_EQ(*target.pop_front(), "");
+    EXPECT_EQ(target.pop_front()->size(), 100000u);
+}
+
+TEST_F(AsyncDequeTest, RestoreRejectsMismatchedOrOversizedSnapshots) {
+    AsyncDeque<uint32_t> source;
+    for (uint32_t i = 0; i < 5; ++i) source.push_back(i);
+    SnapshotBuffer buffer;
+    ASSERT_TRUE(source.snapshot(buffer.writer()));
+
+    AsyncDeque<uint64_t> wrong_type;
+    EXPECT_FALSE(wrong_type.restore(SnapshotBuffer{buffer.bytes}.reader()));
+
+    AsyncDeque<uint32_t> too_small(4);
+    EXPECT_FALSE(too_small.restore(SnapshotBuffer{buffer.bytes}.reader()));
+    EXPECT_TRUE(too_small.empty());
+
+    SnapshotBuffer truncated{buffer.bytes.substr(0, buffer.bytes.size() - 1)};
+    AsyncDeque<uint32_t> target;
+    EXPECT_FALSE(target.restore(truncated.reader()));
+    EXPECT_TRUE(target.empty());
+
+    target.close();
+    EXPECT_FALSE(target.restore(SnapshotBuffer{buffer.bytes}.reader()));
+}
+
+TEST_F(AsyncDequeTest, RestoreRunsPushHooks) {
+    TestExtension source(10);
+    for (int i = 1; i <= 3; ++i) source.push_back(i);
+    SnapshotBuffer buffer;
+    ASSERT_TRUE(source.snapshot(buffer.writer()));
+
+    TestExtension target(10);
+    ASSERT_TRUE(target.restore(buffer.reader()));
+    EXPECT_EQ(target.push_count(), 3);
+    EXPECT_TRUE(target.push_hook_held_lock());
+}
+
+TEST_F(AsyncDequeTest, DeferredRestoreRunsPushHooksOutsideLock) {
+    AsyncDeque<int> source;
+    for (int i = 1; i <= 3; ++i) source.push_back(i);
+    SnapshotBuffer buffer;
+    ASSERT_TRUE(source.snapshot(buffer.writer()));
+
+    DeferredExtension target(10);
+    ASSERT_TRUE(target.restore(buffer.reader()));
+    EXPECT_EQ(target.pushed_sum(), 6);
+    EXPECT_FALSE(target.hooks_saw_lock());
+
+    DeferredExtension too_small(2);
+    EXPECT_FALSE(too_small.restore(SnapshotBuffer{buffer.bytes}.reader()));
+    EXPECT_EQ(too_small.pushed_sum(), 0);
+}
@@ -0,0 +1,169 @@
+#include <gtest/gtest.h>
+#include <async_deque/byte_queue.hpp>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+
+using namespace async_deque;
+using namespace std::chrono_literals;
+
+namespace {
+
+bool push_string(ByteQueue& queue, const std::string& text) {
+    return queue.push(text.data(), text.size());
+}
+
+std::string pop_string(ByteQueue& queue) {
+    auto record = queue.try_read(100ms);
+    if (!record) return "<none>";
+    std::string text(reinterpret_cast<const char*>(record->data), record->size);
+    queue.release();
+    return text;
+}
+
+} // namespace
+
+TEST(ByteQueueTest, RecordsComeOutInOrder) {
+    ByteQueue queue(256);
+    EXPECT_TRUE(push_string(queue, "alpha"));
+    EXPECT_TRUE(push_string(queue, ""));
+    EXPECT_TRUE(push_string(queue, "gamma"));
+    EXPECT_EQ(queue.size(), 3u);
+    EXPECT_EQ(queue.bytes_used(), 3 * ByteQueue::header_bytes + 10);
+
+    EXPECT_EQ(pop_string(queue), "alpha");
+    EXPECT_EQ(pop_string(queue), "");
+    EXPECT_EQ(pop_string(queue), "gamma");
+    EXPECT_TRUE(queue.empty());
+    EXPECT_EQ(queue.bytes_used(), 0u);
+}
+
+TEST(ByteQueueTest, ReserveInPlaceAndCommitShorter) {
+    ByteQueue queue(64);
+    unsigned char* out = queue.reserve(32);
+    ASSERT_NE(out, nullptr);
+    std::memcpy(out, "frame", 5);
+    queue.commit(5);
+
+    auto record = queue.read();
+    ASSERT_TRUE(record);
+    EXPECT_EQ(record->data, out);   // the consumer sees the producer's bytes in place
+    EXPECT_EQ(record->size, 5u);
+    queue.release();
+}
+
+TEST(ByteQueueTest, RecordsStayContiguousAcrossTheWrap) {
+    ByteQueue queue(40);   // four 10-byte records
+    for (char c = 'a'; c < 'd'; ++c) ASSERT_TRUE(push_string(queue, std::string(6, c)));
+    EXPECT_EQ(pop_string(queue), "aaaaaa");
+    EXPECT_EQ(pop_string(queue), "bbbbbb");
+
+    // 10 bytes left at the end and 20 at the start: a 14-byte record goes to the start
+    unsigned char* out = queue.try_reserve(10, 10ms);
+    ASSERT_NE(out, nullptr);
+    std::memset(out, 'd', 10);
+    queue.commit(10);
+    ASSERT_TRUE(push_string(queue, "ee"));   // 6 more bytes fill the start up to region A
+    EXPECT_EQ(queue.try_reserve(0, 10ms), nullptr);
+
+    EXPECT_EQ(pop_string(queue), "cccccc");
+    EXPECT_EQ(pop_string(queue), std::string(10, 'd'));
+    EXPECT_EQ(pop_string(queue), "ee");
+    EXPECT_TRUE(queue.empty());
+    EXPECT_NE(queue.try_reserve(queue.max_record_size(), 10ms), nullptr);   // back to one region
+    queue.cancel();
+}
+
+TEST(ByteQueueTest, OversizedRecordIsRejected) {
+    ByteQueue queue(16);
+    EXPECT_EQ(queue.max_record_size(), 12u);
+    EXPECT_EQ(queue.reserve(13), nullptr);
+    EXPECT_TRUE(push_string(queue, std::string(12, 'x')));
+}
+
+TEST(ByteQueueTest, OneReservationAtATime) {
+    ByteQueue queue(64);
+    ASSERT_NE(queue.reserve(4), nullptr);
+    EXPECT_EQ(queue.try_reserve(4, 10ms), nullptr);
+    queue.cancel();
+    EXPECT_TRUE(queue.empty());
+    EXPECT_NE(queue.try_reserve(4, 10ms), nullptr);
+    queue.commit(0);
+    EXPECT_EQ(queue.size(), 1u);
+}
+
+TEST(ByteQueueTest, CommitLongerThanReservedCancels) {
+    ByteQueue queue(64);
+    ASSERT_NE(queue.reserve(4), nullptr);
+    EXPECT_FALSE(queue.commit(5));
+    EXPECT_TRUE(queue.empty());
+    EXPECT_FALSE(queue.commit(0));   // nothing reserved any more
+
+    // The reservation was released, so producers are not stuck behind it
+    ASSERT_NE(queue.try_reserve(4, 10ms), nullptr);
+    EXPECT_TRUE(queue.commit(4));
+    EXPECT_EQ(queue.size(), 1u);
+}
+
+TEST(ByteQueueTest, CloseDrainsThenEnds) {
+    ByteQueue queue(64);
+    EXPECT_FALSE(queue.try_read(10ms).has_value());
+    ASSERT_TRUE(push_string(queue, "last"));
+    queue.close();
+    EXPECT_TRUE(queue.is_closed());
+    EXPECT_EQ(queue.reserve(1), nullptr);
+    EXPECT_EQ(pop_string(queue), "last");
+    EXPECT_FALSE(queue.read().has_value());
+}
+
+TEST(ByteQueueTest, ProducerBlocksUntilConsumerReleases) {
+    ByteQueue queue(32);
+    ASSERT_TRUE(push_string(queue, std::string(20, 'a')));
+    std::thread consumer([&] {
+        std::this_thread::sleep_for(20ms);
+        EXPECT_EQ(pop_string(queue), std::string(20, 'a'));
+    });
+    const auto start = std::chrono::steady_clock::now();
+    EXPECT_TRUE(push_string(queue, std::string(20, 'b')));
+    EXPECT_GE(std::chrono::steady_clock::now() - start, 10ms);
+    consumer.join();
+    EXPECT_EQ(pop_string(queue), std::string(20, 'b'));
+}
+
+TEST(ByteQueueTest, ConcurrentProducersAndConsumer) {
+    ByteQueue queue(1024);
+    constexpr uint32_t per_producer = 20000;
+    std::vector<std::thread> producers;
+    for (uint32_t p = 0; p < 2; ++p) {
+        producers.emplace_back([&, p] {
+            for (uint32_t i = 0; i < per_producer; ++i) {
+                // Variable length: the sequence number repeated 1..8 times
+                const size_t words = 1 + i % 8;
+                unsigned char* out = queue.reserve(2 * 4 * 8);
+                for (size_t w = 0; w < words; ++w) {
+                    std::memcpy(out + 8 * w, &p, 4);
+                    std::memcpy(out + 8 * w + 4, &i, 4);
+                }
+                queue.commit(8 * words);
+            }
+        });
+    }
+    uint32_t next[2] = {0, 0};
+    for (uint32_t n = 0; n < 2 * per_producer; ++n) {
+        auto record = queue.read();
+        ASSERT_TRUE(record);
+        uint32_t p, i;
+        std::memcpy(&p, record->data, 4);
+        std::memcpy(&i, record->data + 4, 4);
+        ASSERT_LT(p, 2u);
+        ASSERT_EQ(i, next[p]);
+        ASSERT_EQ(record->size, 8 * (1 + i % 8));
+        ASSERT_EQ(std::memcmp(record->data, record->data + record->size - 8, 8), 0);
+        ++next[p];
+        queue.release();
+    }
+    for (auto& producer : producers) producer.join();
+    EXPECT_TRUE(queue.empty());
+}
@@ -0,0 +1,112 @@
+#include <gtest/gtest.h>
+#include <async_deque/capture.hpp>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace async_deque;
+
+namespace {
+
+std::string temp_path(const std::string& name) {
+    return ::testing::TempDir() + "async_deque_" + name + ".adqcap";
+}
+
+} // namespace
+
+TEST(CaptureDequeTest, RecordsOperationsInQueueOrder) {
+    const std::string path = temp_path("order");
+    {
+        CaptureDeque<std::string> deque(path, 10);
+        ASSERT_TRUE(deque.capturing());
+        EXPECT_TRUE(deque.push_back("abc"));
+        EXPECT_TRUE(deque.push_front("hello"));
+        EXPECT_EQ(*deque.pop_back(), "abc");
+        EXPECT_EQ(*deque.pop_front(), "hello");
+        deque.close();
+        EXPECT_TRUE(deque.flush());
+        EXPECT_EQ(deque.captured(), 5u);
+    }
+
+    Capture capture;
+    ASSERT_TRUE(read_capture(path, capture));
+    EXPECT_EQ(capture.capacity, 10u);
+    ASSERT_EQ(capture.records.size(), 5u);
+    const std::vector<CaptureKind> kinds = {CaptureKind::push_back, CaptureKind::push_front,
+                                            CaptureKind::pop_back, CaptureKind::pop_front,
+                                            CaptureKind::close};
+    const std::vector<uint32_t> sizes = {3, 5, 3, 5, 0};
+    for (size_t i = 0; i < capture.records.size(); ++i) {
+        EXPECT_EQ(capture.records[i].kind, kinds[i]) << i;
+        EXPECT_EQ(capture.records[i].size, sizes[i]) << i;
+        EXPECT_EQ(capture.records[i].thread, capture.records[0].thread);
+        if (i > 0) {
+            EXPECT_GE(capture.records[i].time_ns, capture.records[i - 1].time_ns);
+        }
+    }
+    std::remove(path.c_str());
+}
+
+TEST(CaptureDequeTest, WritesEveryRecordFromManyThreads) {
+    const std::string path = temp_path("threads");
+    constexpr int per_thread = 5000;
+    {
+        // Small chunks so the writer thread runs many times
+        CaptureDeque<int> deque(path, 64, 100);
+        std::thread producer([&] {
+            for (int i = 0; i < per_thread; ++i) deque.push_back(i);
+        });
+        std::thread consumer([&] {
+            for (int i = 0; i < per_thread; ++i) deque.pop_front();
+        });
+        producer.join();
+        consumer.join();
+    }
+
+    Capture capture;
+    ASSERT_TRUE(read_capture(path, capture));
+    ASSERT_EQ(capture.records.size(), 2u * per_thread + 1);
+    int depth = 0;
+    for (const CaptureRecord& record : capture.records) {
+        if (record.kind == CaptureKind::push_back) ++depth;
+        if (record.kind == CaptureKind::pop_front) --depth;
+        ASSERT_GE(depth, 0);
+        ASSERT_LE(depth, 64);
+        EXPECT_EQ(record.size, record.kind == CaptureKind::close ? 0u : sizeof(int));
+    }
+    EXPECT_EQ(depth, 0);
+    EXPECT_EQ(capture.records.back().kind, CaptureKind::close);
+    EXPECT_NE(capture.records.front().thread, capture.records.back().thread);
+    std::remove(path.c_str());
+}
+
+TEST(CaptureDequeTest, UnwritablePathStillQueues) {
+    CaptureDeque<int> deque("/nonexistent-dir/capture.adqcap");
+    EXPECT_FALSE(deque.capturing());
+    EXPECT_TRUE(deque.push_back(1));
+    EXPECT_EQ(*deque.pop_front(), 1);
+    EXPECT_FALSE(deque.flush());
+}
+
+TEST(CaptureDequeTest, ReadRejectsOtherFilesAndIgnoresTornRecord) {
+    Capture capture;
+    EXPECT_FALSE(read_capture(temp_path("missing"), capture));
+
+    const std::string other = temp_path("other");
+    std::ofstream(other) << "not a capture file, just some text";
+    EXPECT_FALSE(read_capture(other, capture));
+    std::remove(other.c_str());
+
+    const std::string path = temp_path("torn");
+    {
+        CaptureDeque<int> deque(path);
+        deque.push_back(1);
+        deque.push_back(2);
+    }
+    std::ofstream(path, std::ios::binary | std::ios::app) << "partial";
+    ASSERT_TRUE(read_capture(path, capture));
+    EXPECT_EQ(capture.records.size(), 3u);   // two pushes and the close
+    std::remove(path.c_str());
+}
@@ -0,0 +1,207 @@
+#include <gtest/gtest.h>
+#include <async_deque/async_deque.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <utility>
+
+using namespace async_deque;
+using namespace std::chrono_literals;
+
+// Payload owning a heap buffer that counts copies, moves and buffer allocations
+class CountedItem {
+public:
+    static constexpr size_t buffer_size = 4096;
+
+    explicit CountedItem(int value) : buffer_(allocate()), value_(value) {}
+
+    CountedItem(const CountedItem& other) : buffer_(allocate()), value_(other.value_) {
+        std::memcpy(buffer_.get(), other.buffer_.get(), buffer_size);
+        copies_++;
+    }
+
+    CountedItem(CountedItem&& other) noexcept
+        : buffer_(std::move(other.buffer_)), value_(std::exchange(other.value_, 0)) {
+        moves_++;
+    }
+
+    CountedItem& operator=(const CountedItem& other) {
+        if (this != &other) {
+            if (!buffer_) buffer_ = allocate();
+            std::memcpy(buffer_.get(), other.buffer_.get(), buffer_size);
+            value_ = other.value_;
+            copies_++;
+        }
+        return *this;
+    }
+
+    CountedItem& operator=(CountedItem&& other) noexcept {
+        buffer_ = std::move(other.buffer_);
+        value_ = std::exchange(other.value_, 0);
+        moves_++;
+        return *this;
+    }
+
+    int value() const { return value_; }
+
+    struct Counts {
+        int copies;
+        int moves;
+        int allocations;
+
+        bool operator==(const Counts& other) const {
+            return copies == other.copies && moves == other.moves &&
+                   allocations == other.allocations;
+        }
+    };
+
+    static Counts counts() { return {copies_, moves_, allocations_}; }
+
+    static void reset() {
+        copies_ = 0;
+        moves_ = 0;
+        allocations_ = 0;
+    }
+
+private:
+    static std::unique_ptr<char[]> allocate() {
+        allocations_++;
+        return std::make_unique<char[]>(buffer_size);
+    }
+
+    std::unique_ptr<char[]> buffer_;
+    int value_;
+    static inline std::atomic<int> copies_{0};
+    static inline std::atomic<int> moves_{0};
+    static inline std::atomic<int> allocations_{0};
+};
+
+std::ostream& operator<<(std::ostream& out, const CountedItem::Counts& counts) {
+    return out << "{copies=" << counts.copies << ", moves=" << counts.moves
+               << ", allocations=" << counts.allocations << "}";
+}
+
+class CopyMoveTest : public ::testing::Test {
+protected:
+    // Counts of a push followed by reading the popped value into a local
+    template<typename Push, typename Pop>
+    CountedItem::Counts round_trip(AsyncDeque<CountedItem>& deque, Push push, Pop pop) {
+        CountedItem item(7);
+        CountedItem::reset();
+        EXPECT_TRUE(push(deque, item));
+        const CountedItem::Counts pushed = CountedItem::counts();
+        CountedItem::reset();
+        auto popped = pop(deque);
+        EXPECT_TRUE(popped.has_value());
+        if (popped) {
+            EXPECT_EQ(popped->value(), 7);
+        }
+        const CountedItem::Counts after_pop = CountedItem::counts();
+        return {pushed.copies + after_pop.copies, pushed.moves + after_pop.moves,
+                pushed.allocations + after_pop.allocations};
+    }
+
+    AsyncDeque<CountedItem> deque_{10};
+};
+
+constexpr CountedItem::Counts one_copy{1, 1, 1};   // copy in, move out
+constexpr CountedItem::Counts no_copy{0, 2, 0};    // move in, move out
+
+auto pop_front = [](AsyncDeque<CountedItem>& d) { return d.pop_front(); };
+auto pop_back = [](AsyncDeque<CountedItem>& d) { return d.pop_back(); };
+auto try_pop_front = [](AsyncDeque<CountedItem>& d) { return d.try_pop_front(10ms); };
+auto try_pop_back = [](AsyncDeque<CountedItem>& d) { return d.try_pop_back(10ms); };
+
+TEST_F(CopyMoveTest, PushLvalueCopiesOnce) {
+    auto push_back = [](AsyncDeque<CountedItem>& d, CountedItem& item) { return d.push_back(item); };
+    auto push_front = [](AsyncDeque<CountedItem>& d, CountedItem& item) { return d.push_front(item); };
+    EXPECT_EQ(round_trip(deque_, push_back, pop_front), one_copy);
+    EXPECT_EQ(round_trip(deque_, push_front, pop_back), one_copy);
+    EXPECT_EQ(round_trip(deque_, push_back, try_pop_back), one_copy);
+    EXPECT_EQ(round_trip(deque_, push_front, try_pop_front), one_copy);
+}
+
+TEST_F(CopyMoveTest, PushRvalueNeverCopies) {
+    auto push_back = [](AsyncDeque<CountedItem>& d, CountedItem& item) {
+        return d.push_back(std::move(item));
+    };
+    auto push_front = [](AsyncDeque<CountedItem>& d, CountedItem& item) {
+        return d.push_front(std::move(item));
+    };
+    EXPECT_EQ(round_trip(deque_, push_back, pop_front), no_copy);
+    EXPECT_EQ(round_trip(deque_, push_front, pop_back), no_copy);
+    EXPECT_EQ(round_trip(deque_, push_back, try_pop_back), no_copy);
+    EXPECT_EQ(round_trip(deque_, push_front, try_pop_front), no_copy);
+}
+
+TEST_F(CopyMoveTest, TryPushLvalueCopiesOnce) {
+    auto try_push_back = [](AsyncDeque<CountedItem>& d, CountedItem& item) {
+        return d.try_push_back(item, 10ms);
+    };
+    auto try_push_front = [](AsyncDeque<CountedItem>& d, CountedItem& item) {
+        return d.try_push_front(item, 10ms);
+    };
+    EXPECT_EQ(round_trip(deque_, try_push_back, pop_front), one_copy);
+    EXPECT_EQ(round_trip(deque_, try_push_front, try_pop_back), one_copy);
+}
+
+TEST_F(CopyMoveTest, TryPushRvalueNeverCopies) {
+    auto try_push_back = [](AsyncDeque<CountedItem>& d, CountedItem& item) {
+        return d.try_push_back(std::move(item), 10ms);
+    };
+    auto try_push_front = [](AsyncDeque<CountedItem>& d, CountedItem& item) {
+        return d.try_push_front(std::move(item), 10ms);
+    };
+    EXPECT_EQ(round_trip(deque_, try_push_back, pop_front), no_copy);
+    EXPECT_EQ(round_trip(deque_, try_push_front, try_pop_back), no_copy);
+}
+
+TEST_F(CopyMoveTest, TimedOutTryPushLeavesRvalueIntact) {
+    AsyncDeque<CountedItem> full(1);
+    ASSERT_TRUE(full.push_back(CountedItem(1)));
+
+    CountedItem item(2);
+    CountedItem::reset();
+    EXPECT_FALSE(full.try_push_back(std::move(item), 1ms));
+    EXPECT_EQ(item.value(), 2);
+    EXPECT_EQ(CountedItem::counts(), (CountedItem::Counts{0, 0, 0}));
+}
+
+TEST_F(CopyMoveTest, EmptyPopDoesNotConstruct) {
+    CountedItem::reset();
+    EXPECT_FALSE(deque_.try_pop_front(1ms).has_value());
+    deque_.close();
+    EXPECT_FALSE(deque_.pop_back().has_value());
+    EXPECT_EQ(CountedItem::counts(), (CountedItem::Counts{0, 0, 0}));
+}
+
+TEST_F(CopyMoveTest, DeferredHooksCopyOnlyForRvalues) {
+    class Deferred : public AsyncDeque<CountedItem> {
+    public:
+        Deferred() : AsyncDeque<CountedItem>(10, HookMode::deferred) {}
+    };
+    Deferred deferred;
+
+    CountedItem item(3);
+    CountedItem::reset();
+    EXPECT_TRUE(deferred.push_back(item));
+    EXPECT_EQ(CountedItem::counts(), (CountedItem::Counts{1, 0, 1}));
+
+    // The hook needs its own copy once the item has been moved into the queue
+    CountedItem::reset();
+    EXPECT_TRUE(deferred.push_back(CountedItem(4)));
+    EXPECT_EQ(CountedItem::counts().copies, 1);
+
+    // A push that fails makes no copy for the hook
+    Deferred closed;
+    closed.close();
+    CountedItem::reset();
+    EXPECT_FALSE(closed.push_back(CountedItem(5)));
+    EXPECT_EQ(CountedItem::counts().copies, 0);
+
+    CountedItem::reset();
+    EXPECT_EQ(deferred.pop_front()->value(), 3);
+    EXPECT_EQ(CountedItem::counts(), (CountedItem::Counts{0, 1, 0}));
+}
@@ -0,0 +1,259 @@
+#include <gtest/gtest.h>
+#include <async_deque/durable.hpp>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace async_deque;
+using namespace std::chrono_literals;
+
+namespace {
+
+struct StringSerializer {
+    size_t size(const std::string& item) const { return item.size(); }
+    void write(const std::string& item, unsigned char* out) const {
+        std::memcpy(out, item.data(), item.size());
+    }
+    std::string read(const unsigned char* data, size_t size) const {
+        return std::string(reinterpret_cast<const char*>(data), size);
+    }
+};
+
+class DurableDequeTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        directory_ = ::testing::TempDir() + "async_deque_durable_" +
+                     ::testing::UnitTest::GetInstance()->current_test_info()->name();
+        ::mkdir(directory_.c_str(), 0700);
+    }
+
+    void TearDown() override {
+        for (const std::string& name : entries()) ::unlink((directory_ + "/" + name).c_str());
+        ::rmdir(directory_.c_str());
+    }
+
+    std::vector<std::string> entries() const {
+        std::vector<std::string> names;
+        if (DIR* dir = ::opendir(directory_.c_str())) {
+            while (const dirent* entry = ::readdir(dir)) {
+                if (entry->d_name[0] != '.') names.push_back(entry->d_name);
+            }
+            ::closedir(dir);
+        }
+        return names;
+    }
+
+    size_t segment_files() const {
+        size_t count = 0;
+        for (const std::string& name : entries()) {
+            if (name.find(".log") != std::string::npos) ++count;
+        }
+        return count;
+    }
+
+    DurableOptions options(SyncPolicy sync = SyncPolicy::group_commit,
+                           size_t segment_bytes = 4096) const {
+        DurableOptions o;
+        o.directory = directory_;
+        o.segment_bytes = segment_bytes;
+        o.sync = sync;
+        return o;
+    }
+
+    std::string directory_;
+};
+
+} // namespace
+
+TEST_F(DurableDequeTest, ItemsSurviveReopen) {
+    {
+        auto deque = DurableDeque<std::string, StringSerializer>::open(options());
+        ASSERT_TRUE(deque);
+        for (int i = 0; i < 10; ++i) ASSERT_TRUE(deque->push_back("item " + std::to_string(i)));
+        EXPECT_EQ(*deque->pop_front(), "item 0");
+        EXPECT_EQ(deque->stats().pushes, 10u);
+    }
+    auto deque = DurableDeque<std::string, StringSerializer>::open(options());
+    ASSERT_TRUE(deque);
+    EXPECT_EQ(deque->stats().recovered, 9u);
+    EXPECT_EQ(deque->size(), 9u);
+    for (int i = 1; i < 10; ++i) EXPECT_EQ(*deque->pop_front(), "item " + std::to_string(i));
+    EXPECT_FALSE(deque->try_pop_front(1ms).has_value());
+}
+
+TEST_F(DurableDequeTest, RecoversAfterProcessCrash) {
+    const pid_t pid = fork();
+    if (pid == 0) {
+        auto deque = DurableDeque<uint64_t>::open(options());
+        if (!deque) _exit(1);
+        for (uint64_t i = 0; i < 100; ++i) deque->push_back(i);
+        for (int i = 0; i < 40; ++i) deque->pop_front();
+        deque->push_back(100);   // its sync round also checkpoints the 40 pops
+        _exit(0);                // no destructor, no final sync
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    auto deque = DurableDeque<uint64_t>::open(options());
+    ASSERT_TRUE(deque);
+    EXPECT_EQ(deque->stats().recovered, 61u);
+    for (uint64_t i = 40; i <= 100; ++i) EXPECT_EQ(deque->pop_front(), i);
+    EXPECT_TRUE(deque->empty());
+}
+
+TEST_F(DurableDequeTest, PopsAfterLastCheckpointAreDeliveredAgain) {
+    const pid_t pid = fork();
+    if (pid == 0) {
+        auto deque = DurableDeque<uint64_t>::open(options(SyncPolicy::none));
+        if (!deque) _exit(1);
+        for (uint64_t i = 0; i < 10; ++i) deque->push_back(i);
+        deque->sync();
+        for (int i = 0; i < 3; ++i) deque->pop_front();
+        _exit(0);
+    }
+    waitpid(pid, nullptr, 0);
+
+    auto deque = DurableDeque<uint64_t>::open(options());
+    ASSERT_TRUE(deque);
+    EXPECT_EQ(deque->size(), 10u);
+    EXPECT_EQ(deque->pop_front(), 0u);
+}
+
+TEST_F(DurableDequeTest, TornTailIsDiscarded) {
+    {
+        auto deque = DurableDeque<uint64_t>::open(options());
+        ASSERT_TRUE(deque);
+        for (uint64_t i = 0; i < 5; ++i) ASSERT_TRUE(deque->push_back(i));
+    }
+    // A record header whose CRC does not match, as left by a write cut short
+    const int fd = ::open((directory_ + "/00000000000000000000.log").c_str(), O_WRONLY);
+    ASSERT_GE(fd, 0);
+    const uint32_t torn[2] = {8, 0xdeadbeef};
+    ASSERT_EQ(::pwrite(fd, torn, sizeof(torn), 5 * 16), static_cast<ssize_t>(sizeof(torn)));
+    ::close(fd);
+
+    {
+        auto deque = DurableDeque<uint64_t>::open(options());
+        ASSERT_TRUE(deque);
+        EXPECT_EQ(deque->stats().recovered, 5u);
+        ASSERT_TRUE(deque->push_back(5));
+    }
+    auto deque = DurableDeque<uint64_t>::open(options());
+    ASSERT_TRUE(deque);
+    EXPECT_EQ(deque->size(), 6u);
+    for (uint64_t i = 0; i < 6; ++i) EXPECT_EQ(deque->pop_front(), i);
+}
+
+TEST_F(DurableDequeTest, SegmentsRollOverAndAreDeletedOnceConsumed) {
+    auto deque = DurableDeque<uint64_t>::open(options(SyncPolicy::none, 64));   // 4 records each
+    ASSERT_TRUE(deque);
+    for (uint64_t i = 0; i < 20; ++i) ASSERT_TRUE(deque->push_back(i));
+    EXPECT_EQ(segment_files(), 5u);
+    EXPECT_EQ(deque->stats().segments, 5u);
+    for (uint64_t i = 0; i < 18; ++i) ASSERT_EQ(deque->pop_front(), i);
+    EXPECT_EQ(segment_files(), 1u);
+    deque.reset();
+
+    deque = DurableDeque<uint64_t>::open(options(SyncPolicy::none, 64));
+    ASSERT_TRUE(deque);
+    EXPECT_EQ(deque->pop_front(), 18u);
+    EXPECT_EQ(deque->pop_front(), 19u);
+    ASSERT_TRUE(deque->push_back(20));
+    EXPECT_EQ(deque->pop_front(), 20u);
+}
+
+TEST_F(DurableDequeTest, OversizedItemGetsItsOwnSegment) {
+    auto deque = DurableDeque<std::string, StringSerializer>::open(options(SyncPolicy::none, 32));
+    ASSERT_TRUE(deque);
+    ASSERT_TRUE(deque->push_back("small"));
+    ASSERT_TRUE(deque->push_back(std::string(1000, 'x')));
+    ASSERT_TRUE(deque->push_back("after"));
+    deque.reset();
+
+    deque = DurableDeque<std::string, StringSerializer>::open(options(SyncPolicy::none, 32));
+    ASSERT_TRUE(deque);
+    EXPECT_EQ(*deque->pop_front(), "small");
+    EXPECT_EQ(deque->pop_front()->size(), 1000u);
+    EXPECT_EQ(*deque->pop_front(), "after");
+}
+
+TEST_F(DurableDequeTest, ConcurrentPushesShareSyncs) {
+    auto deque = DurableDeque<uint64_t>::open(options(SyncPolicy::group_commit, 1 << 20));
+    ASSERT_TRUE(deque);
+    constexpr uint64_t per_producer = 200;
+    std::vector<std::thread> producers;
+    for (uint64_t p = 0; p < 4; ++p) {
+        producers.emplace_back([&, p] {
+            for (uint64_t i = 0; i < per_producer; ++i) deque->push_back(p << 32 | i);
+        });
+    }
+    for (auto& producer : producers) producer.join();
+    const DurableStats stats = deque->stats();
+    EXPECT_EQ(stats.pushes, 4 * per_producer);
+    EXPECT_LE(stats.syncs, stats.pushes);
+    EXPECT_EQ(stats.sync_errors, 0u);
+    EXPECT_EQ(deque->size(), 4 * per_producer);
+}
+
+TEST_F(DurableDequeTest, PeriodicPolicySyncsInBackground) {
+    DurableOptions o = options(SyncPolicy::periodic);
+    o.sync_interval = 1ms;
+    auto deque = DurableDeque<int>::open(o);
+    ASSERT_TRUE(deque);
+    ASSERT_TRUE(deque->push_back(1));
+    const auto deadline = std::chrono::steady_clock::now() + 2s;
+    while (deque->stats().syncs == 0 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(1ms);
+    }
+    EXPECT_GE(deque->stats().syncs, 1u);
+}
+
+TEST_F(DurableDequeTest, CapacityAndClose) {
+    auto deque = DurableDeque<int>::open(options(SyncPolicy::none), 2);
+    ASSERT_TRUE(deque);
+    EXPECT_TRUE(deque->try_push_back(1, 1ms));
+    EXPECT_TRUE(deque->try_push_back(2, 1ms));
+    EXPECT_FALSE(deque->try_push_back(3, 10ms));
+    deque->close();
+    EXPECT_FALSE(deque->push_back(3));
+    EXPECT_EQ(deque->pop_front(), 1);
+    EXPECT_EQ(deque->pop_front(), 2);
+    EXPECT_FALSE(deque->pop_front().has_value());
+}
+
+TEST_F(DurableDequeTest, FailedRecoveryKeepsTheCheckpoint) {
+    {
+        auto deque = DurableDeque<uint64_t>::open(options());
+        ASSERT_TRUE(deque);
+        for (uint64_t i = 0; i < 10; ++i) EXPECT_TRUE(deque->push_back(i));
+        for (int i = 0; i < 4; ++i) EXPECT_TRUE(deque->pop_front().has_value());
+    }
+
+    // A directory named like a segment cannot be opened as one, so recovery
+    // fails after it has read the checkpoint
+    const std::string blocker = directory_ + "/99999999999999999999.log";
+    ASSERT_EQ(::mkdir(blocker.c_str(), 0700), 0);
+    EXPECT_FALSE(DurableDeque<uint64_t>::open(options()));
+    ::rmdir(blocker.c_str());
+
+    auto deque = DurableDeque<uint64_t>::open(options());
+    ASSERT_TRUE(deque);
+    EXPECT_EQ(deque->size(), 6u);
+    for (uint64_t i = 4; i < 10; ++i) EXPECT_EQ(deque->pop_front(), i);
+}
+
+TEST_F(DurableDequeTest, MissingDirectoryFailsToOpen) {
+    DurableOptions o;
+    o.directory = directory_ + "/missing";
+    EXPECT_FALSE(DurableDeque<int>::open(o));
+}
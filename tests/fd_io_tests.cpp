@@ -0,0 +1,367 @@
+#include <gtest/gtest.h>
+#include <async_deque/fd_io.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <csignal>
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace async_deque;
+using namespace std::chrono_literals;
+
+namespace {
+
+/// Pipe whose ends are closed on destruction
+struct Pipe {
+    int read_end = -1;
+    int write_end = -1;
+
+    Pipe() {
+        int fds[2];
+        if (::pipe(fds) == 0) {
+            read_end = fds[0];
+            write_end = fds[1];
+        }
+    }
+
+    ~Pipe() {
+        if (read_end >= 0) ::close(read_end);
+        if (write_end >= 0) ::close(write_end);
+    }
+
+    std::string read_available() const {
+        std::string out;
+        char chunk[4096];
+        const int flags = ::fcntl(read_end, F_GETFL);
+        ::fcntl(read_end, F_SETFL, flags | O_NONBLOCK);
+        for (ssize_t n; (n = ::read(read_end, chunk, sizeof(chunk))) > 0;) out.append(chunk, n);
+        ::fcntl(read_end, F_SETFL, flags);
+        return out;
+    }
+};
+
+} // namespace
+
+TEST(WritevDequeTest, DrainsManyBuffersWithOneWrite) {
+    Pipe pipe;
+    ASSERT_GE(pipe.write_end, 0);
+    WritevDeque<std::string> deque(1000);
+    std::string expected;
+    for (int i = 0; i < 100; ++i) {
+        const std::string line = "line " + std::to_string(i) + "\n";
+        expected += line;
+        ASSERT_TRUE(deque.push_back(line));
+    }
+
+    EXPECT_EQ(deque.drain_to_fd(pipe.write_end), static_cast<ssize_t>(expected.size()));
+    EXPECT_EQ(pipe.read_available(), expected);
+    EXPECT_TRUE(deque.empty());
+    const DrainStats stats = deque.drain_stats();
+    EXPECT_EQ(stats.writev_calls, 1u);
+    EXPECT_EQ(stats.buffers_written, 100u);
+    EXPECT_EQ(deque.stats().pops, 100u);
+}
+
+TEST(WritevDequeTest, MaxBytesRequeuesTheRestAtTheFront) {
+    Pipe pipe;
+    WritevDeque<std::vector<uint8_t>> deque;
+    ASSERT_TRUE(deque.push_back(std::vector<uint8_t>{'h', 'e', 'l', 'l', 'o'}));
+    ASSERT_TRUE(deque.push_back(std::vector<uint8_t>{'w', 'o', 'r', 'l', 'd', '!', '!'}));
+    ASSERT_TRUE(deque.push_back(std::vector<uint8_t>{'?'}));
+
+    EXPECT_EQ(deque.drain_to_fd(pipe.write_end, 10), 10);
+    EXPECT_EQ(pipe.read_available(), "helloworld");
+    EXPECT_EQ(deque.size(), 2u);
+    EXPECT_EQ(deque.drain_stats().partial_writes, 1u);
+    EXPECT_EQ(deque.pop_front(), (std::vector<uint8_t>{'!', '!'}));
+    EXPECT_EQ(deque.pop_front(), (std::vector<uint8_t>{'?'}));
+}
+
+TEST(WritevDequeTest, ShortWriteToFullPipeKeepsOrder) {
+    Pipe pipe;
+    ASSERT_GE(::fcntl(pipe.write_end, F_SETFL, O_NONBLOCK), 0);
+    WritevDeque<std::string> deque;
+    std::string expected;
+    for (char c = 'a'; c <= 'z'; ++c) {
+        expected += std::string(10000, c);
+        ASSERT_TRUE(deque.push_back(std::string(10000, c)));
+    }
+
+    std::string received;
+    while (!deque.empty()) {
+        const ssize_t n = deque.drain_to_fd(pipe.write_end);
+        if (n < 0) {
+            ASSERT_EQ(errno, EAGAIN);
+        }
+        received += pipe.read_available();
+    }
+    received += pipe.read_available();
+    EXPECT_EQ(received, expected);
+    EXPECT_GT(deque.drain_stats().partial_writes, 0u);
+    EXPECT_EQ(deque.drain_stats().buffers_written, 26u);
+}
+
+TEST(WritevDequeTest, TakesAtMostIovMaxBuffersPerCall) {
+    const int null_fd = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+    ASSERT_GE(null_fd, 0);
+    WritevDeque<std::string> deque;
+    for (size_t i = 0; i < detail::iov_max + 10; ++i) ASSERT_TRUE(deque.push_back(std::string("x")));
+    EXPECT_EQ(deque.drain_to_fd(null_fd), static_cast<ssize_t>(detail::iov_max));
+    EXPECT_EQ(deque.size(), 10u);
+    EXPECT_EQ(deque.drain_to_fd(null_fd), 10);
+    ::close(null_fd);
+}
+
+TEST(WritevDequeTest, FailedWriteRequeuesEverything) {
+    WritevDeque<std::string> deque;
+    ASSERT_TRUE(deque.push_back(std::string("one")));
+    ASSERT_TRUE(deque.push_back(std::string("two")));
+    EXPECT_EQ(deque.drain_to_fd(-1), -1);
+    EXPECT_EQ(errno, EBADF);
+    EXPECT_EQ(deque.size(), 2u);
+    EXPECT_EQ(deque.pop_front(), "one");
+}
+
+TEST(WritevDequeTest, SpansAndEndOfStream) {
+    Pipe pipe;
+    static const char text[] = "static bytes";
+    WritevDeque<ByteSpan> deque(4);
+    EXPECT_EQ(deque.try_drain_to_fd(pipe.write_end, 10ms), 0);
+    ASSERT_TRUE(deque.push_back(ByteSpan{reinterpret_cast<const unsigned char*>(text), 6}));
+    ASSERT_TRUE(deque.push_back(ByteSpan{reinterpret_cast<const unsigned char*>(text) + 6, 6}));
+    deque.close();
+    EXPECT_EQ(deque.drain_to_fd(pipe.write_end), 12);
+    EXPECT_EQ(pipe.read_available(), "static bytes");
+    EXPECT_EQ(deque.drain_to_fd(pipe.write_end), 0);
+}
+
+TEST(WritevDequeTest, DrainedBuffersCountTowardCapacityUntilWritten) {
+    Pipe pipe;
+    WritevDeque<std::string> deque(2);
+    ASSERT_TRUE(deque.push_back(std::string(1 << 20, 'a')));   // larger than the pipe buffer
+    ASSERT_TRUE(deque.push_back(std::string("b")));
+    std::thread writer([&] { EXPECT_EQ(deque.drain_to_fd(pipe.write_end), (1 << 20) + 1); });
+
+    // The writer blocks in writev() holding both buffers; they still use up the capacity
+    while (deque.size() != 0) std::this_thread::sleep_for(1ms);
+    EXPECT_FALSE(deque.try_push_back(std::string("c"), 20ms));
+
+    size_t received = 0;
+    char chunk[65536];
+    while (received < (1u << 20) + 1) {
+        const ssize_t n = ::read(pipe.read_end, chunk, sizeof(chunk));
+        if (n <= 0) break;
+        received += static_cast<size_t>(n);
+    }
+    writer.join();
+    EXPECT_EQ(received, (1u << 20) + 1);
+    EXPECT_TRUE(deque.try_push_back(std::string("c"), 20ms));
+}
+
+TEST(WritevDequeTest, WakeupsFromADrainAreNotSpurious) {
+    Pipe pipe;
+    WritevDeque<std::string> deque(1);
+    ASSERT_TRUE(deque.push_back(std::string("a")));
+    std::thread producer([&] { EXPECT_TRUE(deque.push_back(std::string("b"))); });
+    std::this_thread::sleep_for(20ms);
+    EXPECT_EQ(deque.drain_to_fd(pipe.write_end), 1);
+    producer.join();
+
+    const DequeStats stats = deque.stats();
+    EXPECT_EQ(stats.producer_wakeups, 1u);
+    EXPECT_EQ(stats.spurious_wakeups, 0u);
+    EXPECT_GE(stats.lock_acquisitions, 2u);
+}
+
+TEST(WritevDequeTest, ClosedQueueWaitsForBuffersBeingWritten) {
+    const auto previous = std::signal(SIGPIPE, SIG_IGN);
+    Pipe pipe;
+    WritevDeque<std::string> deque;
+    ASSERT_TRUE(deque.push_back(std::string(1 << 20, 'a')));   // larger than the pipe buffer
+    ASSERT_TRUE(deque.push_back(std::string("b")));
+    std::thread writer([&] { deque.drain_to_fd(pipe.write_end); });
+    while (deque.size() != 0) std::this_thread::sleep_for(1ms);
+    deque.close();
+
+    std::atomic<bool> popped{false};
+    std::optional<std::string> item;
+    std::thread consumer([&] {
+        item = deque.pop_front();
+        popped = true;
+    });
+    std::this_thread::sleep_for(20ms);
+    EXPECT_FALSE(popped);   // the buffers may still come back
+
+    ::close(pipe.read_end);   // the write fails or stops short; the rest is requeued
+    pipe.read_end = -1;
+    writer.join();
+    consumer.join();
+    ASSERT_TRUE(item);
+    EXPECT_FALSE(item->empty());
+    std::signal(SIGPIPE, previous);
+}
+
+namespace {
+
+/// Appends @p payload to @p stream in ByteQueue's record layout
+void append_record(std::string& stream, const std::string& payload) {
+    const uint32_t length = static_cast<uint32_t>(payload.size());
+    stream.append(reinterpret_cast<const char*>(&length), sizeof(length));
+    stream += payload;
+}
+
+std::string payload_for(uint32_t i) {
+    return std::string(i % 31, static_cast<char>('a' + i % 26));
+}
+
+} // namespace
+
+TEST(ReadRecordsTest, PipeRecordsAreCommittedInPlace) {
+    Pipe pipe;
+    std::string stream;
+    append_record(stream, "first");
+    append_record(stream, "");
+    append_record(stream, "third");
+    ASSERT_EQ(::write(pipe.write_end, stream.data(), stream.size()), static_cast<ssize_t>(stream.size()));
+    ::close(pipe.write_end);
+    pipe.write_end = -1;
+
+    ByteQueue queue(256);
+    EXPECT_EQ(read_records_from_fd(queue, pipe.read_end), static_cast<ssize_t>(stream.size()));
+    EXPECT_EQ(read_records_from_fd(queue, pipe.read_end), 0);
+    ASSERT_EQ(queue.size(), 3u);
+    for (const char* expected : {"first", "", "third"}) {
+        auto record = queue.read();
+        ASSERT_TRUE(record);
+        EXPECT_EQ(std::string(reinterpret_cast<const char*>(record->data), record->size), expected);
+        queue.release();
+    }
+}
+
+TEST(ReadRecordsTest, RecordsSplitAcrossReadsAndTheWrap) {
+    std::string stream;
+    constexpr uint32_t records = 500;
+    for (uint32_t i = 0; i < records; ++i) append_record(stream, payload_for(i));
+    FILE* file = std::tmpfile();
+    ASSERT_NE(file, nullptr);
+    const int fd = ::fileno(file);
+    ASSERT_EQ(::write(fd, stream.data(), stream.size()), static_cast<ssize_t>(stream.size()));
+    ASSERT_EQ(::lseek(fd, 0, SEEK_SET), 0);
+
+    ByteQueue queue(48);   // a few records at a time, so nearly every read wraps
+    uint32_t next = 0;
+    for (size_t call = 0;; ++call) {
+        const ssize_t n = read_records_from_fd(queue, fd, 7 + call % 23);
+        ASSERT_GE(n, 0);
+        while (auto record = queue.try_read(0ms)) {
+            ASSERT_EQ(std::string(reinterpret_cast<const char*>(record->data), record->size),
+                      payload_for(next));
+            ++next;
+            queue.release();
+        }
+        if (n == 0) break;
+    }
+    EXPECT_EQ(next, records);
+    std::fclose(file);
+}
+
+TEST(ReadRecordsTest, ConcurrentReaderAndConsumerOverAPipe) {
+    Pipe pipe;
+    constexpr uint32_t records = 20000;
+    std::thread writer([&] {
+        std::string stream;
+        for (uint32_t i = 0; i < records; ++i) append_record(stream, payload_for(i));
+        // Odd-sized writes, so reads end in the middle of records
+        for (size_t offset = 0; offset < stream.size();) {
+            const size_t chunk = std::min<size_t>(stream.size() - offset, 1 + offset % 997);
+            const ssize_t n = ::write(pipe.write_end, stream.data() + offset, chunk);
+            if (n <= 0) break;
+            offset += static_cast<size_t>(n);
+        }
+        ::close(pipe.write_end);
+        pipe.write_end = -1;
+    });
+
+    ByteQueue queue(512);
+    std::thread reader([&] {
+        while (read_records_from_fd(queue, pipe.read_end) > 0) {
+        }
+        queue.close();
+    });
+
+    uint32_t next = 0;
+    while (auto record = queue.read()) {
+        ASSERT_EQ(std::string(reinterpret_cast<const char*>(record->data), record->size),
+                  payload_for(next));
+        ++next;
+        queue.release();
+    }
+    writer.join();
+    reader.join();
+    EXPECT_EQ(next, records);
+}
+
+TEST(ReadRecordsTest, OversizedRecordIsAnError) {
+    Pipe pipe;
+    std::string stream;
+    append_record(stream, "ok");
+    append_record(stream, std::string(100, 'x'));
+    ASSERT_EQ(::write(pipe.write_end, stream.data(), stream.size()), static_cast<ssize_t>(stream.size()));
+
+    ByteQueue queue(64);
+    EXPECT_EQ(read_records_from_fd(queue, pipe.read_end), -1);
+    EXPECT_EQ(errno, EBADMSG);
+    EXPECT_EQ(queue.size(), 1u);   // the records before it were committed
+    EXPECT_NE(queue.try_reserve(8, 10ms), nullptr);   // and the stream no longer blocks producers
+    queue.cancel();
+}
+
+TEST(ReadRecordsTest, ReadErrorWithNothingPendingFreesProducers) {
+    Pipe pipe;
+    ASSERT_GE(::fcntl(pipe.read_end, F_SETFL, O_NONBLOCK), 0);
+    ByteQueue queue(64);
+    EXPECT_EQ(read_records_from_fd(queue, pipe.read_end), -1);
+    EXPECT_EQ(errno, EAGAIN);
+    EXPECT_NE(queue.try_reserve(10, 50ms), nullptr);
+    queue.cancel();
+}
+
+TEST(ReadRecordsTest, PartialRecordSurvivesARetriedError) {
+    Pipe pipe;
+    ASSERT_GE(::fcntl(pipe.read_end, F_SETFL, O_NONBLOCK), 0);
+    std::string stream;
+    append_record(stream, "split record");
+    ASSERT_EQ(::write(pipe.write_end, stream.data(), 7), 7);
+
+    ByteQueue queue(64);
+    EXPECT_EQ(read_records_from_fd(queue, pipe.read_end), 7);
+    EXPECT_EQ(read_records_from_fd(queue, pipe.read_end), -1);
+    EXPECT_EQ(errno, EAGAIN);
+    EXPECT_EQ(queue.try_reserve(10, 10ms), nullptr);   // the partial record is still reserved
+
+    const ssize_t rest = static_cast<ssize_t>(stream.size()) - 7;
+    ASSERT_EQ(::write(pipe.write_end, stream.data() + 7, static_cast<size_t>(rest)), rest);
+    EXPECT_EQ(read_records_from_fd(queue, pipe.read_end), rest);
+    auto record = queue.try_read(0ms);
+    ASSERT_TRUE(record);
+    EXPECT_EQ(std::string(reinterpret_cast<const char*>(record->data), record->size), "split record");
+    queue.release();
+}
+
+TEST(ReadRecordsTest, ClosedQueueReadsNothing) {
+    Pipe pipe;
+    ASSERT_EQ(::write(pipe.write_end, "abcd", 4), 4);
+    ByteQueue queue(64);
+    queue.close();
+    EXPECT_EQ(read_records_from_fd(queue, pipe.read_end), 0);
+    EXPECT_EQ(pipe.read_available(), "abcd");
+}
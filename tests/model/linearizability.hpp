@@ -0,0 +1,199 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "model.hpp"
+
+/**
+ * @file linearizability.hpp
+ * @brief History recording and linearizability check against a sequential deque
+ *
+ * @details Each operation is recorded with the scheduler step at which it was
+ * invoked and the step at which it returned. A history is linearizable if
+ * the operations can be put in one sequential order that respects
+ * real-time order and in which each result matches what a sequential
+ * bounded deque would have returned. Operation a precedes b in real time if
+ * a returned before b was invoked. The search is Wing & Gong's, with
+ * memoization of visited (done set, contents) states.
+ */
+
+namespace model {
+
+struct Operation {
+    enum class Kind { push_back, push_front, pop_back, pop_front, close };
+
+    Kind kind = Kind::close;
+    bool timed = false;             ///< try_* variant, allowed to give up
+    int value = 0;                  ///< Pushed value
+    bool pushed = false;            ///< Result of a push
+    std::optional<int> popped{};    ///< Result of a pop
+    uint64_t invoked = 0;
+    uint64_t returned = 0;
+    size_t thread = 0;
+
+    std::string describe() const {
+        std::ostringstream out;
+        out << "t" << thread << " [" << invoked << "," << returned << "] ";
+        switch (kind) {
+        case Kind::push_back: out << (timed ? "try_push_back(" : "push_back(") << value << ")=" << pushed; break;
+        case Kind::push_front: out << (timed ? "try_push_front(" : "push_front(") << value << ")=" << pushed; break;
+        case Kind::pop_back: out << (timed ? "try_pop_back()=" : "pop_back()="); break;
+        case Kind::pop_front: out << (timed ? "try_pop_front()=" : "pop_front()="); break;
+        case Kind::close: out << "close()"; break;
+        }
+        if (kind == Kind::pop_back || kind == Kind::pop_front) {
+            if (popped) out << *popped; else out << "none";
+        }
+        return out.str();
+    }
+};
+
+/**
+ * @brief Operations of one model run, recorded by the model threads
+ *
+ * Recording itself is not a scheduling point, so an operation's interval is
+ * exactly the steps spent inside the queue call.
+ */
+class History {
+public:
+    template<typename Call>
+    void push(Operation::Kind kind, size_t thread, int value, bool timed, Call call) {
+        Operation op{kind, timed, value};
+        op.thread = thread;
+        op.invoked = model::now();
+        op.pushed = call();
+        op.returned = model::now();
+        ops_.push_back(op);
+    }
+
+    template<typename Call>
+    void pop(Operation::Kind kind, size_t thread, bool timed, Call call) {
+        Operation op{kind, timed};
+        op.thread = thread;
+        op.invoked = model::now();
+        op.popped = call();
+        op.returned = model::now();
+        ops_.push_back(op);
+    }
+
+    template<typename Call>
+    void close(size_t thread, Call call) {
+        Operation op{Operation::Kind::close};
+        op.thread = thread;
+        op.invoked = model::now();
+        call();
+        op.returned = model::now();
+        ops_.push_back(op);
+    }
+
+    const std::vector<Operation>& operations() const { return ops_; }
+
+    std::string describe() const {
+        std::string text;
+        for (const Operation& op : ops_) text += "  " + op.describe() + "\n";
+        return text;
+    }
+
+private:
+    std::vector<Operation> ops_;
+};
+
+/**
+ * @brief Checks @p ops against a sequential deque of the given capacity
+ *
+ * Blocking pushes and pops may only complete when they could have proceeded
+ * (space, an item, or the queue closed). Timed ones may also give up when
+ * they could not.
+ */
+class LinearizabilityChecker {
+public:
+    LinearizabilityChecker(std::vector<Operation> ops, size_t capacity)
+        : ops_(std::move(ops)), capacity_(capacity) {}
+
+    bool check() {
+        if (ops_.size() > 64) return false;
+        visited_.clear();
+        return search(0, {}, false);
+    }
+
+private:
+    struct State {
+        std::deque<int> items;
+        bool closed = false;
+    };
+
+    /// Applies op to state if its result is possible there
+    bool apply(const Operation& op, State& state) const {
+        using Kind = Operation::Kind;
+        switch (op.kind) {
+        case Kind::close:
+            state.closed = true;
+            return true;
+        case Kind::push_back:
+        case Kind::push_front: {
+            const bool room = !state.closed && state.items.size() < capacity_;
+            if (!op.pushed) return state.closed || (op.timed && !room);
+            if (!room) return false;
+            if (op.kind == Kind::push_back) state.items.push_back(op.value);
+            else state.items.push_front(op.value);
+            return true;
+        }
+        case Kind::pop_back:
+        case Kind::pop_front: {
+            if (!op.popped) return state.items.empty() && (state.closed || op.timed);
+            if (state.items.empty()) return false;
+            int& end = op.kind == Kind::pop_back ? state.items.back() : state.items.front();
+            if (end != *op.popped) return false;
+            if (op.kind == Kind::pop_back) state.items.pop_back();
+            else state.items.pop_front();
+            return true;
+        }
+        }
+        return false;
+    }
+
+    bool search(uint64_t done, const std::deque<int>& items, bool closed) {
+        if (done == full_mask()) return true;
+        if (!visited_.insert(std::make_tuple(done, items, closed)).second) return false;
+
+        uint64_t first_return = std::numeric_limits<uint64_t>::max();
+        for (size_t i = 0; i < ops_.size(); ++i) {
+            if (!(done & (uint64_t{1} << i))) first_return = std::min(first_return, ops_[i].returned);
+        }
+        for (size_t i = 0; i < ops_.size(); ++i) {
+            if (done & (uint64_t{1} << i)) continue;
+            // Ops invoked once some pending op had returned must come after it.
+            // Each step runs a single thread, so equal steps mean program order.
+            if (ops_[i].invoked >= first_return) continue;
+            State state{items, closed};
+            if (apply(ops_[i], state) &&
+                search(done | (uint64_t{1} << i), state.items, state.closed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    uint64_t full_mask() const {
+        return ops_.size() == 64 ? ~uint64_t{0} : (uint64_t{1} << ops_.size()) - 1;
+    }
+
+    std::vector<Operation> ops_;
+    size_t capacity_;
+    std::set<std::tuple<uint64_t, std::deque<int>, bool>> visited_;
+};
+
+inline bool linearizable(const History& history, size_t capacity) {
+    return LinearizabilityChecker(history.operations(), capacity).check();
+}
+
+} // namespace model
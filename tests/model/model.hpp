@@ -0,0 +1,515 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @file model.hpp
+ * @brief Deterministic scheduler with instrumented mutex, condition variable and atomics
+ *
+ * @details model::run() executes a set of thread bodies on real threads, but
+ * lets only one of them run at a time. Every operation on a model::mutex,
+ * model::condition_variable or model::atomic is a scheduling point. At each
+ * point a seeded random number generator picks which thread runs next, so a
+ * seed fully determines the interleaving and a failing seed replays exactly.
+ *
+ * The scheduler also picks which waiter a notify_one() wakes. It can make a
+ * timed wait time out, and it can inject spurious wakeups. The standard
+ * allows all of these.
+ *
+ * A run fails when it deadlocks, that is, when unfinished threads remain
+ * but none can make progress. A thread asleep on a condition variable
+ * that nobody will notify is a lost wakeup. A run also fails when it
+ * exceeds the step limit, which catches livelock. The memory model is
+ * sequentially consistent: weaker orderings are not explored.
+ *
+ * AsyncDeque picks these primitives up through ASYNC_DEQUE_SYNC=::model::Sync
+ * (see sync.hpp).
+ */
+
+namespace model {
+
+struct Options {
+    uint64_t seed = 1;
+    uint64_t max_steps = 100000;             ///< Fail the run after this many scheduling points
+    double spurious_wakeup_probability = 0;  ///< Per scheduling point, if a thread is waiting
+    double timeout_probability = 0.05;       ///< Per scheduling point, if a timed waiter exists
+};
+
+struct Result {
+    bool ok = true;
+    std::string failure;            ///< What went wrong, with the state of every thread
+    std::vector<size_t> schedule;   ///< Thread picked at each scheduling point
+    uint64_t steps = 0;
+};
+
+class mutex;
+class condition_variable;
+
+namespace detail {
+
+/// Thrown into model threads to unwind them once a run has failed
+struct Aborted {};
+
+class Scheduler;
+inline thread_local Scheduler* current_scheduler = nullptr;
+inline thread_local size_t current_thread = 0;
+
+class Scheduler {
+public:
+    enum class State { runnable, blocked_on_mutex, waiting, finished };
+    enum class Wake { notified, timeout, spurious };
+
+    struct Thread {
+        State state = State::runnable;
+        const mutex* blocked_on = nullptr;
+        const condition_variable* waiting_on = nullptr;
+        bool timed = false;
+        Wake wake = Wake::notified;
+    };
+
+    explicit Scheduler(const Options& options) : options_(options), random_(options.seed) {}
+
+    Result run(std::vector<std::function<void()>> bodies);
+
+    /**
+     * @brief Scheduling point of the calling model thread
+     * @param can_throw Whether the caller can unwind when the run has failed;
+     *        false for unlock(), which is called from destructors
+     */
+    void point(bool can_throw = true);
+
+    /// Random index below @p n from the run's generator
+    size_t pick(size_t n) {
+        return static_cast<size_t>(std::uniform_int_distribution<uint64_t>(0, n - 1)(random_));
+    }
+
+    Thread& self() { return threads_[current_thread]; }
+    bool aborted() const { return aborted_; }
+    uint64_t steps() const { return steps_; }
+
+    /// Wakes a waiter of @p cv chosen by the scheduler
+    void notify(const condition_variable* cv, bool all);
+
+private:
+    bool enabled(const Thread& thread) const;
+    size_t choose();
+    void wake(size_t index, Wake reason);
+    void fail(const std::string& reason);
+    void hand_to(size_t next);
+    void wait_for_turn();
+    void thread_main(size_t index, const std::function<void()>& body);
+
+    const Options options_;
+    std::mt19937_64 random_;
+    std::vector<Thread> threads_;
+    std::vector<size_t> schedule_;
+    uint64_t steps_ = 0;
+    bool aborted_ = false;
+    std::string failure_;
+    size_t finished_ = 0;
+
+    std::mutex baton_mutex_;                ///< Guards running_ and finished_ hand-offs
+    std::condition_variable baton_;
+    size_t running_ = 0;                    ///< Thread allowed to run
+};
+
+} // namespace detail
+
+/// Current step of the running model (0 outside a run), used to order history events
+inline uint64_t now() {
+    return detail::current_scheduler ? detail::current_scheduler->steps() : 0;
+}
+
+/**
+ * @brief Mutex whose lock(), try_lock() and unlock() are scheduling points
+ *
+ * Outside model::run() it acts as a plain single-threaded mutex.
+ */
+class mutex {
+public:
+    mutex() = default;
+    mutex(const mutex&) = delete;
+    mutex& operator=(const mutex&) = delete;
+
+    void lock() {
+        detail::Scheduler* scheduler = detail::current_scheduler;
+        if (!scheduler) {
+            if (locked_) throw std::logic_error("model::mutex would block outside model::run()");
+            locked_ = true;
+            return;
+        }
+        scheduler->point();
+        while (locked_) {
+            scheduler->self().state = detail::Scheduler::State::blocked_on_mutex;
+            scheduler->self().blocked_on = this;
+            scheduler->point();
+        }
+        locked_ = true;
+    }
+
+    bool try_lock() {
+        if (detail::Scheduler* scheduler = detail::current_scheduler) scheduler->point();
+        if (locked_) return false;
+        locked_ = true;
+        return true;
+    }
+
+    void unlock() {
+        locked_ = false;
+        if (detail::Scheduler* scheduler = detail::current_scheduler) scheduler->point(false);
+    }
+
+    bool locked() const { return locked_; }
+
+private:
+    friend class condition_variable;
+
+    /// Releases the mutex as part of a condition variable wait, without a scheduling point
+    void unlock_for_wait() { locked_ = false; }
+
+    bool locked_ = false;
+};
+
+/**
+ * @brief Condition variable whose waits and notifications are scheduling points
+ */
+class condition_variable {
+public:
+    condition_variable() = default;
+    condition_variable(const condition_variable&) = delete;
+    condition_variable& operator=(const condition_variable&) = delete;
+
+    void wait(std::unique_lock<mutex>& lock) {
+        wait_for_wake(lock, false);
+    }
+
+    template<typename Predicate>
+    void wait(std::unique_lock<mutex>& lock, Predicate pred) {
+        while (!pred()) wait(lock);
+    }
+
+    /// The deadline itself is ignored; the scheduler decides when a timed wait expires
+    template<typename Clock, typename Duration>
+    std::cv_status wait_until(std::unique_lock<mutex>& lock,
+                              const std::chrono::time_point<Clock, Duration>&) {
+        return wait_for_wake(lock, true) ? std::cv_status::timeout : std::cv_status::no_timeout;
+    }
+
+    template<typename Clock, typename Duration, typename Predicate>
+    bool wait_until(std::unique_lock<mutex>& lock,
+                    const std::chrono::time_point<Clock, Duration>& deadline, Predicate pred) {
+        while (!pred()) {
+            if (wait_until(lock, deadline) == std::cv_status::timeout) return pred();
+        }
+        return true;
+    }
+
+    template<typename Rep, typename Period>
+    std::cv_status wait_for(std::unique_lock<mutex>& lock,
+                            const std::chrono::duration<Rep, Period>&) {
+        return wait_for_wake(lock, true) ? std::cv_status::timeout : std::cv_status::no_timeout;
+    }
+
+    void notify_one() {
+        if (detail::Scheduler* scheduler = detail::current_scheduler) scheduler->notify(this, false);
+    }
+
+    void notify_all() {
+        if (detail::Scheduler* scheduler = detail::current_scheduler) scheduler->notify(this, true);
+    }
+
+private:
+    /// @return true if the wait timed out
+    bool wait_for_wake(std::unique_lock<mutex>& lock, bool timed) {
+        detail::Scheduler* scheduler = detail::current_scheduler;
+        if (!scheduler) {
+            throw std::logic_error("model::condition_variable would block outside model::run()");
+        }
+        auto& self = scheduler->self();
+        self.state = detail::Scheduler::State::waiting;
+        self.waiting_on = this;
+        self.timed = timed;
+        lock.mutex()->unlock_for_wait();
+        scheduler->point();
+        const bool timed_out = self.wake == detail::Scheduler::Wake::timeout;
+        lock.mutex()->lock();
+        return timed_out;
+    }
+};
+
+/**
+ * @brief Atomic whose every operation is a scheduling point
+ *
+ * For checking lock-free code. Operations are sequentially consistent
+ * whatever memory order is passed.
+ */
+template<typename T>
+class atomic {
+public:
+    atomic() = default;
+    constexpr atomic(T value) : value_(value) {}
+    atomic(const atomic&) = delete;
+    atomic& operator=(const atomic&) = delete;
+
+    T load(std::memory_order = std::memory_order_seq_cst) const {
+        point();
+        return value_.load();
+    }
+
+    void store(T value, std::memory_order = std::memory_order_seq_cst) {
+        point();
+        value_.store(value);
+    }
+
+    T exchange(T value, std::memory_order = std::memory_order_seq_cst) {
+        point();
+        return value_.exchange(value);
+    }
+
+    bool compare_exchange_strong(T& expected, T desired,
+                                 std::memory_order = std::memory_order_seq_cst) {
+        point();
+        return value_.compare_exchange_strong(expected, desired);
+    }
+
+    bool compare_exchange_weak(T& expected, T desired,
+                               std::memory_order order = std::memory_order_seq_cst) {
+        return compare_exchange_strong(expected, desired, order);
+    }
+
+    T fetch_add(T delta, std::memory_order = std::memory_order_seq_cst) {
+        point();
+        return value_.fetch_add(delta);
+    }
+
+    T fetch_sub(T delta, std::memory_order = std::memory_order_seq_cst) {
+        point();
+        return value_.fetch_sub(delta);
+    }
+
+    operator T() const { return load(); }
+
+    T operator=(T value) {
+        store(value);
+        return value;
+    }
+
+private:
+    static void point() {
+        if (detail::Scheduler* scheduler = detail::current_scheduler) scheduler->point();
+    }
+
+    std::atomic<T> value_{};
+};
+
+/// Synchronization policy for ASYNC_DEQUE_SYNC
+struct Sync {
+    using mutex = model::mutex;
+    using condition_variable = model::condition_variable;
+};
+
+/**
+ * @brief Runs @p bodies as concurrent threads under the deterministic scheduler
+ *
+ * Returns once every thread has finished, or has been unwound after a failure.
+ */
+inline Result run(const Options& options, std::vector<std::function<void()>> bodies) {
+    detail::Scheduler scheduler(options);
+    return scheduler.run(std::move(bodies));
+}
+
+
+namespace detail {
+
+inline Result Scheduler::run(std::vector<std::function<void()>> bodies) {
+    const size_t count = bodies.size();
+    threads_.assign(count, Thread{});
+    running_ = count;   // nobody
+    std::vector<std::thread> workers;
+    workers.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        workers.emplace_back([this, i, &bodies] { thread_main(i, bodies[i]); });
+    }
+    if (count != 0) {
+        const size_t first = pick(count);
+        schedule_.push_back(first);
+        hand_to(first);
+    }
+    {
+        std::unique_lock<std::mutex> lock(baton_mutex_);
+        baton_.wait(lock, [&] { return finished_ == count; });
+    }
+    for (auto& worker : workers) worker.join();
+
+    Result result;
+    result.ok = failure_.empty();
+    result.failure = failure_;
+    result.schedule = schedule_;
+    result.steps = steps_;
+    return result;
+}
+
+inline void Scheduler::point(bool can_throw) {
+    if (!aborted_) {
+        const size_t next = choose();
+        if (!aborted_ && next != current_thread) {
+            hand_to(next);
+            wait_for_turn();
+        }
+    }
+    if (aborted_ && can_throw) throw Aborted{};
+}
+
+inline void Scheduler::notify(const condition_variable* cv, bool all) {
+    point();
+    std::vector<size_t> waiters;
+    for (size_t i = 0; i < threads_.size(); ++i) {
+        if (threads_[i].state == State::waiting && threads_[i].waiting_on == cv) waiters.push_back(i);
+    }
+    if (waiters.empty()) return;
+    if (all) {
+        for (size_t i : waiters) wake(i, Wake::notified);
+    } else {
+        wake(waiters[pick(waiters.size())], Wake::notified);
+    }
+}
+
+inline bool Scheduler::enabled(const Thread& thread) const {
+    switch (thread.state) {
+    case State::runnable: return true;
+    case State::blocked_on_mutex: return !thread.blocked_on->locked();
+    default: return false;
+    }
+}
+
+inline size_t Scheduler::choose() {
+    if (++steps_ > options_.max_steps) {
+        fail("step limit of " + std::to_string(options_.max_steps) + " exceeded (livelock?)");
+        return current_thread;
+    }
+
+    std::vector<size_t> waiting;
+    std::vector<size_t> timed;
+    bool any_enabled = false;
+    for (size_t i = 0; i < threads_.size(); ++i) {
+        if (enabled(threads_[i])) {
+            any_enabled = true;
+        } else if (threads_[i].state == State::waiting) {
+            waiting.push_back(i);
+            if (threads_[i].timed) timed.push_back(i);
+        }
+    }
+    std::uniform_real_distribution<double> coin(0.0, 1.0);
+    if (!timed.empty() && (!any_enabled || coin(random_) < options_.timeout_probability)) {
+        wake(timed[pick(timed.size())], Wake::timeout);
+    } else if (!waiting.empty() && options_.spurious_wakeup_probability > 0 &&
+               coin(random_) < options_.spurious_wakeup_probability) {
+        wake(waiting[pick(waiting.size())], Wake::spurious);
+    }
+
+    std::vector<size_t> candidates;
+    for (size_t i = 0; i < threads_.size(); ++i) {
+        if (enabled(threads_[i])) candidates.push_back(i);
+    }
+    if (candidates.empty()) {
+        fail("deadlock: no thread can make progress");
+        return current_thread;
+    }
+    const size_t next = candidates[pick(candidates.size())];
+    threads_[next].state = State::runnable;
+    threads_[next].blocked_on = nullptr;
+    schedule_.push_back(next);
+    return next;
+}
+
+inline void Scheduler::wake(size_t index, Wake reason) {
+    Thread& thread = threads_[index];
+    thread.state = State::runnable;
+    thread.waiting_on = nullptr;
+    thread.timed = false;
+    thread.wake = reason;
+}
+
+inline void Scheduler::fail(const std::string& reason) {
+    if (aborted_) return;
+    aborted_ = true;
+    std::ostringstream out;
+    out << reason << " after " << steps_ << " steps (seed " << options_.seed << ")";
+    for (size_t i = 0; i < threads_.size(); ++i) {
+        out << "\n  thread " << i << ": ";
+        switch (threads_[i].state) {
+        case State::runnable: out << "runnable"; break;
+        case State::blocked_on_mutex: out << "blocked on mutex " << threads_[i].blocked_on; break;
+        case State::waiting:
+            out << "waiting on condition variable " << threads_[i].waiting_on
+                << (threads_[i].timed ? " (timed)" : " (never notified: lost wakeup?)");
+            break;
+        case State::finished: out << "finished"; break;
+        }
+    }
+    failure_ = out.str();
+}
+
+inline void Scheduler::hand_to(size_t next) {
+    {
+        std::lock_guard<std::mutex> lock(baton_mutex_);
+        running_ = next;
+    }
+    baton_.notify_all();
+}
+
+inline void Scheduler::wait_for_turn() {
+    std::unique_lock<std::mutex> lock(baton_mutex_);
+    baton_.wait(lock, [&] { return running_ == current_thread; });
+}
+
+inline void Scheduler::thread_main(size_t index, const std::function<void()>& body) {
+    current_scheduler = this;
+    current_thread = index;
+    wait_for_turn();
+    try {
+        body();
+    } catch (const Aborted&) {
+    } catch (const std::exception& e) {
+        fail("thread " + std::to_string(index) + " threw: " + e.what());
+    }
+    threads_[index].state = State::finished;
+
+    size_t next = threads_.size();
+    const bool others_left = std::any_of(threads_.begin(), threads_.end(), [](const Thread& t) {
+        return t.state != State::finished;
+    });
+    if (others_left && !aborted_) next = choose();
+    if (aborted_) {
+        // Unwind the remaining threads one at a time
+        next = threads_.size();
+        for (size_t i = 0; i < threads_.size(); ++i) {
+            if (threads_[i].state != State::finished) {
+                next = i;
+                break;
+            }
+        }
+    }
+    current_scheduler = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(baton_mutex_);
+        ++finished_;
+        running_ = next;
+    }
+    baton_.notify_all();
+}
+
+} // namespace detail
+
+} // namespace model
@@ -0,0 +1,271 @@
+// Built with ASYNC_DEQUE_SYNC=::model::Sync, so every AsyncDeque in this
+// executable runs on the model mutex and condition variable.
+#include "model/model.hpp"
+#include "model/linearizability.hpp"
+
+#include <gtest/gtest.h>
+#include <async_deque/async_deque.hpp>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+using namespace async_deque;
+using namespace std::chrono_literals;
+using model::History;
+using Kind = model::Operation::Kind;
+
+namespace {
+
+constexpr uint64_t seeds = 1000;
+
+std::string report(const model::Result& result, const History& history) {
+    return result.failure + "\nhistory:\n" + history.describe();
+}
+
+// Queue with the single condition variable AsyncDeque used to have:
+// producers and consumers wait together, and each side wakes one waiter.
+class SingleConditionVariableQueue {
+public:
+    explicit SingleConditionVariableQueue(size_t capacity) : capacity_(capacity) {}
+
+    bool push_back(int value) {
+        std::unique_lock<model::mutex> lock(mutex_);
+        cv_.wait(lock, [&] { return items_.size() < capacity_; });
+        items_.push_back(value);
+        lock.unlock();
+        cv_.notify_one();
+        return true;
+    }
+
+    std::optional<int> pop_front() {
+        std::unique_lock<model::mutex> lock(mutex_);
+        cv_.wait(lock, [&] { return !items_.empty(); });
+        const int value = items_.front();
+        items_.pop_front();
+        lock.unlock();
+        cv_.notify_one();
+        return value;
+    }
+
+private:
+    model::mutex mutex_;
+    model::condition_variable cv_;
+    std::deque<int> items_;
+    const size_t capacity_;
+};
+
+// Queue whose pop reads the front and removes it in two critical sections
+class CheckThenActQueue {
+public:
+    bool push_back(int value) {
+        std::lock_guard<model::mutex> lock(mutex_);
+        items_.push_back(value);
+        return true;
+    }
+
+    std::optional<int> try_pop_front() {
+        int value;
+        {
+            std::lock_guard<model::mutex> lock(mutex_);
+            if (items_.empty()) return std::nullopt;
+            value = items_.front();
+        }
+        std::lock_guard<model::mutex> lock(mutex_);
+        if (!items_.empty()) items_.pop_front();
+        return value;
+    }
+
+private:
+    model::mutex mutex_;
+    std::deque<int> items_;
+};
+
+// Two producers and two consumers moving two items each through capacity 1
+template<typename Queue>
+std::vector<std::function<void()>> mpmc_capacity_one(Queue& queue, History& history) {
+    std::vector<std::function<void()>> threads;
+    for (size_t p = 0; p < 2; ++p) {
+        threads.push_back([&, p] {
+            for (int i = 0; i < 2; ++i) {
+                const int value = static_cast<int>(p) * 10 + i;
+                history.push(Kind::push_back, p, value, false, [&] { return queue.push_back(value); });
+            }
+        });
+    }
+    for (size_t c = 2; c < 4; ++c) {
+        threads.push_back([&, c] {
+            for (int i = 0; i < 2; ++i) {
+                history.pop(Kind::pop_front, c, false, [&] { return queue.pop_front(); });
+            }
+        });
+    }
+    return threads;
+}
+
+} // namespace
+
+TEST(ModelCheckTest, MpmcCapacityOneHasNoLostWakeups) {
+    for (uint64_t seed = 1; seed <= seeds; ++seed) {
+        AsyncDeque<int> queue(1);
+        History history;
+        model::Options options;
+        options.seed = seed;
+        options.spurious_wakeup_probability = 0.05;
+        const model::Result result = model::run(options, mpmc_capacity_one(queue, history));
+        ASSERT_TRUE(result.ok) << report(result, history);
+        ASSERT_TRUE(model::linearizable(history, 1)) << "seed " << seed << "\n" << history.describe();
+    }
+}
+
+TEST(ModelCheckTest, BothEndsTimedCallsAndCloseAreLinearizable) {
+    for (uint64_t seed = 1; seed <= seeds; ++seed) {
+        AsyncDeque<int> queue(2);
+        History history;
+        model::Options options;
+        options.seed = seed;
+        options.timeout_probability = 0.1;
+        options.spurious_wakeup_probability = 0.05;
+        const model::Result result = model::run(options, {
+            [&] {
+                for (int i = 0; i < 3; ++i) {
+                    history.push(Kind::push_back, 0, i, true, [&] { return queue.try_push_back(i, 1ms); });
+                }
+            },
+            [&] {
+                history.push(Kind::push_front, 1, 10, false, [&] { return queue.push_front(10); });
+                history.push(Kind::push_front, 1, 11, true, [&] { return queue.try_push_front(11, 1ms); });
+            },
+            [&] {
+                history.pop(Kind::pop_front, 2, false, [&] { return queue.pop_front(); });
+                history.pop(Kind::pop_back, 2, true, [&] { return queue.try_pop_back(1ms); });
+            },
+            [&] {
+                history.pop(Kind::pop_back, 3, true, [&] { return queue.try_pop_back(1ms); });
+                history.close(3, [&] { queue.close(); });
+                history.pop(Kind::pop_front, 3, false, [&] { return queue.pop_front(); });
+            },
+        });
+        ASSERT_TRUE(result.ok) << report(result, history);
+        ASSERT_TRUE(model::linearizable(history, 2)) << "seed " << seed << "\n" << history.describe();
+    }
+}
+
+TEST(ModelCheckTest, CloseReleasesBlockedCallers) {
+    for (uint64_t seed = 1; seed <= seeds; ++seed) {
+        AsyncDeque<int> queue(1);
+        History history;
+        model::Options options;
+        options.seed = seed;
+        const model::Result result = model::run(options, {
+            [&] {
+                for (int i = 0; i < 3; ++i) {
+                    history.push(Kind::push_back, 0, i, false, [&] { return queue.push_back(i); });
+                }
+            },
+            [&] { history.pop(Kind::pop_front, 1, false, [&] { return queue.pop_front(); }); },
+            [&] { history.close(2, [&] { queue.close(); }); },
+        });
+        ASSERT_TRUE(result.ok) << report(result, history);
+        ASSERT_TRUE(model::linearizable(history, 1)) << "seed " << seed << "\n" << history.describe();
+    }
+}
+
+TEST(ModelCheckTest, SameSeedReplaysSameSchedule) {
+    auto run = [](uint64_t seed) {
+        AsyncDeque<int> queue(1);
+        History history;
+        model::Options options;
+        options.seed = seed;
+        return model::run(options, mpmc_capacity_one(queue, history)).schedule;
+    };
+    EXPECT_EQ(run(42), run(42));
+    EXPECT_NE(run(42), run(43));
+}
+
+// The checks below make sure the harness finds the bugs it is meant to find
+
+TEST(ModelCheckTest, FindsLostWakeupWithSingleConditionVariable) {
+    bool found = false;
+    for (uint64_t seed = 1; seed <= 2000 && !found; ++seed) {
+        SingleConditionVariableQueue queue(1);
+        History history;
+        model::Options options;
+        options.seed = seed;
+        const model::Result result = model::run(options, mpmc_capacity_one(queue, history));
+        if (!result.ok) {
+            EXPECT_NE(result.failure.find("deadlock"), std::string::npos) << result.failure;
+            EXPECT_NE(result.failure.find("lost wakeup"), std::string::npos) << result.failure;
+            found = true;
+        }
+    }
+    EXPECT_TRUE(found);
+}
+
+TEST(ModelCheckTest, FindsNonLinearizableCheckThenAct) {
+    bool found = false;
+    for (uint64_t seed = 1; seed <= 500 && !found; ++seed) {
+        CheckThenActQueue queue;
+        History history;
+        model::Options options;
+        options.seed = seed;
+        const model::Result result = model::run(options, {
+            [&] {
+                for (int i = 0; i < 2; ++i) {
+                    history.push(Kind::push_back, 0, i, false, [&] { return queue.push_back(i); });
+                }
+            },
+            [&] { history.pop(Kind::pop_front, 1, true, [&] { return queue.try_pop_front(); }); },
+            [&] { history.pop(Kind::pop_front, 2, true, [&] { return queue.try_pop_front(); }); },
+        });
+        ASSERT_TRUE(result.ok) << result.failure;
+        found = !model::linearizable(history, 10);
+    }
+    EXPECT_TRUE(found);
+}
+
+TEST(ModelCheckTest, FindsLostUpdateOnAtomicLoadStore) {
+    bool lost = false;
+    for (uint64_t seed = 1; seed <= 200; ++seed) {
+        model::atomic<int> racy{0};
+        model::atomic<int> counted{0};
+        model::Options options;
+        options.seed = seed;
+        auto increment = [&] {
+            racy.store(racy.load() + 1);
+            counted.fetch_add(1);
+        };
+        ASSERT_TRUE(model::run(options, {increment, increment}).ok);
+        EXPECT_EQ(counted.load(), 2);
+        lost = lost || racy.load() == 1;
+    }
+    EXPECT_TRUE(lost);
+}
+
+TEST(ModelCheckTest, LinearizabilityCheckerOnFixedHistories) {
+    auto op = [](Kind kind, int value, uint64_t invoked, uint64_t returned) {
+        model::Operation o{kind};
+        o.invoked = invoked;
+        o.returned = returned;
+        if (kind == Kind::push_back || kind == Kind::push_front) {
+            o.value = value;
+            o.pushed = true;
+        } else {
+            o.popped = value;
+        }
+        return o;
+    };
+    // Sequential: push 1, push 2, pop_front gives 2 -> impossible
+    EXPECT_FALSE(model::LinearizabilityChecker(
+        {op(Kind::push_back, 1, 0, 1), op(Kind::push_back, 2, 2, 3), op(Kind::pop_front, 2, 4, 5)},
+        10).check());
+    // Overlapping pushes may take effect in either order
+    EXPECT_TRUE(model::LinearizabilityChecker(
+        {op(Kind::push_back, 1, 0, 5), op(Kind::push_back, 2, 1, 3), op(Kind::pop_front, 2, 6, 7)},
+        10).check());
+    // A completed blocking push cannot exceed the capacity
+    EXPECT_FALSE(model::LinearizabilityChecker(
+        {op(Kind::push_back, 1, 0, 1), op(Kind::push_back, 2, 2, 3)}, 1).check());
+}
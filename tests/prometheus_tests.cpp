@@ -0,0 +1,76 @@
+#include <gtest/gtest.h>
+#include <async_deque/async_deque.hpp>
+#include <async_deque/prometheus.hpp>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <chrono>
+
+using namespace async_deque;
+using namespace std::chrono_literals;
+
+TEST(PrometheusTest, RegistrationFollowsLifetime) {
+    StatsRegistry registry;
+    AsyncDeque<int> deque;
+    {
+        auto registration = registry.add("a", deque);
+        EXPECT_EQ(registry.size(), 1u);
+        auto moved = std::move(registration);
+        EXPECT_EQ(registry.size(), 1u);
+    }
+    EXPECT_EQ(registry.size(), 0u);
+}
+
+TEST(PrometheusTest, RendersExpositionFormat) {
+    StatsRegistry registry;
+    AsyncDeque<int> bounded(4);
+    AsyncDeque<int> unbounded;
+    auto r1 = registry.add("in\"bound", bounded);
+    auto r2 = registry.add("out", unbounded);
+
+    EXPECT_TRUE(bounded.push_back(1));
+    EXPECT_TRUE(bounded.push_back(2));
+    EXPECT_TRUE(bounded.pop_front().has_value());
+    EXPECT_FALSE(unbounded.try_pop_front(1ms).has_value());
+    unbounded.close();
+    EXPECT_FALSE(unbounded.push_back(3));
+
+    const std::string text = render_prometheus(registry);
+    EXPECT_NE(text.find("# TYPE async_deque_depth gauge\n"), std::string::npos);
+    EXPECT_NE(text.find("async_deque_depth{queue=\"in\\\"bound\"} 1\n"), std::string::npos);
+    EXPECT_NE(text.find("async_deque_capacity{queue=\"in\\\"bound\"} 4\n"), std::string::npos);
+    EXPECT_NE(text.find("async_deque_capacity{queue=\"out\"} +Inf\n"), std::string::npos);
+    EXPECT_NE(text.find("async_deque_pushes_total{queue=\"in\\\"bound\"} 2\n"), std::string::npos);
+    EXPECT_NE(text.find("async_deque_timeouts_total{queue=\"out\",side=\"consumer\"} 1\n"),
+              std::string::npos);
+    EXPECT_NE(text.find("async_deque_dropped_total{queue=\"out\"} 1\n"), std::string::npos);
+    EXPECT_NE(text.find("async_deque_wait_seconds_count{queue=\"out\",side=\"consumer\"} 1\n"),
+              std::string::npos);
+    EXPECT_NE(text.find("async_deque_wait_seconds_bucket{queue=\"out\",side=\"consumer\",le=\"0.01\"} 1\n"),
+              std::string::npos);
+    EXPECT_NE(text.find("async_deque_wait_seconds_bucket{queue=\"out\",side=\"consumer\",le=\"0.0001\"} 0\n"),
+              std::string::npos);
+
+    // Every line is a comment or "name{labels} value"
+    std::istringstream lines(text);
+    for (std::string line; std::getline(lines, line);) {
+        if (line.rfind("# ", 0) == 0) continue;
+        EXPECT_NE(line.find("} "), std::string::npos) << line;
+        EXPECT_EQ(line.rfind("async_deque_", 0), 0u) << line;
+    }
+}
+
+TEST(PrometheusTest, WritesTextfile) {
+    StatsRegistry registry;
+    AsyncDeque<int> deque;
+    auto registration = registry.add("q", deque);
+    const std::string path = ::testing::TempDir() + "async_deque_metrics.prom";
+    ASSERT_TRUE(write_prometheus_file(path, registry));
+
+    std::ifstream file(path);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    EXPECT_EQ(contents.str(), render_prometheus(registry));
+    std::remove(path.c_str());
+}
@@ -0,0 +1,215 @@
+#include <gtest/gtest.h>
+#include <async_deque/shm_deque.hpp>
+#include <cerrno>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace async_deque;
+using namespace std::chrono_literals;
+
+namespace {
+
+struct Record {
+    uint64_t sequence;
+    char text[24];
+};
+
+/// Runs @p child in a forked process and returns its exit status (-1 if it crashed)
+template<typename Child>
+int run_child(Child child) {
+    const pid_t pid = fork();
+    if (pid == 0) {
+        _exit(child());
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+} // namespace
+
+TEST(ShmDequeTest, BothEndsInOneProcess) {
+    auto queue = ShmDeque<Record>::create_anonymous(4);
+    ASSERT_TRUE(queue);
+    EXPECT_EQ(queue->capacity(), 4u);
+    EXPECT_TRUE(queue->push_back(Record{1, "one"}));
+    EXPECT_TRUE(queue->push_back(Record{2, "two"}));
+    EXPECT_TRUE(queue->push_front(Record{0, "zero"}));
+    EXPECT_EQ(queue->size(), 3u);
+
+    EXPECT_EQ(queue->pop_back()->sequence, 2u);
+    auto front = queue->pop_front();
+    ASSERT_TRUE(front);
+    EXPECT_EQ(front->sequence, 0u);
+    EXPECT_STREQ(front->text, "zero");
+    EXPECT_EQ(queue->pop_front()->sequence, 1u);
+    EXPECT_TRUE(queue->empty());
+}
+
+TEST(ShmDequeTest, TimeoutsAndClose) {
+    auto queue = ShmDeque<int>::create_anonymous(1);
+    ASSERT_TRUE(queue);
+    EXPECT_FALSE(queue->try_pop_front(10ms).has_value());
+    EXPECT_TRUE(queue->try_push_back(1, 10ms));
+    EXPECT_FALSE(queue->try_push_front(2, 10ms));
+
+    queue->close();
+    EXPECT_TRUE(queue->is_closed());
+    EXPECT_FALSE(queue->push_back(3));
+    EXPECT_EQ(queue->pop_front(), 1);
+    EXPECT_FALSE(queue->pop_front().has_value());
+}
+
+TEST(ShmDequeTest, ForkedProducerFeedsParentInOrder) {
+    auto queue = ShmDeque<Record>::create_anonymous(8);
+    ASSERT_TRUE(queue);
+    constexpr uint64_t items = 20000;
+
+    const pid_t pid = fork();
+    if (pid == 0) {
+        for (uint64_t i = 0; i < items; ++i) {
+            if (!queue->push_back(Record{i, "payload"})) _exit(1);
+        }
+        queue->close();
+        _exit(0);
+    }
+    uint64_t expected = 0;
+    while (auto record = queue->pop_front()) {
+        ASSERT_EQ(record->sequence, expected);
+        ++expected;
+    }
+    EXPECT_EQ(expected, items);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+TEST(ShmDequeTest, CloseInChildReleasesBlockedParent) {
+    auto queue = ShmDeque<int>::create_anonymous(1);
+    ASSERT_TRUE(queue);
+    const pid_t pid = fork();
+    if (pid == 0) {
+        std::this_thread::sleep_for(50ms);
+        queue->close();
+        _exit(0);
+    }
+    const auto start = std::chrono::steady_clock::now();
+    EXPECT_FALSE(queue->pop_front().has_value());
+    EXPECT_GE(std::chrono::steady_clock::now() - start, 40ms);
+    waitpid(pid, nullptr, 0);
+}
+
+TEST(ShmDequeTest, NamedQueueOpenedByAnotherProcess) {
+    const std::string name = "/async_deque_test_" + std::to_string(getpid());
+    auto queue = ShmDeque<uint64_t>::create(name, 16);
+    ASSERT_TRUE(queue);
+    EXPECT_FALSE(ShmDeque<uint64_t>::create(name, 16));   // already exists
+    EXPECT_FALSE(ShmDeque<uint32_t>::open(name));         // wrong element size
+
+    EXPECT_EQ(run_child([&] {
+        auto peer = ShmDeque<uint64_t>::open(name);
+        if (!peer || peer->capacity() != 16) return 1;
+        return peer->push_back(42) && peer->push_front(41) ? 0 : 2;
+    }), 0);
+    EXPECT_EQ(queue->pop_front(), 41u);
+    EXPECT_EQ(queue->pop_front(), 42u);
+
+    EXPECT_TRUE(ShmDeque<uint64_t>::unlink(name));
+    EXPECT_FALSE(ShmDeque<uint64_t>::open(name));
+    EXPECT_TRUE(queue->push_back(7));   // still mapped here
+    EXPECT_EQ(queue->pop_front(), 7u);
+}
+
+TEST(ShmDequeTest, AttachMapsSameQueue) {
+    auto queue = ShmDeque<int>::create_anonymous(4);
+    ASSERT_TRUE(queue);
+    auto other = ShmDeque<int>::attach(queue->fd());
+    ASSERT_TRUE(other);
+    EXPECT_NE(other->fd(), queue->fd());
+    EXPECT_TRUE(queue->push_back(5));
+    EXPECT_EQ(other->pop_front(), 5);
+    other->close();
+    EXPECT_TRUE(queue->is_closed());
+}
+
+TEST(ShmDequeTest, RecoversWhenPeerDiesHoldingTheLock) {
+    auto queue = ShmDeque<int>::create_anonymous(4);
+    ASSERT_TRUE(queue);
+    ASSERT_TRUE(queue->push_back(1));
+
+    // The child takes the queue mutex through its own mapping and dies with it held
+    EXPECT_EQ(run_child([&] {
+        void* region = mmap(nullptr, ShmDeque<int>::region_size(4), PROT_READ | PROT_WRITE,
+                            MAP_SHARED, queue->fd(), 0);
+        if (region == MAP_FAILED) return 1;
+        pthread_mutex_lock(&static_cast<detail::ShmHeader*>(region)->mutex);
+        return 0;
+    }), 0);
+
+    EXPECT_EQ(queue->size(), 1u);
+    EXPECT_EQ(queue->owner_deaths(), 1u);
+    EXPECT_TRUE(queue->push_back(2));
+    EXPECT_EQ(queue->pop_front(), 1);
+    EXPECT_EQ(queue->pop_front(), 2);
+    EXPECT_EQ(queue->owner_deaths(), 1u);
+}
+
+TEST(ShmDequeTest, UnrecoverableMutexFailsEveryCall) {
+    auto queue = ShmDeque<int>::create_anonymous(4);
+    ASSERT_TRUE(queue);
+    ASSERT_TRUE(queue->push_back(1));
+    EXPECT_EQ(run_child([&] {
+        void* region = mmap(nullptr, ShmDeque<int>::region_size(4), PROT_READ | PROT_WRITE,
+                            MAP_SHARED, queue->fd(), 0);
+        if (region == MAP_FAILED) return 1;
+        pthread_mutex_lock(&static_cast<detail::ShmHeader*>(region)->mutex);
+        return 0;
+    }), 0);
+
+    // Releasing a dead owner's mutex without marking it consistent makes it unrecoverable
+    void* region = mmap(nullptr, ShmDeque<int>::region_size(4), PROT_READ | PROT_WRITE,
+                        MAP_SHARED, queue->fd(), 0);
+    ASSERT_NE(region, MAP_FAILED);
+    pthread_mutex_t& mutex = static_cast<detail::ShmHeader*>(region)->mutex;
+    ASSERT_EQ(pthread_mutex_lock(&mutex), EOWNERDEAD);
+    pthread_mutex_unlock(&mutex);
+    ASSERT_EQ(pthread_mutex_lock(&mutex), ENOTRECOVERABLE);
+    munmap(region, ShmDeque<int>::region_size(4));
+
+    EXPECT_TRUE(queue->is_closed());
+    EXPECT_EQ(queue->size(), 0u);
+    EXPECT_FALSE(queue->push_back(2));
+    EXPECT_FALSE(queue->try_push_front(2, 10ms));
+    EXPECT_FALSE(queue->pop_front().has_value());
+    EXPECT_FALSE(queue->try_pop_back(10ms).has_value());
+    queue->close();
+}
+
+TEST(ShmDequeTest, ConsumerKilledMidStreamLeavesQueueUsable) {
+    auto queue = ShmDeque<uint64_t>::create_anonymous(64);
+    ASSERT_TRUE(queue);
+    for (int round = 0; round < 10; ++round) {
+        const pid_t pid = fork();
+        if (pid == 0) {
+            for (uint64_t i = 0;; ++i) {
+                queue->push_back(i);
+                queue->pop_front();
+            }
+        }
+        std::this_thread::sleep_for(5ms);
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+
+        // Whatever the child was doing, the queue holds 0 or 1 items and still works
+        const size_t left = queue->size();
+        EXPECT_LE(left, 1u);
+        EXPECT_TRUE(queue->try_push_back(99, 100ms));
+        for (size_t i = 0; i <= left; ++i) EXPECT_TRUE(queue->try_pop_front(100ms).has_value());
+        EXPECT_TRUE(queue->empty());
+    }
+}
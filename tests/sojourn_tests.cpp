@@ -0,0 +1,55 @@
+#include <gtest/gtest.h>
+#include <async_deque/sojourn.hpp>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <chrono>
+
+using namespace async_deque;
+using namespace std::chrono_literals;
+
+TEST(SojournDequeTest, MeasuresTimeQueued) {
+    SojournDeque<std::string> deque(10);
+    EXPECT_TRUE(deque.push_back("first"));
+    std::this_thread::sleep_for(20ms);
+
+    auto val = deque.pop_front();
+    ASSERT_TRUE(val.has_value());
+    EXPECT_EQ(*val, "first");
+
+    auto summary = deque.sojourn();
+    EXPECT_EQ(summary.count, 1u);
+    EXPECT_GE(summary.max_ns, 15000000u);
+    EXPECT_LT(summary.max_ns, 1000000000u);
+}
+
+TEST(SojournDequeTest, StampsFollowElementsAtBothEnds) {
+    SojournDeque<int> deque;
+    EXPECT_TRUE(deque.push_back(1));   // old
+    std::this_thread::sleep_for(30ms);
+    EXPECT_TRUE(deque.push_front(2));  // young, but at the front
+
+    EXPECT_EQ(*deque.pop_front(), 2);
+    EXPECT_LT(deque.sojourn().max_ns, 20000000u);
+
+    EXPECT_EQ(*deque.pop_back(), 1);
+    EXPECT_GE(deque.sojourn().max_ns, 25000000u);
+    EXPECT_EQ(deque.sojourn().count, 2u);
+}
+
+TEST(SojournDequeTest, CoarseClockAndDump) {
+    SojournDeque<int, CoarseClock> deque;
+    for (int i = 0; i < 100; ++i) EXPECT_TRUE(deque.push_back(i));
+    for (int i = 0; i < 100; ++i) EXPECT_TRUE(deque.try_pop_front(1ms).has_value());
+
+    auto summary = deque.sojourn();
+    EXPECT_EQ(summary.count, 100u);
+    EXPECT_LE(summary.p50_ns, summary.p99_ns);
+    EXPECT_LE(summary.p99_ns, summary.p999_ns);
+    EXPECT_LE(summary.p999_ns, summary.max_ns);
+
+    std::ostringstream out;
+    deque.dump_sojourn(out);
+    EXPECT_EQ(out.str().rfind("sojourn count=100 ", 0), 0u);
+    EXPECT_NE(out.str().find("1.000000"), std::string::npos);
+}
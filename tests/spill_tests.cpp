@@ -0,0 +1,216 @@
+#include <gtest/gtest.h>
+#include <async_deque/spill.hpp>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+using namespace async_deque;
+using namespace std::chrono_literals;
+
+namespace {
+
+struct StringSerializer {
+    size_t size(const std::string& item) const { return item.size(); }
+    void write(const std::string& item, unsigned char* out) const {
+        std::memcpy(out, item.data(), item.size());
+    }
+    std::string read(const unsigned char* data, size_t size) const {
+        return std::string(reinterpret_cast<const char*>(data), size);
+    }
+};
+
+class SpillDequeTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        directory_ = ::testing::TempDir() + "async_deque_spill_" +
+                     ::testing::UnitTest::GetInstance()->current_test_info()->name();
+        ::mkdir(directory_.c_str(), 0700);
+    }
+
+    void TearDown() override {
+        ::rmdir(directory_.c_str());
+    }
+
+    size_t files() const {
+        size_t count = 0;
+        if (DIR* dir = ::opendir(directory_.c_str())) {
+            while (const dirent* entry = ::readdir(dir)) {
+                if (std::string(entry->d_name).find(".seg") != std::string::npos) ++count;
+            }
+            ::closedir(dir);
+        }
+        return count;
+    }
+
+    SpillOptions options(size_t segment_bytes = 4096) const {
+        SpillOptions o;
+        o.directory = directory_;
+        o.segment_bytes = segment_bytes;
+        return o;
+    }
+
+    std::string directory_;
+};
+
+} // namespace
+
+TEST_F(SpillDequeTest, SpillsInsteadOfBlockingAndKeepsFifoOrder) {
+    SpillDeque<std::string, StringSerializer> deque(4, options());
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_TRUE(deque.try_push_back("item " + std::to_string(i), 1ms));
+    }
+    EXPECT_EQ(deque.size(), 100u);
+    const SpillStats stats = deque.spill_stats();
+    EXPECT_EQ(stats.spilled_items, 96u);
+    EXPECT_EQ(stats.total_spilled, 96u);
+    EXPECT_EQ(stats.segments, 1u);
+    EXPECT_EQ(files(), 1u);
+
+    for (int i = 0; i < 100; ++i) {
+        auto item = deque.pop_front();
+        ASSERT_TRUE(item.has_value());
+        EXPECT_EQ(*item, "item " + std::to_string(i));
+    }
+    EXPECT_TRUE(deque.empty());
+    EXPECT_EQ(deque.spill_stats().spilled_bytes, 0u);
+    EXPECT_EQ(files(), 0u);
+}
+
+TEST_F(SpillDequeTest, SegmentsAreDeletedOnceConsumed) {
+    SpillDeque<uint64_t> deque(2, options(64));   // 5 records of 12 bytes per segment
+    for (uint64_t i = 0; i < 52; ++i) ASSERT_TRUE(deque.push_back(i));
+    EXPECT_EQ(deque.spill_stats().segments, 10u);
+    EXPECT_EQ(files(), 10u);
+
+    size_t previous = files();
+    for (uint64_t i = 0; i < 52; ++i) {
+        ASSERT_EQ(deque.pop_front(), i);
+        EXPECT_LE(files(), previous);
+        previous = files();
+    }
+    EXPECT_EQ(files(), 0u);
+}
+
+TEST_F(SpillDequeTest, OversizedItemGetsItsOwnSegment) {
+    SpillDeque<std::string, StringSerializer> deque(1, options(16));
+    ASSERT_TRUE(deque.push_back("small"));
+    ASSERT_TRUE(deque.push_back(std::string(1000, 'x')));
+    ASSERT_TRUE(deque.push_back("after"));
+    EXPECT_EQ(*deque.pop_front(), "small");
+    EXPECT_EQ(deque.pop_front()->size(), 1000u);
+    EXPECT_EQ(*deque.pop_front(), "after");
+}
+
+TEST_F(SpillDequeTest, BlocksWhenSpillBudgetIsUsed) {
+    SpillOptions o = options();
+    o.max_spill_bytes = 24;   // two 8-byte items with their length prefixes
+    SpillDeque<uint64_t> deque(1, o);
+    EXPECT_TRUE(deque.try_push_back(uint64_t{0}, 1ms));
+    EXPECT_TRUE(deque.try_push_back(uint64_t{1}, 1ms));
+    EXPECT_TRUE(deque.try_push_back(uint64_t{2}, 1ms));
+    EXPECT_FALSE(deque.try_push_back(uint64_t{3}, 10ms));
+
+    EXPECT_EQ(deque.pop_front(), 0u);
+    EXPECT_TRUE(deque.try_push_back(uint64_t{3}, 1ms));
+    for (uint64_t i = 1; i <= 3; ++i) EXPECT_EQ(deque.pop_front(), i);
+}
+
+TEST_F(SpillDequeTest, UnusableDirectoryFallsBackToBlocking) {
+    SpillOptions o;
+    o.directory = directory_ + "/missing";
+    SpillDeque<int> deque(2, o);
+    EXPECT_TRUE(deque.try_push_back(1, 1ms));
+    EXPECT_TRUE(deque.try_push_back(2, 1ms));
+    EXPECT_FALSE(deque.try_push_back(3, 10ms));
+    EXPECT_GE(deque.spill_stats().spill_failures, 1u);
+    EXPECT_EQ(deque.pop_front(), 1);
+    EXPECT_TRUE(deque.try_push_back(3, 1ms));
+}
+
+TEST_F(SpillDequeTest, SpillingResumesAfterAFailureWithNothingSpilled) {
+    const std::string missing = directory_ + "/missing";
+    SpillOptions o = options();
+    o.directory = missing;
+    SpillDeque<int> deque(1, o);
+    EXPECT_TRUE(deque.try_push_back(1, 1ms));
+    EXPECT_FALSE(deque.try_push_back(2, 10ms));
+    EXPECT_EQ(deque.spill_stats().spilled_items, 0u);
+
+    ASSERT_EQ(::mkdir(missing.c_str(), 0700), 0);
+    EXPECT_EQ(deque.pop_front(), 1);
+    EXPECT_TRUE(deque.try_push_back(2, 1ms));
+    EXPECT_TRUE(deque.try_push_back(3, 1ms));   // memory is full again: spills
+    EXPECT_EQ(deque.spill_stats().spilled_items, 1u);
+    EXPECT_EQ(deque.pop_front(), 2);
+    EXPECT_EQ(deque.pop_front(), 3);
+    ::rmdir(missing.c_str());
+}
+
+namespace {
+
+/// Claims every item needs more bytes than a record length can describe
+struct HugeSerializer {
+    size_t size(int) const { return size_t{std::numeric_limits<uint32_t>::max()} + 1; }
+    void write(int, unsigned char*) const {}
+    int read(const unsigned char*, size_t) const { return 0; }
+};
+
+} // namespace
+
+TEST_F(SpillDequeTest, ItemTooLargeToSpillIsRejected) {
+    if (sizeof(size_t) <= sizeof(uint32_t)) GTEST_SKIP() << "sizes above 4GB need a 64-bit size_t";
+    SpillDeque<int, HugeSerializer> deque(1, options());
+    EXPECT_TRUE(deque.push_back(1));
+    EXPECT_FALSE(deque.push_back(2));
+    EXPECT_EQ(deque.spill_stats().spill_failures, 0u);
+    EXPECT_EQ(deque.size(), 1u);
+}
+
+TEST_F(SpillDequeTest, CloseDrainsSpilledItems) {
+    SpillDeque<int> deque(1, options());
+    for (int i = 0; i < 5; ++i) ASSERT_TRUE(deque.push_back(i));
+    deque.close();
+    EXPECT_FALSE(deque.push_back(5));
+    for (int i = 0; i < 5; ++i) EXPECT_EQ(deque.pop_front(), i);
+    EXPECT_FALSE(deque.pop_front().has_value());
+}
+
+TEST_F(SpillDequeTest, DestructorRemovesSegments) {
+    {
+        SpillDeque<int> deque(1, options());
+        for (int i = 0; i < 10; ++i) ASSERT_TRUE(deque.push_back(i));
+        EXPECT_EQ(files(), 1u);
+    }
+    EXPECT_EQ(files(), 0u);
+}
+
+TEST_F(SpillDequeTest, ConcurrentProducersAndSlowConsumerStayOrdered) {
+    SpillDeque<uint64_t> deque(16, options(1024));
+    constexpr uint64_t per_producer = 5000;
+    std::vector<std::thread> producers;
+    for (uint64_t p = 0; p < 2; ++p) {
+        producers.emplace_back([&, p] {
+            for (uint64_t i = 0; i < per_producer; ++i) deque.push_back(p << 32 | i);
+        });
+    }
+    uint64_t next[2] = {0, 0};
+    for (uint64_t n = 0; n < 2 * per_producer; ++n) {
+        auto item = deque.pop_front();
+        ASSERT_TRUE(item.has_value());
+        const uint64_t producer = *item >> 32;
+        ASSERT_LT(producer, 2u);
+        ASSERT_EQ(*item & 0xffffffff, next[producer]);
+        ++next[producer];
+        if (n % 1000 == 0) std::this_thread::sleep_for(1ms);
+    }
+    for (auto& producer : producers) producer.join();
+    EXPECT_TRUE(deque.empty());
+    EXPECT_EQ(files(), 0u);
+}
@@ -0,0 +1,259 @@
+#include <gtest/gtest.h>
+#include <async_deque/async_deque.hpp>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <atomic>
+
+using namespace async_deque;
+using namespace std::chrono_literals;
+
+TEST(LogLinearHistogramTest, SmallValuesAreExact) {
+    LogLinearHistogram<3> histogram;
+    for (uint64_t v = 0; v < 8; ++v) {
+        histogram.record(v);
+    }
+    auto snap = histogram.snapshot();
+    EXPECT_EQ(snap.count, 8u);
+    EXPECT_EQ(snap.max, 7u);
+    EXPECT_EQ(snap.percentile(0.5), 3u);   // the 4th of 8
+    for (size_t i = 0; i < 8; ++i) {
+        EXPECT_EQ(snap.counts[i], 1u);
+    }
+}
+
+TEST(LogLinearHistogramTest, RelativeErrorIsBounded) {
+    using Histogram = LogLinearHistogram<3>;
+    HistogramSnapshot snap = Histogram().snapshot();
+    for (uint64_t v : {9ull, 100ull, 12345ull, 987654321ull}) {
+        size_t index = Histogram::bucket_index(v);
+        EXPECT_LE(snap.bucket_lower(index), v);
+        EXPECT_GE(snap.bucket_upper(index), v);
+        EXPECT_LE(snap.bucket_upper(index) - snap.bucket_lower(index), v / 8);
+    }
+}
+
+TEST(LogLinearHistogramTest, Percentiles) {
+    LogLinearHistogram<4> histogram;
+    for (uint64_t v = 1; v <= 1000; ++v) {
+        histogram.record(v * 1000);
+    }
+    auto snap = histogram.snapshot();
+    EXPECT_EQ(snap.max, 1000000u);
+    EXPECT_NEAR(static_cast<double>(snap.percentile(0.5)), 500000.0, 500000.0 / 16);
+    EXPECT_NEAR(static_cast<double>(snap.percentile(0.99)), 990000.0, 990000.0 / 16);
+    EXPECT_EQ(snap.percentile(1.0), 1000000u);
+}
+
+TEST(LogLinearHistogramTest, PercentilesUseNearestRank) {
+    LogLinearHistogram<7> histogram;   // exact below 128
+    for (uint64_t v = 1; v <= 100; ++v) {
+        histogram.record(v);
+    }
+    auto snap = histogram.snapshot();
+    EXPECT_EQ(snap.percentile(0.0), 1u);
+    EXPECT_EQ(snap.percentile(0.01), 1u);
+    EXPECT_EQ(snap.percentile(0.07), 7u);
+    EXPECT_EQ(snap.percentile(0.5), 50u);
+    EXPECT_EQ(snap.percentile(0.505), 51u);
+    EXPECT_EQ(snap.percentile(0.9), 90u);
+    EXPECT_EQ(snap.percentile(0.99), 99u);
+    EXPECT_EQ(snap.percentile(0.999), 100u);
+}
+
+TEST(DequeStatsTest, CountsOperations) {
+    AsyncDeque<int> deque(2);
+    EXPECT_TRUE(deque.push_back(1));
+    EXPECT_TRUE(deque.push_front(2));
+    EXPECT_FALSE(deque.try_push_back(3, 1ms));
+    EXPECT_TRUE(deque.pop_back().has_value());
+
+    auto stats = deque.stats();
+    EXPECT_EQ(stats.pushes, 2u);
+    EXPECT_EQ(stats.pops, 1u);
+    EXPECT_EQ(stats.push_timeouts, 1u);
+    EXPECT_EQ(stats.depth, 1u);
+    EXPECT_EQ(stats.high_water, 2u);
+    EXPECT_EQ(stats.producer_blocks, 1u);
+    EXPECT_GE(stats.producer_blocked_ns, 1000000u);
+
+    EXPECT_TRUE(deque.pop_front().has_value());
+    EXPECT_FALSE(deque.try_pop_front(1ms).has_value());
+    deque.close();
+    EXPECT_FALSE(deque.push_back(4));
+
+    stats = deque.stats();
+    EXPECT_EQ(stats.pop_timeouts, 1u);
+    EXPECT_EQ(stats.rejected_pushes, 1u);
+    EXPECT_EQ(stats.depth, 0u);
+    EXPECT_EQ(stats.consumer_blocks, 1u);
+    EXPECT_GE(stats.lock_acquisitions, 8u);
+}
+
+TEST(DequeStatsTest, HistogramsAreAllocatedOnFirstUse) {
+    AsyncDeque<int> deque(1);
+    EXPECT_LT(sizeof(deque), 1024u);
+    ASSERT_TRUE(deque.push_back(1));
+    auto stats = deque.stats();
+    EXPECT_EQ(stats.producer_wait.count, 0u);
+    EXPECT_EQ(stats.producer_wait.counts.size(), LogLinearHistogram<>::bucket_count);
+
+    EXPECT_FALSE(deque.try_push_back(2, 1ms));
+    stats = deque.stats();
+    EXPECT_EQ(stats.producer_wait.count, 1u);
+    EXPECT_EQ(stats.consumer_wait.count, 0u);
+}
+
+TEST(DequeStatsTest, ConsumerBlockedTime) {
+    AsyncDeque<int> deque;
+    std::thread consumer([&] { EXPECT_TRUE(deque.pop_front().has_value()); });
+    std::this_thread::sleep_for(50ms);
+    EXPECT_TRUE(deque.push_back(1));
+    consumer.join();
+
+    auto stats = deque.stats();
+    EXPECT_EQ(stats.consumer_blocks, 1u);
+    EXPECT_GE(stats.consumer_blocked_ns, 40000000u);
+    EXPECT_GE(stats.consumer_wait.max, 40000000u);
+}
+
+TEST(DequeStatsTest, ConcurrentTotalsAreExact) {
+    AsyncDeque<int> deque(16);
+    constexpr int producers = 4;
+    constexpr int items = 2000;
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&] {
+            for (int i = 0; i < items; ++i) EXPECT_TRUE(deque.push_back(i));
+        });
+    }
+    std::thread consumer([&] {
+        for (int i = 0; i < producers * items; ++i) EXPECT_TRUE(deque.pop_front().has_value());
+    });
+    for (auto& t : threads) t.join();
+    consumer.join();
+
+    auto stats = deque.stats();
+    EXPECT_EQ(stats.pushes, static_cast<uint64_t>(producers * items));
+    EXPECT_EQ(stats.pops, static_cast<uint64_t>(producers * items));
+    EXPECT_LE(stats.high_water, 16u);
+    EXPECT_EQ(stats.lock_wait.count, stats.lock_contentions);
+}
+
+TEST(LockProfileTest, DisabledByDefault) {
+    AsyncDeque<int> deque;
+    EXPECT_FALSE(deque.lock_profiling_enabled());
+    EXPECT_TRUE(deque.push_back(1));
+    EXPECT_TRUE(deque.stats().lock_sites.empty());
+}
+
+TEST(LockProfileTest, RecordsPerCallSite) {
+    AsyncDeque<int> deque;
+    deque.enable_lock_profiling();
+    deque.enable_lock_profiling();  // idempotent
+    EXPECT_TRUE(deque.lock_profiling_enabled());
+
+    EXPECT_TRUE(deque.push_back(1));
+    EXPECT_TRUE(deque.push_back(2));
+    EXPECT_EQ(deque.size(), 2u);
+    EXPECT_EQ(deque.size(), 2u);
+    EXPECT_EQ(deque.size(), 2u);
+    EXPECT_TRUE(deque.pop_front().has_value());
+
+    auto sites = deque.stats().lock_sites;
+    ASSERT_EQ(sites.size(), static_cast<size_t>(CallSite::count_));
+    auto site = [&](CallSite s) { return sites[static_cast<size_t>(s)]; };
+    EXPECT_EQ(site(CallSite::push_back).acquisitions, 2u);
+    EXPECT_EQ(site(CallSite::size).acquisitions, 3u);
+    EXPECT_EQ(site(CallSite::pop_front).acquisitions, 1u);
+    EXPECT_EQ(site(CallSite::pop_back).acquisitions, 0u);
+    EXPECT_EQ(site(CallSite::size).hold.count, 3u);
+    EXPECT_STREQ(call_site_name(CallSite::try_pop_front), "try_pop_front");
+}
+
+TEST(LockProfileTest, HoldTimeExcludesBlocking) {
+    AsyncDeque<int> deque;
+    deque.enable_lock_profiling();
+    EXPECT_FALSE(deque.try_pop_front(50ms).has_value());
+
+    auto sites = deque.stats().lock_sites;
+    const auto& site = sites[static_cast<size_t>(CallSite::try_pop_front)];
+    EXPECT_EQ(site.acquisitions, 1u);
+    EXPECT_LT(site.hold.max, 10000000u);
+    EXPECT_GE(deque.stats().consumer_blocked_ns, 50000000u);
+}
+
+TEST(LockProfileTest, ContentionIsAttributed) {
+    AsyncDeque<int> deque;
+    deque.enable_lock_profiling();
+    std::atomic<bool> done{false};
+    std::thread monitor([&] {
+        while (!done) (void)deque.size();
+    });
+    for (int i = 0; i < 20000; ++i) {
+        EXPECT_TRUE(deque.push_back(i));
+        EXPECT_TRUE(deque.pop_front().has_value());
+    }
+    done = true;
+    monitor.join();
+
+    auto stats = deque.stats();
+    uint64_t contentions = 0;
+    uint64_t acquisitions = 0;
+    for (const auto& site : stats.lock_sites) {
+        contentions += site.contentions;
+        acquisitions += site.acquisitions;
+    }
+    EXPECT_EQ(contentions, stats.lock_contentions);
+    EXPECT_EQ(acquisitions, stats.lock_acquisitions);
+}
+
+TEST(WakeupStatsTest, CountsNotifiesAndWakeups) {
+    AsyncDeque<int> deque;
+    std::thread consumer([&] { EXPECT_TRUE(deque.pop_front().has_value()); });
+    std::this_thread::sleep_for(50ms);
+    EXPECT_TRUE(deque.push_back(1));
+    consumer.join();
+
+    auto stats = deque.stats();
+    EXPECT_EQ(stats.notifies, 2u);  // push and pop
+    EXPECT_GE(stats.consumer_wakeups, 1u);
+    EXPECT_EQ(stats.consumer_wakeups,
+              stats.consumer_wasted_wakeups + 1);
+    EXPECT_EQ(stats.wakeup_latency.count + stats.spurious_wakeups,
+              stats.consumer_wakeups + stats.producer_wakeups);
+    EXPECT_EQ(stats.producer_wakeups, 0u);
+}
+
+TEST(WakeupStatsTest, PushesDoNotWakeProducers) {
+    // Two producers block on a full queue. The pop wakes one of them; its push
+    // must only signal consumers, so the other producer keeps sleeping.
+    AsyncDeque<int> deque(1);
+    EXPECT_TRUE(deque.push_back(0));
+    std::thread p1([&] { EXPECT_TRUE(deque.push_back(1)); });
+    std::thread p2([&] { EXPECT_TRUE(deque.push_back(2)); });
+    std::this_thread::sleep_for(50ms);
+
+    EXPECT_TRUE(deque.pop_front().has_value());
+    std::this_thread::sleep_for(50ms);
+    EXPECT_TRUE(deque.pop_front().has_value());
+    EXPECT_TRUE(deque.pop_front().has_value());
+    p1.join();
+    p2.join();
+
+    // Each producer is woken once, by a pop, and then has room
+    auto stats = deque.stats();
+    EXPECT_EQ(stats.producer_blocks, 2u);
+    EXPECT_EQ(stats.producer_wakeups, 2u);
+    EXPECT_EQ(stats.producer_wasted_wakeups, 0u);
+}
+
+TEST(WakeupStatsTest, TimedWaitWithoutNotify) {
+    AsyncDeque<int> deque;
+    EXPECT_FALSE(deque.try_pop_front(20ms).has_value());
+    auto stats = deque.stats();
+    EXPECT_EQ(stats.pop_timeouts, 1u);
+    EXPECT_EQ(stats.notifies, 0u);
+    EXPECT_EQ(stats.consumer_wakeups, 0u);   // the timeout is not a wakeup
+    EXPECT_EQ(stats.consumer_wasted_wakeups, 0u);
+}
@@ -0,0 +1,119 @@
+#include <gtest/gtest.h>
+#include <async_deque/async_deque.hpp>
+#include <async_deque/trace.hpp>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <chrono>
+
+using namespace async_deque;
+using namespace std::chrono_literals;
+
+namespace {
+
+size_t count_occurrences(const std::string& text, const std::string& pattern) {
+    size_t count = 0;
+    for (size_t pos = text.find(pattern); pos != std::string::npos;
+         pos = text.find(pattern, pos + pattern.size())) {
+        ++count;
+    }
+    return count;
+}
+
+} // namespace
+
+class TracerTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        Tracer::instance().stop();
+        Tracer::instance().collect();  // discard events left by other tests
+    }
+
+    void TearDown() override {
+        Tracer::instance().stop();
+    }
+};
+
+TEST_F(TracerTest, DisabledRecordsNothing) {
+    AsyncDeque<int> deque;
+    EXPECT_TRUE(deque.push_back(1));
+    EXPECT_TRUE(deque.pop_front().has_value());
+    EXPECT_TRUE(Tracer::instance().collect().empty());
+}
+
+TEST_F(TracerTest, RecordsPushPopAndBlocking) {
+    AsyncDeque<int> deque;
+    Tracer::instance().set_queue_name(&deque, "jobs");
+    Tracer::instance().start();
+
+    std::thread consumer([&] { EXPECT_TRUE(deque.pop_front().has_value()); });
+    std::this_thread::sleep_for(20ms);
+    EXPECT_TRUE(deque.push_back(1));
+    consumer.join();
+    Tracer::instance().stop();
+
+    auto events = Tracer::instance().collect();
+    ASSERT_EQ(events.size(), 4u);
+    EXPECT_EQ(events[0].kind, TraceEventKind::block_begin);
+    EXPECT_FALSE(events[0].producer);
+    EXPECT_EQ(events[1].kind, TraceEventKind::push);
+    EXPECT_EQ(events[1].depth, 1u);
+    EXPECT_EQ(events[2].kind, TraceEventKind::block_end);
+    EXPECT_EQ(events[3].kind, TraceEventKind::pop);
+    EXPECT_EQ(events[3].depth, 0u);
+    EXPECT_EQ(events[0].thread_id, events[3].thread_id);
+    EXPECT_NE(events[0].thread_id, events[1].thread_id);
+    for (const auto& event : events) EXPECT_EQ(event.queue, &deque);
+}
+
+TEST_F(TracerTest, WritesChromeJson) {
+    AsyncDeque<int> deque(1);
+    Tracer::instance().set_queue_name(&deque, "out\"q");
+    Tracer::instance().start();
+    EXPECT_TRUE(deque.push_back(1));
+    EXPECT_FALSE(deque.try_push_back(2, 1ms));
+    EXPECT_TRUE(deque.pop_back().has_value());
+    Tracer::instance().stop();
+
+    std::ostringstream out;
+    Tracer::instance().write_chrome_json(out);
+    const std::string json = out.str();
+    EXPECT_EQ(json.rfind("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 0), 0u);
+    EXPECT_EQ(count_occurrences(json, "\"ph\":\"C\""), 2u);
+    EXPECT_EQ(count_occurrences(json, "\"ph\":\"B\""), 1u);
+    EXPECT_EQ(count_occurrences(json, "\"ph\":\"E\""), 1u);
+    EXPECT_NE(json.find("\"name\":\"wait for space out\\\"q\""), std::string::npos);
+    EXPECT_NE(json.find("\"name\":\"depth out\\\"q\""), std::string::npos);
+    EXPECT_EQ(json.substr(json.size() - 4), "\n]}\n");
+
+    // Events are consumed by the write
+    EXPECT_TRUE(Tracer::instance().collect().empty());
+}
+
+TEST_F(TracerTest, FullRingDropsEvents) {
+    std::thread worker([] {
+        Tracer::instance().start(4);
+        AsyncDeque<int> deque;
+        for (int i = 0; i < 10; ++i) EXPECT_TRUE(deque.push_back(i));
+        Tracer::instance().stop();
+    });
+    worker.join();
+    EXPECT_EQ(Tracer::instance().collect().size(), 4u);
+    EXPECT_GE(Tracer::instance().dropped(), 6u);
+    Tracer::instance().start();  // restore the default ring size for later threads
+    Tracer::instance().stop();
+}
+
+TEST_F(TracerTest, RingsOfExitedThreadsAreFreedOnceDrained) {
+    const size_t before = Tracer::instance().ring_count();
+    AsyncDeque<int> deque;
+    Tracer::instance().start();
+    std::thread worker([&] { EXPECT_TRUE(deque.push_back(1)); });
+    worker.join();
+    Tracer::instance().stop();
+    EXPECT_EQ(Tracer::instance().ring_count(), before + 1);
+
+    // The exited thread's event is still collected, and its ring goes with it
+    EXPECT_EQ(Tracer::instance().collect().size(), 1u);
+    EXPECT_EQ(Tracer::instance().ring_count(), before);
+}